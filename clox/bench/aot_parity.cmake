@@ -0,0 +1,44 @@
+# Checks that each script built with --emit-c behaves like the interpreter:
+# same exit status, same error output and the same printed result. Only the
+# last line of a successful run's output is compared, since builds with
+# DEBUG_TRACE_EXECUTION print a trace before the result.
+#
+#   cmake -DCLOX=<clox> -DNATIVE_DIR=<dir of aot_* executables>
+#         -DSCRIPTS_DIR=<dir of .lox files> -DSCRIPTS=a,b,c -P aot_parity.cmake
+
+string (REPLACE "," ";" SCRIPTS "${SCRIPTS}")
+
+function (last_line text result)
+    string (STRIP "${text}" text)
+    string (REGEX REPLACE "^.*\n" "" text "${text}")
+    set (${result} "${text}" PARENT_SCOPE)
+endfunction ()
+
+set (failures 0)
+foreach (script ${SCRIPTS})
+    execute_process (COMMAND "${CLOX}" "${SCRIPTS_DIR}/${script}.lox"
+        RESULT_VARIABLE interpreted_status OUTPUT_VARIABLE interpreted_output ERROR_VARIABLE interpreted_error)
+    execute_process (COMMAND "${NATIVE_DIR}/aot_${script}"
+        RESULT_VARIABLE native_status OUTPUT_VARIABLE native_output ERROR_VARIABLE native_error)
+
+    last_line ("${interpreted_output}" interpreted_output)
+    last_line ("${native_output}" native_output)
+    if (NOT interpreted_status EQUAL 0)
+        set (interpreted_output "${native_output}")
+    endif ()
+
+    if (NOT interpreted_status STREQUAL native_status
+        OR NOT interpreted_output STREQUAL native_output
+        OR NOT interpreted_error STREQUAL native_error)
+        message (SEND_ERROR "${script}: interpreter gave status ${interpreted_status}, "
+            "output '${interpreted_output}', errors '${interpreted_error}'; "
+            "native gave status ${native_status}, output '${native_output}', errors '${native_error}'")
+        math (EXPR failures "${failures} + 1")
+    else ()
+        message (STATUS "${script}: ok (status ${native_status}, '${native_output}')")
+    endif ()
+endforeach ()
+
+if (failures GREATER 0)
+    message (FATAL_ERROR "${failures} script(s) differ between the interpreter and --emit-c")
+endif ()
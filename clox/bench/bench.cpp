@@ -0,0 +1,211 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+#include "bench.h"
+
+#ifdef __linux__
+static cpu_set_t original_affinity;
+static bool have_original_affinity = false;
+#endif
+
+// Pins the benchmark to a single core so frequency scaling and migrations
+// between cores do not show up as noise in the samples.
+static void pin_thread(int cpu)
+{
+#ifdef __linux__
+    if (!have_original_affinity)
+        have_original_affinity = sched_getaffinity(0, sizeof(original_affinity), &original_affinity) == 0;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) != 0)
+        fprintf(stderr, "warning: could not pin to cpu %d\n", cpu);
+#else
+    (void)cpu;
+#endif
+}
+
+void bench_set_pinned(const BenchOptions& options, bool pinned)
+{
+#ifdef __linux__
+    if (pinned)
+        pin_thread(options.cpu);
+    else if (have_original_affinity)
+        sched_setaffinity(0, sizeof(original_affinity), &original_affinity);
+#else
+    (void)options;
+    (void)pinned;
+#endif
+}
+
+static double elapsed_ns(BenchBody body, void* context, uint64_t iterations)
+{
+    auto start = std::chrono::steady_clock::now();
+    body(context, iterations);
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count();
+}
+
+static double median(std::vector<double>& values)
+{
+    std::sort(values.begin(), values.end());
+    size_t mid = values.size() / 2;
+    if (values.size() % 2 == 0)
+        return (values[mid - 1] + values[mid]) / 2;
+    return values[mid];
+}
+
+bool bench_selected(const BenchOptions& options, const char* name)
+{
+    return options.filter.empty() || strstr(name, options.filter.c_str()) != nullptr;
+}
+
+BenchStats bench_measure(const BenchOptions& options, BenchBody body, void* context)
+{
+    const double min_sample_ns = options.min_sample_seconds * 1e9;
+
+    uint64_t iterations = 1;
+    for (;;)
+    {
+        double ns = elapsed_ns(body, context, iterations);
+        if (ns >= min_sample_ns)
+            break;
+        uint64_t scale = ns > 0 ? static_cast<uint64_t>(min_sample_ns / ns * 1.2) + 1 : 16;
+        iterations *= std::min<uint64_t>(std::max<uint64_t>(scale, 2), 16);
+    }
+
+    for (int i = 0; i < options.warmup; i++)
+        elapsed_ns(body, context, iterations);
+
+    std::vector<double> per_iteration;
+    for (int i = 0; i < options.samples; i++)
+        per_iteration.push_back(elapsed_ns(body, context, iterations) / iterations);
+
+    BenchStats stats = {};
+    stats.min_ns = *std::min_element(per_iteration.begin(), per_iteration.end());
+    stats.median_ns = median(per_iteration);
+
+    std::vector<double> deviations;
+    for (double value : per_iteration)
+        deviations.push_back(std::fabs(value - stats.median_ns));
+    stats.mad_ns = median(deviations);
+
+    return stats;
+}
+
+void bench_report(const char* name, const BenchStats& stats, double units_per_iteration, const char* unit)
+{
+    double rate = units_per_iteration / (stats.median_ns * 1e-9);
+    const char* scale = "";
+    if (rate >= 1e9)
+    {
+        rate /= 1e9;
+        scale = "G";
+    }
+    else if (rate >= 1e6)
+    {
+        rate /= 1e6;
+        scale = "M";
+    }
+    else if (rate >= 1e3)
+    {
+        rate /= 1e3;
+        scale = "k";
+    }
+
+    double noise = stats.median_ns > 0 ? 100.0 * stats.mad_ns / stats.median_ns : 0;
+    printf("%-44s %12.2f ns/iter %10.2f %s%s/s  (min %.2f, +-%.1f%%)\n",
+        name, stats.median_ns, rate, scale, unit, stats.min_ns, noise);
+    fflush(stdout);
+}
+
+bool read_corpus_file(const std::string& path, std::string& contents)
+{
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file)
+        return false;
+
+    char buffer[4096];
+    size_t read;
+    contents.clear();
+    while ((read = fread(buffer, 1, sizeof(buffer), file)) > 0)
+        contents.append(buffer, read);
+    fclose(file);
+
+    // Editors on Windows like to prepend a byte order mark; the scanner does not skip it.
+    if (contents.compare(0, 3, "\xEF\xBB\xBF") == 0)
+        contents.erase(0, 3);
+    return true;
+}
+
+static void usage()
+{
+    fprintf(stderr,
+        "Usage: clox_bench [options] [filter]\n"
+        "  --cpu N        pin to cpu N (default 0)\n"
+        "  --samples N    timed samples per benchmark (default 15)\n"
+        "  --warmup N     untimed warmup samples (default 2)\n"
+        "  --min-time S   minimum seconds per sample (default 0.02)\n"
+        "  --corpus FILE  add a Lox source to the scanner corpus\n"
+        "Only benchmarks whose name contains the filter are run.\n");
+    exit(64);
+}
+
+int main(int argc, const char* argv[])
+{
+    BenchOptions options;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char* arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (strcmp(arg, "--cpu") == 0 && has_value)
+            options.cpu = atoi(argv[++i]);
+        else if (strcmp(arg, "--samples") == 0 && has_value)
+            options.samples = std::max(1, atoi(argv[++i]));
+        else if (strcmp(arg, "--warmup") == 0 && has_value)
+            options.warmup = std::max(0, atoi(argv[++i]));
+        else if (strcmp(arg, "--min-time") == 0 && has_value)
+            options.min_sample_seconds = atof(argv[++i]);
+        else if (strcmp(arg, "--corpus") == 0 && has_value)
+            options.corpus.push_back(argv[++i]);
+        else if (arg[0] == '-')
+            usage();
+        else
+            options.filter = arg;
+    }
+
+    if (options.corpus.empty())
+    {
+        options.corpus.push_back(CLOX_BENCH_CORPUS "/fibonacci.lox");
+        options.corpus.push_back(CLOX_BENCH_CORPUS "/counter.lox");
+    }
+
+    pin_thread(options.cpu);
+
+    bench_aio(options);
+    bench_fiber(options);
+    bench_globals(options);
+    bench_hash(options);
+    bench_heap(options);
+    bench_intern(options);
+    bench_number(options);
+    bench_output(options);
+    bench_pool(options);
+    bench_program(options);
+    bench_scanner(options);
+    bench_snapshot(options);
+    bench_table(options);
+    bench_vm(options);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Options shared by every benchmark in the suite. A measurement first
+// calibrates the number of iterations so one sample takes at least
+// `min_sample_seconds`, then runs `warmup` untimed samples of that many
+// iterations, and finally records `samples` timed samples. The median is
+// reported; the median absolute deviation gives an idea of how noisy the
+// run was.
+struct BenchOptions
+{
+    int warmup = 2;
+    int samples = 15;
+    double min_sample_seconds = 0.02;
+    int cpu = 0;
+    std::string filter;
+    std::vector<std::string> corpus;
+};
+
+struct BenchStats
+{
+    double median_ns;
+    double min_ns;
+    double mad_ns;
+};
+
+// Keeps the optimizer from discarding a result that is otherwise unused.
+template<typename T>
+inline void do_not_optimize(const T& value)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    asm volatile("" : : "r,m"(value) : "memory");
+#else
+    static volatile const void* sink;
+    sink = &value;
+#endif
+}
+
+typedef void (*BenchBody)(void* context, uint64_t iterations);
+
+bool bench_selected(const BenchOptions& options, const char* name);
+BenchStats bench_measure(const BenchOptions& options, BenchBody body, void* context);
+
+// Prints one result line. `units_per_iteration` is how many units (bytes,
+// tokens, operations) a single iteration processes, `unit` their name.
+void bench_report(const char* name, const BenchStats& stats, double units_per_iteration, const char* unit);
+
+// Convenience wrapper: measures a lambda taking the iteration count.
+template<typename TFn>
+void bench_run(const BenchOptions& options, const char* name, double units_per_iteration, const char* unit, TFn&& fn)
+{
+    if (!bench_selected(options, name))
+        return;
+
+    BenchBody body = [](void* context, uint64_t iterations) { (*static_cast<TFn*>(context))(iterations); };
+    BenchStats stats = bench_measure(options, body, &fn);
+    bench_report(name, stats, units_per_iteration, unit);
+}
+
+// Threads inherit the affinity of the thread that creates them, so
+// multi-threaded benchmarks lift the pin while they run.
+void bench_set_pinned(const BenchOptions& options, bool pinned);
+
+bool read_corpus_file(const std::string& path, std::string& contents);
+
+void bench_aio(const BenchOptions& options);
+void bench_fiber(const BenchOptions& options);
+void bench_globals(const BenchOptions& options);
+void bench_hash(const BenchOptions& options);
+void bench_heap(const BenchOptions& options);
+void bench_intern(const BenchOptions& options);
+void bench_number(const BenchOptions& options);
+void bench_output(const BenchOptions& options);
+void bench_pool(const BenchOptions& options);
+void bench_program(const BenchOptions& options);
+void bench_scanner(const BenchOptions& options);
+void bench_snapshot(const BenchOptions& options);
+void bench_table(const BenchOptions& options);
+void bench_vm(const BenchOptions& options);
@@ -0,0 +1,162 @@
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "aio.h"
+#include "bench.h"
+#include "compiler.h"
+#include "vm.h"
+
+static const int FILES = 2000;
+static const int FILE_SIZE = 4096;
+static const char* FILES_DIR = "clox_bench_files";
+
+static std::string file_path(int file)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "%s/%04d.txt", FILES_DIR, file);
+    return path;
+}
+
+static std::string file_contents(int file)
+{
+    std::string contents = "file " + std::to_string(file) + "\n";
+    while (contents.size() < FILE_SIZE)
+        contents += static_cast<char>('a' + contents.size() % 26);
+    return contents;
+}
+
+// Each script reads its file, checks it and then does some arithmetic, so
+// with an I/O loop the other fibers compute while reads are in flight.
+static std::string script_source(int file)
+{
+    std::string source = "(read \"" + file_path(file) + "\" == \"" + file_contents(file) + "\") == (0";
+    for (int i = 0; i < 64; i++)
+        source += " + " + std::to_string(i) + " * 1.5 / 3";
+    return source + " > 0)";
+}
+
+static bool write_files()
+{
+    std::error_code error;
+    std::filesystem::create_directory(FILES_DIR, error);
+    for (int i = 0; i < FILES; i++)
+    {
+        FILE* file = fopen(file_path(i).c_str(), "wb");
+        std::string contents = file_contents(i);
+        bool written = file && fwrite(contents.data(), 1, contents.size(), file) == contents.size();
+        if (file && fclose(file) != 0)
+            written = false;
+        if (!written)
+            return false;
+    }
+    return true;
+}
+
+// Drops the files from the page cache, so reads go to the device. Not
+// every file system honours it.
+static void evict_files()
+{
+#ifdef __linux__
+    for (int i = 0; i < FILES; i++)
+    {
+        int fd = open(file_path(i).c_str(), O_RDONLY);
+        if (fd < 0)
+            continue;
+        fdatasync(fd);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+#endif
+}
+
+static std::string run_scripts(VM& vm, std::vector<Chunk>& chunks, IoLoop* io)
+{
+    vm.output.count = 0;
+    vm.io = io;
+    for (Chunk& chunk : chunks)
+        spawn_fiber(vm, chunk);
+    InterpretResult result = run_fibers(vm);
+    vm.io = nullptr;
+    return result == INTERPRET_OK ? std::string(vm.output.buffer, vm.output.count) : "error";
+}
+
+void bench_aio(const BenchOptions& options)
+{
+    if (!bench_selected(options, "aio/"))
+        return;
+
+    Output output;
+    init_output_memory(output);
+    VM vm = {};
+    init_vm(vm, output);
+
+    std::vector<Chunk> chunks(FILES);
+    bool ok = write_files();
+    for (int i = 0; i < FILES; i++)
+    {
+        init_chunk(chunks[static_cast<size_t>(i)]);
+        ok = ok && compile(script_source(i).c_str(), chunks[static_cast<size_t>(i)]);
+    }
+
+    IoLoop* threads = start_io(false);
+    IoLoop* uring = start_io(true);
+    if (io_backend(*uring) != IO_BACKEND_URING)
+        printf("%-44s io_uring unavailable, threads measured twice\n", "aio/uring");
+
+    std::string expected;
+    for (int i = 0; i < FILES; i++)
+        expected += "true\n";
+    struct Mode
+    {
+        const char* name;
+        IoLoop* io;
+    };
+    const Mode modes[] = { { "blocking", nullptr }, { "threads", threads }, { "uring", uring } };
+    for (const Mode& mode : modes)
+    {
+        if (ok && run_scripts(vm, chunks, mode.io) != expected)
+        {
+            fprintf(stderr, "error: %s reads gave a wrong result\n", mode.name);
+            ok = false;
+        }
+    }
+
+    if (ok)
+    {
+        for (const Mode& mode : modes)
+        {
+            std::string name = std::string("aio/warm/") + mode.name;
+            bench_run(options, name.c_str(), FILES, "file", [&](uint64_t iterations) {
+                for (uint64_t i = 0; i < iterations; i++)
+                    run_scripts(vm, chunks, mode.io);
+            });
+        }
+        // Eviction is timed too, the same for every mode.
+        for (const Mode& mode : modes)
+        {
+            std::string name = std::string("aio/cold/") + mode.name;
+            bench_run(options, name.c_str(), FILES, "file", [&](uint64_t iterations) {
+                for (uint64_t i = 0; i < iterations; i++)
+                {
+                    evict_files();
+                    run_scripts(vm, chunks, mode.io);
+                }
+            });
+        }
+    }
+
+    stop_io(uring);
+    stop_io(threads);
+    for (Chunk& chunk : chunks)
+        free_chunk(chunk);
+    free_vm(vm);
+    std::error_code error;
+    std::filesystem::remove_all(FILES_DIR, error);
+}
@@ -0,0 +1,79 @@
+#include <cstdio>
+#include <string>
+
+#include "bench.h"
+#include "compiler.h"
+#include "fiber.h"
+#include "vm.h"
+
+static const int YIELDS = 8;
+
+// Each fiber stands in for a request handler that waits eight times, with
+// a value or two on its stack at each wait.
+static std::string handler_source()
+{
+    std::string source = "1";
+    for (int i = 0; i < YIELDS; i++)
+        source += " + (yield " + std::to_string(i + 2) + ") * 2";
+    return source;
+}
+
+static InterpretResult run_handlers(VM& vm, Chunk& chunk, int fibers)
+{
+    vm.output.count = 0;
+    for (int i = 0; i < fibers; i++)
+        spawn_fiber(vm, chunk);
+    return run_fibers(vm);
+}
+
+void bench_fiber(const BenchOptions& options)
+{
+    if (!bench_selected(options, "fiber/"))
+        return;
+
+    Output output;
+    init_output_memory(output);
+    VM vm = {};
+    init_vm(vm, output);
+
+    std::string source = handler_source();
+    Chunk chunk;
+    init_chunk(chunk);
+    if (!compile(source.c_str(), chunk) || interpret(vm, chunk) != INTERPRET_OK)
+    {
+        fprintf(stderr, "error: fiber benchmark source does not run\n");
+        free_chunk(chunk);
+        free_vm(vm);
+        return;
+    }
+    std::string line(vm.output.buffer, vm.output.count);
+
+    for (int fibers : { 10000, 100000 })
+    {
+        // Every fiber must print what the source prints on its own.
+        vm.fiber_peak = 0;
+        std::string expected;
+        for (int i = 0; i < fibers; i++)
+            expected += line;
+        if (run_handlers(vm, chunk, fibers) != INTERPRET_OK ||
+            std::string(vm.output.buffer, vm.output.count) != expected || vm.fiber_bytes != 0)
+        {
+            fprintf(stderr, "error: %d fibers gave a wrong result\n", fibers);
+            break;
+        }
+
+        char name[64];
+        snprintf(name, sizeof(name), "fiber/bytes_per_fiber/%d", fibers);
+        printf("%-44s %12d bytes\n", name, static_cast<int>(vm.fiber_peak / static_cast<size_t>(fibers)));
+
+        // Spawning, every switch and every fiber's return, per switch.
+        snprintf(name, sizeof(name), "fiber/switch/%d", fibers);
+        bench_run(options, name, static_cast<double>(fibers) * YIELDS, "switch", [&](uint64_t iterations) {
+            for (uint64_t i = 0; i < iterations; i++)
+                run_handlers(vm, chunk, fibers);
+        });
+    }
+
+    free_chunk(chunk);
+    free_vm(vm);
+}
@@ -0,0 +1,107 @@
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "bench.h"
+#include "compiler.h"
+#include "globals.h"
+#include "intern.h"
+#include "table.h"
+#include "vm.h"
+
+static const int LOOP_ITERATIONS = 100 * 100;
+static const int NAMES = 64;
+
+// The nested loops of vm/locals with every variable declared up front,
+// at the top level as globals or in a block as locals.
+static std::string loop_source(bool globals)
+{
+    std::string body =
+        "var total = 0; var i = 0; var j = 0; var k = 0; var row = 0;\n"
+        "while (i < 100) {\n"
+        "  row = 0; j = 0;\n"
+        "  while (j < 100) { k = i * j; row = row + k - j; j = j + 1; }\n"
+        "  total = total + row; i = i + 1;\n"
+        "}\n";
+    return globals ? body : "{\n" + body + "}\n";
+}
+
+static void bench_loop(const BenchOptions& options, VM& vm, const char* name, bool globals)
+{
+    if (!bench_selected(options, name))
+        return;
+
+    std::string source = loop_source(globals);
+    Chunk chunk;
+    init_chunk(chunk);
+    if (!compile(source.c_str(), chunk) || interpret(vm, chunk) != INTERPRET_OK)
+    {
+        fprintf(stderr, "error: %s source does not run\n", name);
+        free_chunk(chunk);
+        return;
+    }
+
+    bench_run(options, name, LOOP_ITERATIONS, "iteration", [&](uint64_t iterations) {
+        for (uint64_t i = 0; i < iterations; i++)
+            interpret(vm, chunk);
+    });
+    free_chunk(chunk);
+}
+
+void bench_globals(const BenchOptions& options)
+{
+    if (!bench_selected(options, "globals/"))
+        return;
+
+    Output output;
+    init_output_memory(output);
+    VM vm = {};
+    init_vm(vm, output);
+    vm.optimize = false;
+
+    bench_loop(options, vm, "globals/loop/globals", true);
+    bench_loop(options, vm, "globals/loop/locals", false);
+
+    // One read of a defined global, by slot through a chunk's links as
+    // OP_GET_GLOBAL does it, and by name from a table of interned names, as
+    // a table of globals would.
+    std::vector<ObjString*> names;
+    std::vector<int> slots;
+    Table table;
+    init_table(table);
+    for (int i = 0; i < NAMES; i++)
+    {
+        std::string name = "bench_global_" + std::to_string(i);
+        names.push_back(intern_string(name.c_str(), static_cast<int>(name.size())));
+        slots.push_back(global_slot(vm.globals, names.back()));
+        table_set(table, names.back(), number_val(i));
+    }
+    for (int i = 0; i < NAMES; i++)
+        vm.globals.values[slots[static_cast<size_t>(i)]] = number_val(i);
+
+    bench_run(options, "globals/get/slot", NAMES, "op", [&](uint64_t iterations) {
+        double sum = 0;
+        for (uint64_t n = 0; n < iterations; n++)
+            for (int i = 0; i < NAMES; i++)
+            {
+                Value value = vm.globals.values[slots[static_cast<size_t>(i)]];
+                if (!is_undefined(value))
+                    sum += as_number(value);
+            }
+        do_not_optimize(sum);
+    });
+    bench_run(options, "globals/get/table", NAMES, "op", [&](uint64_t iterations) {
+        double sum = 0;
+        for (uint64_t n = 0; n < iterations; n++)
+            for (int i = 0; i < NAMES; i++)
+            {
+                Value value;
+                if (table_get(table, names[static_cast<size_t>(i)], value))
+                    sum += as_number(value);
+            }
+        do_not_optimize(sum);
+    });
+
+    free_table(table);
+    free_vm(vm);
+}
@@ -0,0 +1,68 @@
+#include <cstdio>
+#include <vector>
+
+#include "bench.h"
+#include "hash.h"
+
+static const size_t KEY_LENGTHS[] = {
+    1, 2, 3, 4, 7, 8, 12, 15, 16, 17, 24, 31, 32, 33, 48, 64, 100, 128, 256, 512, 1024, 4096,
+};
+
+// Keys up to this length take the short-key path, which is measured once per
+// implementation the CPU supports.
+static constexpr size_t SHORT_KEY_MAX = 32;
+
+// Number of distinct start offsets the keys are drawn from. Rotating through
+// them keeps the hash from being hoisted out of the loop and exercises
+// unaligned loads the way real string contents do.
+static constexpr size_t KEY_OFFSETS = 64;
+
+static void bench_hash_lengths(const BenchOptions& options, const std::vector<uint8_t>& buffer, const char* label,
+    HashImplementation implementation, size_t max_length)
+{
+    for (size_t length : KEY_LENGTHS)
+    {
+        if (length > max_length)
+            break;
+
+        char name[64];
+
+        snprintf(name, sizeof(name), "hash64/%s/%zu", label, length);
+        bench_run(options, name, static_cast<double>(length), "B", [&](uint64_t iterations) {
+            uint64_t acc = 0;
+            for (uint64_t i = 0; i < iterations; i++)
+                acc += hash64_using(implementation, buffer.data() + (i % KEY_OFFSETS), length);
+            do_not_optimize(acc);
+        });
+
+        snprintf(name, sizeof(name), "hash32/%s/%zu", label, length);
+        bench_run(options, name, static_cast<double>(length), "B", [&](uint64_t iterations) {
+            uint32_t acc = 0;
+            for (uint64_t i = 0; i < iterations; i++)
+                acc += hash_truncate(hash64_using(implementation, buffer.data() + (i % KEY_OFFSETS), length));
+            do_not_optimize(acc);
+        });
+    }
+}
+
+void bench_hash(const BenchOptions& options)
+{
+    std::vector<uint8_t> buffer(4096 + KEY_OFFSETS);
+    uint64_t state = 0x243F6A8885A308D3ULL;
+    for (uint8_t& byte : buffer)
+    {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        byte = static_cast<uint8_t>(state >> 56);
+    }
+
+    // Each implementation is called directly: earlier suites have interned
+    // strings, so the process's implementation can no longer be switched.
+    static const HashImplementation IMPLEMENTATIONS[] = { HASH_PORTABLE, HASH_CRC32C };
+    for (HashImplementation implementation : IMPLEMENTATIONS)
+    {
+        if (hash_implementation_supported(implementation))
+            bench_hash_lengths(options, buffer, hash_implementation_name(implementation), implementation, SHORT_KEY_MAX);
+    }
+
+    bench_hash_lengths(options, buffer, "long", hash_implementation(), SIZE_MAX);
+}
@@ -0,0 +1,70 @@
+#include <cstdio>
+#include <string>
+
+#include "bench.h"
+#include "compiler.h"
+#include "vm.h"
+
+// Builds a string of a few kilobytes from many small pieces, so most of
+// the time goes to concatenation and its accounting.
+static std::string concatenation_source()
+{
+    std::string source = "\"start\"";
+    for (int i = 0; i < 200; i++)
+        source += " + \"piece " + std::to_string(i) + "\"";
+    return source + " == \"\"";
+}
+
+static InterpretResult run_limited(VM& vm, Chunk& chunk, size_t limit)
+{
+    vm.output.count = 0;
+    vm.objects.limit = limit;
+    InterpretResult result = interpret(vm, chunk);
+    free_objects(vm.objects);
+    return result;
+}
+
+void bench_heap(const BenchOptions& options)
+{
+    if (!bench_selected(options, "heap/"))
+        return;
+
+    Output output;
+    init_output_memory(output);
+    VM vm = {};
+    init_vm(vm, output);
+    vm.optimize = false;
+
+    std::string source = concatenation_source();
+    Chunk chunk;
+    init_chunk(chunk);
+    bool ok = compile(source.c_str(), chunk);
+    size_t bytes = 0;
+    if (ok)
+    {
+        ok = interpret(vm, chunk) == INTERPRET_OK;
+        bytes = vm.objects.bytes;
+        free_objects(vm.objects);
+    }
+    if (!ok || run_limited(vm, chunk, bytes) != INTERPRET_OK)
+    {
+        fprintf(stderr, "error: heap benchmark source does not run within its own footprint\n");
+        free_chunk(chunk);
+        free_vm(vm);
+        return;
+    }
+    printf("%-44s %12d bytes\n", "heap/footprint", static_cast<int>(bytes));
+
+    // The accounting is always on; a limit adds one comparison per object.
+    bench_run(options, "heap/concatenate/unlimited", 200, "concat", [&](uint64_t iterations) {
+        for (uint64_t i = 0; i < iterations; i++)
+            run_limited(vm, chunk, 0);
+    });
+    bench_run(options, "heap/concatenate/limited", 200, "concat", [&](uint64_t iterations) {
+        for (uint64_t i = 0; i < iterations; i++)
+            run_limited(vm, chunk, bytes);
+    });
+
+    free_chunk(chunk);
+    free_vm(vm);
+}
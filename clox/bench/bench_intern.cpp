@@ -0,0 +1,129 @@
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bench.h"
+#include "compiler.h"
+#include "intern.h"
+#include "vm.h"
+
+static std::vector<std::string> make_keys(int count, const char* prefix)
+{
+    std::vector<std::string> keys;
+    for (int i = 0; i < count; i++)
+        keys.push_back(prefix + std::to_string(i * 7919));
+    return keys;
+}
+
+static size_t heap_bytes(const ObjList& objects)
+{
+    size_t bytes = 0;
+    for (Obj* object = objects.head; object != nullptr; object = object->next)
+        bytes += sizeof(ObjString) + static_cast<size_t>(reinterpret_cast<ObjString*>(object)->length) + 1;
+    return bytes;
+}
+
+// Threads interning the same keys at once, in different orders, must all
+// get the same object for each key.
+static bool verify_concurrent_interning()
+{
+    const int THREADS = 8;
+    std::vector<std::string> keys = make_keys(4096, "intern-check-");
+    std::vector<std::vector<ObjString*>> results(THREADS, std::vector<ObjString*>(keys.size()));
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < THREADS; t++)
+    {
+        threads.emplace_back([&, t]() {
+            for (size_t i = 0; i < keys.size(); i++)
+            {
+                size_t k = t % 2 ? keys.size() - 1 - i : i;
+                results[t][k] = intern_string(keys[k].c_str(), static_cast<int>(keys[k].size()));
+            }
+        });
+    }
+    for (std::thread& thread : threads)
+        thread.join();
+
+    for (size_t k = 0; k < keys.size(); k++)
+    {
+        for (int t = 1; t < THREADS; t++)
+        {
+            if (results[t][k] != results[0][k] || results[0][k]->chars != keys[k])
+            {
+                fprintf(stderr, "error: \"%s\" interned as different objects\n", keys[k].c_str());
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+void bench_intern(const BenchOptions& options)
+{
+    if (!bench_selected(options, "intern/"))
+        return;
+
+    bench_set_pinned(options, false);
+    bool verified = verify_concurrent_interning();
+    bench_set_pinned(options, true);
+    if (!verified)
+        return;
+
+    const int COUNT = 1024;
+    std::vector<std::string> keys = make_keys(COUNT, "intern-key-");
+    std::vector<ObjString*> interned;
+    for (const std::string& key : keys)
+        interned.push_back(intern_string(key.c_str(), static_cast<int>(key.size())));
+
+    bench_run(options, "intern/lookup", COUNT, "str", [&](uint64_t iterations) {
+        for (uint64_t i = 0; i < iterations; i++)
+            for (const std::string& key : keys)
+                do_not_optimize(intern_string(key.c_str(), static_cast<int>(key.size())));
+    });
+
+    // Comparing a string with an equal one: two copies compare their
+    // characters, interned strings compare pointers.
+    ObjList copies = {};
+    std::vector<Value> copied;
+    for (const std::string& key : keys)
+        copied.push_back(obj_val(copy_string(copies, key.c_str(), static_cast<int>(key.size()))));
+    for (int other = 0; other < 2; other++)
+    {
+        const char* name = other ? "intern/equal/copies" : "intern/equal/interned";
+        bench_run(options, name, COUNT, "cmp", [&](uint64_t iterations) {
+            int equal = 0;
+            for (uint64_t i = 0; i < iterations; i++)
+                for (int k = 0; k < COUNT; k++)
+                    equal += values_equal(obj_val(interned[k]), other ? copied[k] : obj_val(interned[k]));
+            do_not_optimize(equal);
+        });
+    }
+    free_objects(copies);
+
+    // What a VM's heap holds after compiling a script full of literals,
+    // against what it held when every literal was copied into it.
+    std::string source;
+    for (int i = 0; i < 200; i++)
+        source += (i ? " + \"" : "\"") + keys[static_cast<size_t>(i)] + "\"";
+    Output output;
+    init_output_memory(output);
+    VM vm = {};
+    init_vm(vm, output);
+    Chunk chunk;
+    init_chunk(chunk);
+    if (compile(source.c_str(), chunk))
+    {
+        ObjList copied_literals = {};
+        for (int i = 0; i < chunk.constants.count; i++)
+        {
+            ObjString* literal = as_string(chunk.constants.values[i]);
+            copy_string(copied_literals, literal->chars, literal->length);
+        }
+        printf("%-44s %12zu bytes (%zu with copied literals)\n", "intern/isolate_heap", heap_bytes(vm.objects), heap_bytes(copied_literals));
+        free_objects(copied_literals);
+    }
+    free_chunk(chunk);
+    free_vm(vm);
+}
@@ -0,0 +1,129 @@
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "bench.h"
+#include "number.h"
+
+static uint64_t next_random(uint64_t& state)
+{
+    state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+    return state >> 11;
+}
+
+// Literals the way scripts write them: mostly short integers and decimals,
+// with a tail of long mantissas and big or tiny magnitudes that miss the
+// fast path.
+static std::string random_literal(uint64_t& state)
+{
+    char text[64];
+    uint64_t shape = next_random(state) % 8;
+    if (shape < 3)
+        snprintf(text, sizeof(text), "%llu", static_cast<unsigned long long>(next_random(state) % 100000));
+    else if (shape < 6)
+        snprintf(text, sizeof(text), "%llu.%llu", static_cast<unsigned long long>(next_random(state) % 1000),
+                 static_cast<unsigned long long>(next_random(state) % 1000));
+    else if (shape < 7)
+        snprintf(text, sizeof(text), "%llu.%llu", static_cast<unsigned long long>(next_random(state)),
+                 static_cast<unsigned long long>(next_random(state)));
+    else
+        snprintf(text, sizeof(text), "%.17f", static_cast<double>(next_random(state)) * 1e-20);
+    return text;
+}
+
+static double random_double(uint64_t& state)
+{
+    uint64_t shape = next_random(state) % 4;
+    if (shape < 2)
+        return static_cast<double>(next_random(state) % 100000);
+    if (shape < 3)
+        return static_cast<double>(next_random(state) % 100000) / 100;
+    uint64_t bits = next_random(state) << 11 | next_random(state) % 2048;
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return std::isfinite(value) ? value : 1.0 / 3.0;
+}
+
+// Both directions must agree with strtod exactly, or the timings mean nothing.
+static bool verify_numbers(const std::vector<std::string>& literals, const std::vector<double>& values)
+{
+    for (const std::string& literal : literals)
+    {
+        double expected = strtod(literal.c_str(), nullptr);
+        double actual = parse_number(literal.c_str(), static_cast<int>(literal.size()));
+        if (memcmp(&expected, &actual, sizeof(double)) != 0)
+        {
+            fprintf(stderr, "error: parse_number(\"%s\") = %.17g, strtod gives %.17g\n", literal.c_str(), actual, expected);
+            return false;
+        }
+    }
+
+    for (double value : values)
+    {
+        char buffer[NUMBER_BUFFER_SIZE];
+        format_number(value, buffer);
+        double round_trip = strtod(buffer, nullptr);
+        if (memcmp(&value, &round_trip, sizeof(double)) != 0)
+        {
+            fprintf(stderr, "error: format_number(%.17g) = \"%s\" does not round-trip\n", value, buffer);
+            return false;
+        }
+    }
+    return true;
+}
+
+void bench_number(const BenchOptions& options)
+{
+    if (!bench_selected(options, "number/"))
+        return;
+
+    static constexpr size_t COUNT = 4096;
+    uint64_t state = 0x13198A2E03707344ULL;
+
+    std::vector<std::string> literals;
+    std::vector<double> values;
+    for (size_t i = 0; i < COUNT; i++)
+    {
+        literals.push_back(random_literal(state));
+        values.push_back(random_double(state));
+    }
+
+    if (!verify_numbers(literals, values))
+        return;
+
+    bench_run(options, "number/parse/parse_number", 1, "num", [&](uint64_t iterations) {
+        double acc = 0;
+        for (uint64_t i = 0; i < iterations; i++)
+        {
+            const std::string& literal = literals[i % COUNT];
+            acc += parse_number(literal.c_str(), static_cast<int>(literal.size()));
+        }
+        do_not_optimize(acc);
+    });
+
+    bench_run(options, "number/parse/strtod", 1, "num", [&](uint64_t iterations) {
+        double acc = 0;
+        for (uint64_t i = 0; i < iterations; i++)
+            acc += strtod(literals[i % COUNT].c_str(), nullptr);
+        do_not_optimize(acc);
+    });
+
+    bench_run(options, "number/format/format_number", 1, "num", [&](uint64_t iterations) {
+        char buffer[NUMBER_BUFFER_SIZE];
+        uint64_t acc = 0;
+        for (uint64_t i = 0; i < iterations; i++)
+            acc += format_number(values[i % COUNT], buffer);
+        do_not_optimize(acc);
+    });
+
+    bench_run(options, "number/format/snprintf_g", 1, "num", [&](uint64_t iterations) {
+        char buffer[NUMBER_BUFFER_SIZE];
+        uint64_t acc = 0;
+        for (uint64_t i = 0; i < iterations; i++)
+            acc += snprintf(buffer, sizeof(buffer), "%g", values[i % COUNT]);
+        do_not_optimize(acc);
+    });
+}
@@ -0,0 +1,112 @@
+#include <cstdio>
+#include <vector>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#define open _open
+#define close _close
+#define NULL_DEVICE "NUL"
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#define NULL_DEVICE "/dev/null"
+#endif
+
+#include "bench.h"
+#include "object.h"
+#include "output.h"
+
+// What OP_RETURN used to do: one printf per value plus one for the newline.
+static void print_value_stdio(FILE* file, Value value)
+{
+    switch (value.type)
+    {
+    case VAL_NIL:
+        fprintf(file, "nil");
+        break;
+    case VAL_BOOL:
+        fprintf(file, as_bool(value) ? "true" : "false");
+        break;
+    case VAL_NUMBER:
+        fprintf(file, "%g", as_number(value));
+        break;
+    case VAL_OBJ:
+        fprintf(file, "%s", as_cstring(value));
+        break;
+    }
+    fprintf(file, "\n");
+}
+
+void bench_output(const BenchOptions& options)
+{
+    if (!bench_selected(options, "output/"))
+        return;
+
+    ObjList objects = {};
+    std::vector<Value> values;
+    for (int i = 0; i < 1024; i++)
+    {
+        char text[32];
+        int length = snprintf(text, sizeof(text), "row %d", i);
+        switch (i % 4)
+        {
+        case 0: values.push_back(number_val(i)); break;
+        case 1: values.push_back(number_val(i * 0.25)); break;
+        case 2: values.push_back(obj_val(copy_string(objects, text, length))); break;
+        case 3: values.push_back(bool_val(i % 8 == 3)); break;
+        }
+    }
+    double count = static_cast<double>(values.size());
+
+    FILE* file = fopen(NULL_DEVICE, "w");
+    int fd = open(NULL_DEVICE, O_WRONLY);
+    if (!file || fd < 0)
+    {
+        fprintf(stderr, "warning: could not open " NULL_DEVICE "\n");
+        if (file)
+            fclose(file);
+        if (fd >= 0)
+            close(fd);
+        free_objects(objects);
+        return;
+    }
+
+    bench_run(options, "output/printf", count, "value", [&](uint64_t iterations) {
+        for (uint64_t i = 0; i < iterations; i++)
+            for (Value value : values)
+                print_value_stdio(file, value);
+        fflush(file);
+    });
+
+    bench_run(options, "output/buffered_fd", count, "value", [&](uint64_t iterations) {
+        Output out;
+        init_output_fd(out, fd);
+        for (uint64_t i = 0; i < iterations; i++)
+            for (Value value : values)
+            {
+                write_value(out, value);
+                write_output(out, '\n');
+            }
+        free_output(out);
+    });
+
+    bench_run(options, "output/memory", count, "value", [&](uint64_t iterations) {
+        Output out;
+        init_output_memory(out);
+        for (uint64_t i = 0; i < iterations; i++)
+        {
+            out.count = 0;
+            for (Value value : values)
+            {
+                write_value(out, value);
+                write_output(out, '\n');
+            }
+        }
+        free_output(out);
+    });
+
+    fclose(file);
+    close(fd);
+    free_objects(objects);
+}
@@ -0,0 +1,93 @@
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "bench.h"
+#include "pool.h"
+
+// A small script per job: enough arithmetic and string work that the job,
+// not the queue, is most of the cost.
+static std::string job_source()
+{
+    std::string source = "(";
+    for (int i = 0; i < 40; i++)
+    {
+        char term[64];
+        snprintf(term, sizeof(term), "%s%d * 1.5 - %d / 4", i == 0 ? "" : " + ", i, i + 3);
+        source += term;
+    }
+    source += " > 0) == (\"batch\" + \"-\" + \"job\" == \"batch-job\")";
+    return source;
+}
+
+// Every job of a batch has to print what one VM prints for the script.
+static bool verify_batch(Pool& pool, std::vector<PoolJob>& jobs)
+{
+    wait_pool(pool);
+    for (const PoolJob& job : jobs)
+    {
+        std::string printed(job.output.buffer, job.output.count);
+        if (job.result != INTERPRET_OK || printed != "true\n")
+        {
+            fprintf(stderr, "error: pool job printed \"%s\"\n", printed.c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+void bench_pool(const BenchOptions& options)
+{
+    if (!bench_selected(options, "pool/"))
+        return;
+
+    std::string source = job_source();
+    Program* program = compile_program(source.c_str());
+    if (program == nullptr)
+    {
+        fprintf(stderr, "error: pool benchmark source does not compile\n");
+        return;
+    }
+
+    const int BATCH = 512;
+    std::vector<PoolJob> jobs(BATCH);
+    for (PoolJob& job : jobs)
+        init_job(job);
+
+    bench_set_pinned(options, false);
+    for (int workers = 1; workers <= 32; workers *= 2)
+    {
+        Pool* pool = start_pool({ workers, false, false, 0 });
+
+        // Jobs compiling their own source, then jobs sharing one program.
+        for (int shared = 0; shared < 2; shared++)
+        {
+            for (PoolJob& job : jobs)
+            {
+                job.source = shared ? nullptr : source.c_str();
+                job.program = shared ? program : nullptr;
+                submit_job(*pool, job);
+            }
+            if (!verify_batch(*pool, jobs))
+                break;
+
+            char name[64];
+            snprintf(name, sizeof(name), "pool/%s/%d", shared ? "program" : "source", workers);
+            bench_run(options, name, BATCH, "job", [&](uint64_t iterations) {
+                for (uint64_t i = 0; i < iterations; i++)
+                {
+                    for (PoolJob& job : jobs)
+                        submit_job(*pool, job);
+                    wait_pool(*pool);
+                }
+            });
+        }
+
+        stop_pool(pool);
+    }
+    bench_set_pinned(options, true);
+
+    for (PoolJob& job : jobs)
+        free_job(job);
+    release_program(program);
+}
@@ -0,0 +1,124 @@
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bench.h"
+#include "program.h"
+#include "vm.h"
+
+// Stands in for a script a service evaluates on every request: a few
+// hundred bytes of arithmetic and one string comparison.
+static std::string request_source()
+{
+    std::string source = "(";
+    for (int i = 0; i < 20; i++)
+    {
+        char term[64];
+        snprintf(term, sizeof(term), "%s(%d * 2.5 - %d) / 3", i == 0 ? "" : " + ", i, i + 1);
+        source += term;
+    }
+    source += " < 1000) == (\"user\" + \"-\" + \"42\" == \"user-42\")";
+    return source;
+}
+
+static bool run_captured(VM& vm, const Program* program, const std::string& source, std::string& result)
+{
+    vm.output.count = 0;
+    InterpretResult status = program ? interpret(vm, *program) : interpret(vm, source.c_str());
+    result.assign(vm.output.buffer, vm.output.count);
+    free_objects(vm.objects);
+    return status == INTERPRET_OK;
+}
+
+// Many VMs on many threads run one program at once, each round checked
+// against compiling and running the source on its own.
+static bool verify_shared(const Program* program, const std::string& source)
+{
+    Output output;
+    init_output_memory(output);
+    VM vm = {};
+    init_vm(vm, output);
+    std::string expected;
+    bool ok = run_captured(vm, nullptr, source, expected);
+    free_vm(vm);
+    if (!ok)
+    {
+        fprintf(stderr, "error: program benchmark source does not run\n");
+        return false;
+    }
+
+    const int THREADS = 8;
+    std::vector<int> mismatches(THREADS, 0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < THREADS; t++)
+    {
+        threads.emplace_back([&, t]() {
+            Output output;
+            init_output_memory(output);
+            VM vm = {};
+            init_vm(vm, output);
+            std::string actual;
+            for (int round = 0; round < 2000; round++)
+            {
+                if (!run_captured(vm, program, source, actual) || actual != expected)
+                    mismatches[t]++;
+            }
+            free_vm(vm);
+        });
+    }
+    for (std::thread& thread : threads)
+        thread.join();
+
+    for (int t = 0; t < THREADS; t++)
+    {
+        if (mismatches[t] != 0)
+        {
+            fprintf(stderr, "error: shared program gave a wrong result %d times on thread %d\n", mismatches[t], t);
+            return false;
+        }
+    }
+    return true;
+}
+
+void bench_program(const BenchOptions& options)
+{
+    if (!bench_selected(options, "program/"))
+        return;
+
+    std::string source = request_source();
+    Program* program = compile_program(source.c_str());
+    if (program == nullptr)
+    {
+        fprintf(stderr, "error: program benchmark source does not compile\n");
+        return;
+    }
+
+    bench_set_pinned(options, false);
+    bool verified = verify_shared(program, source);
+    bench_set_pinned(options, true);
+
+    if (verified)
+    {
+        Output output;
+        init_output_memory(output);
+        VM vm = {};
+        init_vm(vm, output);
+        std::string result;
+
+        // Per request: scan, compile, run and free, against running the
+        // program compiled once.
+        bench_run(options, "program/compile_and_run", 1, "req", [&](uint64_t iterations) {
+            for (uint64_t i = 0; i < iterations; i++)
+                run_captured(vm, nullptr, source, result);
+        });
+        bench_run(options, "program/run", 1, "req", [&](uint64_t iterations) {
+            for (uint64_t i = 0; i < iterations; i++)
+                run_captured(vm, program, source, result);
+        });
+
+        free_vm(vm);
+    }
+
+    release_program(program);
+}
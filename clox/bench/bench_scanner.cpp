@@ -0,0 +1,311 @@
+#include <cstdio>
+#include <string>
+
+#include "bench.h"
+#include "scanner.h"
+#include "scan_kernels.h"
+
+static uint64_t count_tokens(const char* source)
+{
+    ScannerState state = {};
+    init_scanner_state(state, source);
+
+    uint64_t tokens = 0;
+    for (;;)
+    {
+        Token token = scan_token(state);
+        tokens++;
+        if (token.type == TOKEN_EOF)
+            break;
+    }
+    return tokens;
+}
+
+// Folds every token into a checksum so kernel sets can be checked against
+// the scalar scanner before they are timed.
+static uint64_t token_checksum(const char* source)
+{
+    ScannerState state = {};
+    init_scanner_state(state, source);
+
+    uint64_t sum = 0;
+    for (;;)
+    {
+        Token token = scan_token(state);
+        sum = sum * 31 + static_cast<uint64_t>(token.type);
+        sum = sum * 31 + static_cast<uint64_t>(token.length);
+        sum = sum * 31 + static_cast<uint64_t>(token.line);
+        if (token.type != TOKEN_ERROR)
+            sum = sum * 31 + static_cast<uint64_t>(token.start - source);
+        if (token.type == TOKEN_EOF)
+            break;
+    }
+    return sum;
+}
+
+// Same checksum, computed from a batch-scanned TokenBuffer.
+static uint64_t batch_checksum(const char* source)
+{
+    TokenBuffer buffer;
+    init_token_buffer(buffer);
+    scan_all(buffer, source);
+
+    TokenCursor cursor;
+    init_token_cursor(cursor, buffer);
+
+    uint64_t sum = 0;
+    for (;;)
+    {
+        Token token = next_token(cursor);
+        sum = sum * 31 + static_cast<uint64_t>(token.type);
+        sum = sum * 31 + static_cast<uint64_t>(token.length);
+        sum = sum * 31 + static_cast<uint64_t>(token.line);
+        if (token.type != TOKEN_ERROR)
+            sum = sum * 31 + static_cast<uint64_t>(token.start - source);
+        if (token.type == TOKEN_EOF)
+            break;
+    }
+
+    free_token_buffer(buffer);
+    return sum;
+}
+
+static uint64_t batch_tokens(const char* source)
+{
+    TokenBuffer buffer;
+    init_token_buffer(buffer);
+    scan_all(buffer, source);
+    uint64_t tokens = static_cast<uint64_t>(buffer.count);
+    free_token_buffer(buffer);
+    return tokens;
+}
+
+static bool same_tokens(const TokenBuffer& a, const TokenBuffer& b)
+{
+    if (a.count != b.count)
+        return false;
+
+    TokenCursor ca, cb;
+    init_token_cursor(ca, a);
+    init_token_cursor(cb, b);
+    for (int i = 0; i < a.count; i++)
+    {
+        Token ta = next_token(ca);
+        Token tb = next_token(cb);
+        if (ta.type != tb.type || ta.start != tb.start || ta.length != tb.length || ta.line != tb.line)
+            return false;
+    }
+    return true;
+}
+
+// Differential check of the parallel scanner: sources full of the
+// constructs that make a split point unsafe are scanned with tiny segments
+// and many threads, and must match the sequential scan token for token.
+static bool verify_parallel_scanner()
+{
+    static const char* const PIECES[] = {
+        "var a = \"multi\nline\n\nstring // not a comment\";\n",
+        "// comment with a \" quote\n",
+        "print 1 + 2.5 * (3 - 4) / five;\n",
+        "\"\";\"\n\"\n",
+        "  \t\r\n\n\n",
+        "@ # unexpected characters\n",
+        "a//b\n",
+        "x / / y;\n",
+    };
+
+    uint64_t state = 0x9E3779B97F4A7C15ULL;
+    for (int round = 0; round < 40; round++)
+    {
+        std::string source;
+        for (int i = 0; i < 400; i++)
+        {
+            state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+            source += PIECES[(state >> 33) % (sizeof(PIECES) / sizeof(PIECES[0]))];
+            if ((state >> 20) % 97 == 0)
+                source += std::string(300, '\n');
+        }
+        if (round % 3 == 1)
+            source += "\"unterminated\n string";
+        if (round % 3 == 2)
+            source += "// trailing comment";
+
+        TokenBuffer expected;
+        init_token_buffer(expected);
+        scan_all(expected, source.c_str());
+
+        for (int threads = 2; threads <= 16; threads *= 2)
+        {
+            for (size_t segment : { 1, 17, 256, 4096 })
+            {
+                TokenBuffer actual;
+                init_token_buffer(actual);
+                scan_all_parallel(actual, source.c_str(), threads, segment);
+                bool same = same_tokens(expected, actual);
+                free_token_buffer(actual);
+                if (!same)
+                {
+                    fprintf(stderr, "error: parallel scan (%d threads, %zu byte segments) differs in round %d\n", threads, segment, round);
+                    free_token_buffer(expected);
+                    return false;
+                }
+            }
+        }
+        free_token_buffer(expected);
+    }
+    return true;
+}
+
+// Repeats `unit` until the source is at least `min_size` bytes long.
+static std::string repeat_source(const char* unit, size_t min_size)
+{
+    std::string source;
+    while (source.size() < min_size)
+        source += unit;
+    return source;
+}
+
+struct ScannerSource
+{
+    std::string name;
+    std::string source;
+};
+
+static void bench_source(const BenchOptions& options, const char* kernels, const ScannerSource& input)
+{
+    const char* chars = input.source.c_str();
+    double tokens = static_cast<double>(count_tokens(chars));
+
+    char label[96];
+    snprintf(label, sizeof(label), "scanner/%s/%s tokens", kernels, input.name.c_str());
+    bench_run(options, label, tokens, "tok", [&](uint64_t iterations) {
+        for (uint64_t i = 0; i < iterations; i++)
+            do_not_optimize(count_tokens(chars));
+    });
+
+    snprintf(label, sizeof(label), "scanner/%s/%s bytes", kernels, input.name.c_str());
+    bench_run(options, label, static_cast<double>(input.source.size()), "B", [&](uint64_t iterations) {
+        for (uint64_t i = 0; i < iterations; i++)
+            do_not_optimize(count_tokens(chars));
+    });
+}
+
+void bench_scanner(const BenchOptions& options)
+{
+    static constexpr size_t SYNTHETIC_SIZE = 1 << 20;
+
+    std::vector<ScannerSource> sources = {
+        { "identifiers", repeat_source(
+            "var counter_value = another_identifier + somethingElse * while_loop_index;\n", SYNTHETIC_SIZE) },
+        { "numbers", repeat_source(
+            "1 + 23.5 * 456 - 7890.125 / 3 < 100000 == 42.0 >= 17;\n", SYNTHETIC_SIZE) },
+        { "strings", repeat_source(
+            "\"a moderately long string literal with some words in it\" + \"and another\";\n", SYNTHETIC_SIZE) },
+        { "comments", repeat_source(
+            "// a comment line that the scanner has to skip over entirely\n    \t  x;\n", SYNTHETIC_SIZE) },
+        { "operators", repeat_source(
+            "(!a != b) <= {c >= d} == -e + f * g / h;\n", SYNTHETIC_SIZE) },
+        { "indented", repeat_source(
+            "                {\n                    result = lhs + rhs;\n                }\n\n", SYNTHETIC_SIZE) },
+    };
+
+    for (const std::string& path : options.corpus)
+    {
+        std::string contents;
+        if (!read_corpus_file(path, contents))
+        {
+            fprintf(stderr, "warning: could not read corpus file \"%s\"\n", path.c_str());
+            continue;
+        }
+
+        size_t slash = path.find_last_of("/\\");
+        std::string name = slash == std::string::npos ? path : path.substr(slash + 1);
+        sources.push_back({ name, repeat_source(contents.c_str(), SYNTHETIC_SIZE) });
+    }
+
+    ScanKernelSet selected = scan_kernel_set();
+
+    std::vector<uint64_t> expected;
+    select_scan_kernel_set(SCAN_SCALAR);
+    for (const ScannerSource& input : sources)
+        expected.push_back(token_checksum(input.source.c_str()));
+
+    static const ScanKernelSet KERNEL_SETS[] = { SCAN_SCALAR, SCAN_SSE2, SCAN_AVX2 };
+    for (ScanKernelSet set : KERNEL_SETS)
+    {
+        if (!select_scan_kernel_set(set))
+            continue;
+
+        const char* name = scan_kernel_set_name(set);
+        for (size_t i = 0; i < sources.size(); i++)
+        {
+            if (token_checksum(sources[i].source.c_str()) != expected[i])
+            {
+                fprintf(stderr, "error: %s scanner disagrees with scalar scanner on %s\n", name, sources[i].name.c_str());
+                continue;
+            }
+            bench_source(options, name, sources[i]);
+        }
+    }
+
+    select_scan_kernel_set(selected);
+
+    for (size_t i = 0; i < sources.size(); i++)
+    {
+        const ScannerSource& input = sources[i];
+        if (batch_checksum(input.source.c_str()) != expected[i])
+        {
+            fprintf(stderr, "error: batch scanner disagrees with scan_token on %s\n", input.name.c_str());
+            continue;
+        }
+
+        const char* chars = input.source.c_str();
+        char label[96];
+        snprintf(label, sizeof(label), "scanner/batch/%s tokens", input.name.c_str());
+        bench_run(options, label, static_cast<double>(count_tokens(chars)), "tok", [&](uint64_t iterations) {
+            for (uint64_t n = 0; n < iterations; n++)
+                do_not_optimize(batch_tokens(chars));
+        });
+
+        // Reusing the buffer takes allocation and page faults out of the picture.
+        TokenBuffer buffer;
+        init_token_buffer(buffer);
+        snprintf(label, sizeof(label), "scanner/batch-reuse/%s tokens", input.name.c_str());
+        bench_run(options, label, static_cast<double>(count_tokens(chars)), "tok", [&](uint64_t iterations) {
+            for (uint64_t n = 0; n < iterations; n++)
+            {
+                scan_all(buffer, chars);
+                do_not_optimize(buffer.count);
+            }
+        });
+        free_token_buffer(buffer);
+    }
+
+    if (!bench_selected(options, "scanner/parallel"))
+        return;
+    if (!verify_parallel_scanner())
+        return;
+
+    std::string large = repeat_source(
+        "var counter_value = another_identifier + 23.5 * \"a string\"; // trailing comment\n", 32 << 20);
+    const char* chars = large.c_str();
+    double large_tokens = static_cast<double>(count_tokens(chars));
+
+    bench_set_pinned(options, false);
+    for (int threads = 1; threads <= 32; threads *= 2)
+    {
+        TokenBuffer buffer;
+        init_token_buffer(buffer);
+        char label[96];
+        snprintf(label, sizeof(label), "scanner/parallel/%d threads 32MB", threads);
+        bench_run(options, label, large_tokens, "tok", [&](uint64_t iterations) {
+            for (uint64_t n = 0; n < iterations; n++)
+            {
+                scan_all_parallel(buffer, chars, threads);
+                do_not_optimize(buffer.count);
+            }
+        });
+        free_token_buffer(buffer);
+    }
+    bench_set_pinned(options, true);
+}
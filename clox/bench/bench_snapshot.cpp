@@ -0,0 +1,117 @@
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "bench.h"
+#include "compiler.h"
+#include "snapshot.h"
+#include "vm.h"
+
+static const int MODULES = 64;
+
+// Stands in for the prelude a host evaluates before its first request:
+// many small modules of arithmetic and string constants.
+static std::string module_source(int module)
+{
+    std::string source = "(";
+    for (int i = 0; i < 24; i++)
+    {
+        char term[96];
+        snprintf(term, sizeof(term), "%s(%d * 1.5 - %d) / 7", i == 0 ? "" : " + ", module + i, i + 3);
+        source += term;
+    }
+    char strings[96];
+    snprintf(strings, sizeof(strings), " > 0) == (\"module-%d\" + \"-\" + \"init\" == \"module-%d-init\")", module, module);
+    source += strings;
+    return source;
+}
+
+// Cold start: a fresh VM compiles every module.
+static bool compile_modules(const std::vector<std::string>& sources, std::vector<Chunk>& chunks)
+{
+    chunks.resize(sources.size());
+    bool compiled = true;
+    for (size_t i = 0; i < sources.size(); i++)
+    {
+        init_chunk(chunks[i]);
+        compiled = compile(sources[i].c_str(), chunks[i]) && compiled;
+    }
+    return compiled;
+}
+
+static void free_modules(std::vector<Chunk>& chunks)
+{
+    for (Chunk& chunk : chunks)
+        free_chunk(chunk);
+    chunks.clear();
+}
+
+static std::string run_all(VM& vm, Chunk* chunks, int count)
+{
+    vm.output.count = 0;
+    for (int i = 0; i < count; i++)
+    {
+        if (interpret(vm, chunks[i]) != INTERPRET_OK)
+            return "error";
+    }
+    return std::string(vm.output.buffer, vm.output.count);
+}
+
+void bench_snapshot(const BenchOptions& options)
+{
+    if (!bench_selected(options, "snapshot/"))
+        return;
+
+    std::vector<std::string> sources;
+    for (int i = 0; i < MODULES; i++)
+        sources.push_back(module_source(i));
+
+    Output output;
+    init_output_memory(output);
+    VM vm = {};
+    init_vm(vm, output);
+    vm.optimize = false;
+
+    std::vector<Chunk> chunks;
+    const char* path = "clox_bench_snapshot.bin";
+    bool ok = compile_modules(sources, chunks) && save_snapshot(path, vm, chunks.data(), MODULES);
+    Snapshot* snapshot = ok ? load_snapshot(path, vm) : nullptr;
+    if (snapshot == nullptr)
+    {
+        fprintf(stderr, "error: snapshot benchmark could not save and load its image\n");
+        free_modules(chunks);
+        free_vm(vm);
+        remove(path);
+        return;
+    }
+
+    std::string expected = run_all(vm, chunks.data(), MODULES);
+    std::string actual = run_all(vm, snapshot->chunks, snapshot->chunk_count);
+    size_t image_size = snapshot->size;
+    free_snapshot(snapshot);
+    free_modules(chunks);
+    if (expected == "error" || actual != expected)
+    {
+        fprintf(stderr, "error: restored snapshot gave a different result\n");
+        free_vm(vm);
+        remove(path);
+        return;
+    }
+    printf("%-44s %12d bytes\n", "snapshot/image", static_cast<int>(image_size));
+
+    bench_run(options, "snapshot/cold_compile", MODULES, "module", [&](uint64_t iterations) {
+        for (uint64_t i = 0; i < iterations; i++)
+        {
+            compile_modules(sources, chunks);
+            free_modules(chunks);
+            free_objects(vm.objects);
+        }
+    });
+    bench_run(options, "snapshot/restore", MODULES, "module", [&](uint64_t iterations) {
+        for (uint64_t i = 0; i < iterations; i++)
+            free_snapshot(load_snapshot(path, vm));
+    });
+
+    free_vm(vm);
+    remove(path);
+}
@@ -0,0 +1,114 @@
+#include <cstdio>
+#include <vector>
+
+#include "bench.h"
+#include "memory.h"
+#include "object.h"
+#include "table.h"
+
+static std::vector<ObjString*> make_keys(ObjList& objects, int count, const char* prefix)
+{
+    std::vector<ObjString*> keys;
+    char buffer[64];
+    for (int i = 0; i < count; i++)
+    {
+        int length = snprintf(buffer, sizeof(buffer), "%s_%d", prefix, i);
+        keys.push_back(copy_string(objects, buffer, length));
+    }
+    return keys;
+}
+
+static void bench_table_size(const BenchOptions& options, int size)
+{
+    ObjList objects = {};
+    std::vector<ObjString*> keys = make_keys(objects, size, "key");
+    std::vector<ObjString*> missing = make_keys(objects, size, "missing");
+
+    Table filled;
+    init_table(filled);
+    for (int i = 0; i < size; i++)
+        table_set(filled, keys[i], number_val(i));
+
+    char name[64];
+    double ops = static_cast<double>(size);
+
+    snprintf(name, sizeof(name), "table/%d insert", size);
+    bench_run(options, name, ops, "op", [&](uint64_t iterations) {
+        for (uint64_t n = 0; n < iterations; n++)
+        {
+            Table table;
+            init_table(table);
+            for (int i = 0; i < size; i++)
+                table_set(table, keys[i], number_val(i));
+            do_not_optimize(table.count);
+            free_table(table);
+        }
+    });
+
+    snprintf(name, sizeof(name), "table/%d lookup hit", size);
+    bench_run(options, name, ops, "op", [&](uint64_t iterations) {
+        Value value;
+        int found = 0;
+        for (uint64_t n = 0; n < iterations; n++)
+            for (int i = 0; i < size; i++)
+                found += table_get(filled, keys[i], value);
+        do_not_optimize(found);
+    });
+
+    snprintf(name, sizeof(name), "table/%d lookup miss", size);
+    bench_run(options, name, ops, "op", [&](uint64_t iterations) {
+        Value value;
+        int found = 0;
+        for (uint64_t n = 0; n < iterations; n++)
+            for (int i = 0; i < size; i++)
+                found += table_get(filled, missing[i], value);
+        do_not_optimize(found);
+    });
+
+    snprintf(name, sizeof(name), "table/%d find string", size);
+    bench_run(options, name, ops, "op", [&](uint64_t iterations) {
+        int found = 0;
+        for (uint64_t n = 0; n < iterations; n++)
+            for (int i = 0; i < size; i++)
+                found += table_find_string(filled, keys[i]->chars, keys[i]->length, string_hash(keys[i])) != nullptr;
+        do_not_optimize(found);
+    });
+
+    snprintf(name, sizeof(name), "table/%d copy", size);
+    bench_run(options, name, ops, "op", [&](uint64_t iterations) {
+        for (uint64_t n = 0; n < iterations; n++)
+        {
+            Table table;
+            init_table(table);
+            table_add_all(filled, table);
+            do_not_optimize(table.count);
+            free_table(table);
+        }
+    });
+
+    // Each iteration deletes every key from a fresh copy, so the copy itself
+    // is part of the measurement; subtract the "copy" line to isolate deletes.
+    snprintf(name, sizeof(name), "table/%d copy+delete", size);
+    bench_run(options, name, ops, "op", [&](uint64_t iterations) {
+        for (uint64_t n = 0; n < iterations; n++)
+        {
+            Table table;
+            init_table(table);
+            table_add_all(filled, table);
+            for (int i = 0; i < size; i++)
+                table_delete(table, keys[i]);
+            do_not_optimize(table.count);
+            free_table(table);
+        }
+    });
+
+    free_table(filled);
+    free_objects(objects);
+}
+
+void bench_table(const BenchOptions& options)
+{
+    static const int SIZES[] = { 16, 1024, 65536 };
+    for (int size : SIZES)
+        bench_table_size(options, size);
+}
@@ -0,0 +1,392 @@
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "bench.h"
+#include "compiler.h"
+#include "jit.h"
+#include "opt.h"
+#include "regchunk.h"
+#include "vm.h"
+
+// Every operand is a literal, so the compiler proves every operation
+// numeric; the mix of precedences keeps a few values on the stack.
+static std::string numeric_source()
+{
+    std::string source;
+    for (int i = 0; i < 60; i++)
+    {
+        char term[64];
+        snprintf(term, sizeof(term), "%s%d.5 * %d - %d / %d", i == 0 ? "" : " + ", i, i + 1, i + 2, i + 3);
+        source += term;
+    }
+    source += " < -(1000)";
+    return source;
+}
+
+// lox/Examples/locals.lox at a tenth of the size in each loop. Every
+// variable is a stack slot the compiler resolved; the C# tree-walker looks
+// each one up through a chain of environments.
+static const char* LOCALS_SOURCE =
+    "var total = 0;\n"
+    "for (var i = 0; i < 100; i = i + 1) {\n"
+    "  var row = 0;\n"
+    "  for (var j = 0; j < 100; j = j + 1) {\n"
+    "    var k = i * j;\n"
+    "    row = row + k - j;\n"
+    "  }\n"
+    "  total = total + row;\n"
+    "}\n";
+
+static const int LOCALS_ITERATIONS = 100 * 100;
+
+static int count_instructions(const Chunk& chunk)
+{
+    int count = 0;
+    for (int i = 0; i < chunk.count; i += instruction_length(chunk.code[i]))
+        count++;
+    return count;
+}
+
+// Turns the compiler's unchecked opcodes back into the generic ones, as if
+// nothing were known about the operands.
+static void strip_types(Chunk& chunk)
+{
+    static const struct { OpCode typed, generic; } MAPPING[] = {
+        { OP_EQUAL_F64, OP_EQUAL }, { OP_GREATER_F64, OP_GREATER }, { OP_LESS_F64, OP_LESS },
+        { OP_ADD_F64, OP_ADD }, { OP_SUBTRACT_F64, OP_SUBTRACT }, { OP_MULTIPLY_F64, OP_MULTIPLY },
+        { OP_DIVIDE_F64, OP_DIVIDE }, { OP_NEGATE_F64, OP_NEGATE },
+    };
+    for (int i = 0; i < chunk.count; i += instruction_length(chunk.code[i]))
+    {
+        for (const auto& entry : MAPPING)
+            if (chunk.code[i] == entry.typed)
+                chunk.code[i] = static_cast<uint8_t>(entry.generic);
+    }
+}
+
+static uint64_t next_random(uint64_t& state)
+{
+    state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+    return state >> 33;
+}
+
+// Random well-typed expressions of the requested kind, so runs end in a
+// result rather than a runtime error; strings make the JIT exit to the
+// interpreter part way through. Small literals make ties in comparisons
+// common.
+static std::string random_expression(uint64_t& state, int kind, int depth)
+{
+    static const char* NUMBER_OPS[] = { " + ", " - ", " * ", " / " };
+    static const char* COMPARE_OPS[] = { " < ", " > ", " <= ", " >= ", " == ", " != " };
+    char text[32];
+    uint64_t choice = next_random(state) % (depth > 0 ? 4 : 1);
+
+    switch (kind)
+    {
+    case 0: // number
+        if (choice == 0)
+        {
+            int value = static_cast<int>(next_random(state) % 8);
+            snprintf(text, sizeof(text), value < 4 ? "%d" : "%d.5", value % 4);
+            return text;
+        }
+        if (choice == 1)
+            return "-(" + random_expression(state, 0, depth - 1) + ")";
+        return "(" + random_expression(state, 0, depth - 1) + NUMBER_OPS[next_random(state) % 4] + random_expression(state, 0, depth - 1) + ")";
+    case 1: // bool
+        if (choice == 0)
+            return next_random(state) % 2 ? "true" : "nil";
+        if (choice == 1)
+            return "!" + random_expression(state, static_cast<int>(next_random(state) % 3), depth - 1);
+        if (choice == 2)
+        {
+            int operands = static_cast<int>(next_random(state) % 3);
+            return "(" + random_expression(state, operands, depth - 1) + " == " + random_expression(state, operands, depth - 1) + ")";
+        }
+        return "(" + random_expression(state, 0, depth - 1) + COMPARE_OPS[next_random(state) % 6] + random_expression(state, 0, depth - 1) + ")";
+    default: // string
+        if (choice < 2)
+        {
+            snprintf(text, sizeof(text), "\"s%d\"", static_cast<int>(next_random(state) % 4));
+            return text;
+        }
+        return "(" + random_expression(state, 2, depth - 1) + " + " + random_expression(state, 2, depth - 1) + ")";
+    }
+}
+
+// How an expression is run; all off is the plain interpreter. With
+// `optimize` set it runs as the optimizer's output, with `registers` set
+// as register code.
+struct Tier
+{
+    bool jit;
+    bool optimize;
+    bool registers;
+};
+
+static InterpretResult run_registers(VM& vm, const Chunk& chunk)
+{
+    RegChunk registers;
+    if (!compile_registers(chunk, registers))
+        return INTERPRET_COMPILE_ERROR;
+    InterpretResult result = interpret(vm, registers);
+    free_reg_chunk(registers);
+    return result;
+}
+
+static bool run_captured(const std::string& source, const Tier& tier, bool typed, std::string& result)
+{
+    Output output;
+    init_output_memory(output);
+    VM vm = {};
+    init_vm(vm, output);
+    vm.jit = tier.jit;
+
+    Chunk chunk;
+    init_chunk(chunk);
+    bool compiled = compile(source.c_str(), chunk);
+    if (compiled)
+    {
+        if (!typed)
+            strip_types(chunk);
+        // One run short of the threshold, so this run tiers up.
+        if (tier.optimize)
+            chunk.runs = OPT_THRESHOLD - 1;
+        InterpretResult status = tier.registers ? run_registers(vm, chunk) : interpret(vm, chunk);
+        if (status == INTERPRET_COMPILE_ERROR)
+            result = "not translated";
+        else if (status != INTERPRET_OK)
+            result = "runtime error";
+        else
+            result.assign(vm.output.buffer, vm.output.count);
+    }
+
+    free_chunk(chunk);
+    free_vm(vm);
+    return compiled;
+}
+
+// A tier has to agree with the interpreter on every expression, with and
+// without the compiler's type information.
+static bool verify_tier(const char* name, const Tier& tier)
+{
+    uint64_t state = 0x452821E638D01377ULL;
+    for (int i = 0; i < 2000; i++)
+    {
+        std::string source = random_expression(state, i % 3, 1 + i % 6);
+        for (int typed = 0; typed < 2; typed++)
+        {
+            std::string expected, actual;
+            if (!run_captured(source, Tier{}, typed != 0, expected) || !run_captured(source, tier, typed != 0, actual))
+            {
+                fprintf(stderr, "error: %s check expression does not compile: %s\n", name, source.c_str());
+                return false;
+            }
+            if (expected != actual)
+            {
+                fprintf(stderr, "error: %s gives \"%s\", interpreter \"%s\" for %s\n", name, actual.c_str(), expected.c_str(), source.c_str());
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static void bench_chunk(const BenchOptions& options, VM& vm, const char* name, Chunk& chunk, const std::vector<uint8_t>* restore)
+{
+    double instructions = static_cast<double>(count_instructions(chunk));
+    bench_run(options, name, instructions, "op", [&](uint64_t iterations) {
+        for (uint64_t i = 0; i < iterations; i++)
+        {
+            if (restore)
+                memcpy(chunk.code, restore->data(), restore->size());
+            interpret(vm, chunk);
+            vm.output.count = 0;
+        }
+    });
+}
+
+// What run() did before it cached the top of the stack, for the opcodes of
+// the typed numeric chunk: every operand is popped from vm.stack_top and
+// every result pushed back, two loads and a store per binary operation.
+static void run_memory_stack(VM& vm, const Chunk& chunk)
+{
+    const uint8_t* ip = chunk.code;
+    auto push = [&](Value value) { *vm.stack_top++ = value; };
+    auto pop = [&]() { return *--vm.stack_top; };
+
+#define MEMORY_BINARY_OP(value_type, op)        \
+    do                                          \
+    {                                           \
+        double b = as_number(pop());            \
+        double a = as_number(pop());            \
+        push(value_type(a op b));               \
+    } while (false)
+
+    for (;;)
+    {
+        switch (*ip++)
+        {
+        case OP_CONSTANT: push(chunk.constants.values[*ip++]); break;
+        case OP_EQUAL_F64: MEMORY_BINARY_OP(bool_val, ==); break;
+        case OP_GREATER_F64: MEMORY_BINARY_OP(bool_val, >); break;
+        case OP_LESS_F64: MEMORY_BINARY_OP(bool_val, <); break;
+        case OP_ADD_F64: MEMORY_BINARY_OP(number_val, +); break;
+        case OP_SUBTRACT_F64: MEMORY_BINARY_OP(number_val, -); break;
+        case OP_MULTIPLY_F64: MEMORY_BINARY_OP(number_val, *); break;
+        case OP_DIVIDE_F64: MEMORY_BINARY_OP(number_val, /); break;
+        case OP_NEGATE_F64: push(number_val(-as_number(pop()))); break;
+        case OP_RETURN:
+            write_value(vm.output, pop());
+            write_output(vm.output, '\n');
+            return;
+        default:
+            fprintf(stderr, "error: unexpected opcode in the typed numeric chunk\n");
+            return;
+        }
+    }
+
+#undef MEMORY_BINARY_OP
+}
+
+// Timed per instruction of the stack chunk it was translated from, so the
+// rates compare directly with the stack VM's.
+static void bench_registers(const BenchOptions& options, VM& vm, const char* name, const Chunk& chunk)
+{
+    if (!bench_selected(options, name))
+        return;
+
+    RegChunk registers;
+    if (!compile_registers(chunk, registers))
+    {
+        fprintf(stderr, "error: %s does not translate to registers\n", name);
+        return;
+    }
+
+    int stack_dispatches = count_instructions(chunk);
+    printf("%-44s %12d dispatches (stack %d)\n", name, registers.count, stack_dispatches);
+    bench_run(options, name, stack_dispatches, "op", [&](uint64_t iterations) {
+        for (uint64_t i = 0; i < iterations; i++)
+        {
+            interpret(vm, registers);
+            vm.output.count = 0;
+        }
+    });
+    free_reg_chunk(registers);
+}
+
+// Timed per pass of the inner loop. The sliced run is preempted at loop
+// safepoints and resumed, to show what a slice costs.
+static void bench_locals(const BenchOptions& options, VM& vm)
+{
+    if (!bench_selected(options, "vm/locals"))
+        return;
+
+    Chunk chunk;
+    init_chunk(chunk);
+    if (!compile(LOCALS_SOURCE, chunk))
+    {
+        fprintf(stderr, "error: locals benchmark source does not compile\n");
+        free_chunk(chunk);
+        return;
+    }
+
+    bench_run(options, "vm/locals", LOCALS_ITERATIONS, "iteration", [&](uint64_t iterations) {
+        for (uint64_t i = 0; i < iterations; i++)
+            interpret(vm, chunk);
+    });
+
+    int slices = 0;
+    vm.slice = 1000;
+    bench_run(options, "vm/locals/sliced", LOCALS_ITERATIONS, "iteration", [&](uint64_t iterations) {
+        for (uint64_t i = 0; i < iterations; i++)
+        {
+            InterpretResult result = interpret(vm, chunk);
+            for (slices = 1; result == INTERPRET_PREEMPTED; slices++)
+                result = resume(vm);
+        }
+    });
+    vm.slice = 0;
+    if (bench_selected(options, "vm/locals/sliced"))
+        printf("%-44s %12d slices\n", "vm/locals/sliced", slices);
+
+    free_chunk(chunk);
+}
+
+void bench_vm(const BenchOptions& options)
+{
+    if (!bench_selected(options, "vm/"))
+        return;
+
+    Output output;
+    init_output_memory(output);
+    VM vm = {};
+    init_vm(vm, output);
+    vm.optimize = false;
+
+    bench_locals(options, vm);
+
+    std::string source = numeric_source();
+    Chunk typed, generic;
+    init_chunk(typed);
+    init_chunk(generic);
+    if (!compile(source.c_str(), typed) || !compile(source.c_str(), generic))
+    {
+        fprintf(stderr, "error: numeric benchmark source does not compile\n");
+        free_chunk(typed);
+        free_chunk(generic);
+        free_vm(vm);
+        return;
+    }
+    strip_types(generic);
+    std::vector<uint8_t> generic_code(generic.code, generic.code + generic.count);
+
+    // Generic opcodes restored before every run, so each site takes the full
+    // type dispatch; then left to quicken; then the compiler's typed code.
+    bench_chunk(options, vm, "vm/numeric/generic", generic, &generic_code);
+    bench_chunk(options, vm, "vm/numeric/quickened", generic, nullptr);
+    bench_chunk(options, vm, "vm/numeric/typed", typed, nullptr);
+
+    // The same typed chunk with the top of the stack kept in memory.
+    bench_run(options, "vm/numeric/typed/memory_stack", count_instructions(typed), "op", [&](uint64_t iterations) {
+        for (uint64_t i = 0; i < iterations; i++)
+        {
+            run_memory_stack(vm, typed);
+            vm.output.count = 0;
+        }
+    });
+
+    // The same code as three-address instructions reading constants in place.
+    if (bench_selected(options, "vm/numeric/registers") && verify_tier("register VM", Tier{ false, false, true }))
+    {
+        memcpy(generic.code, generic_code.data(), generic_code.size());
+        bench_registers(options, vm, "vm/numeric/registers/generic", generic);
+        bench_registers(options, vm, "vm/numeric/registers/typed", typed);
+    }
+
+    // The optimizer folds the literals down to the result, so this measures
+    // the time per original instruction once the chunk is hot.
+    if (bench_selected(options, "vm/numeric/optimized") && verify_tier("optimizer", Tier{ false, true, false }))
+    {
+        vm.optimize = true;
+        memcpy(generic.code, generic_code.data(), generic_code.size());
+        bench_chunk(options, vm, "vm/numeric/optimized", generic, nullptr);
+        vm.optimize = false;
+    }
+
+    if (jit_supported() && bench_selected(options, "vm/numeric/jit") && verify_tier("JIT", Tier{ true, false, false }) &&
+        verify_tier("optimized JIT", Tier{ true, true, false }))
+    {
+        vm.jit = true;
+        memcpy(generic.code, generic_code.data(), generic_code.size());
+        bench_chunk(options, vm, "vm/numeric/jit/generic", generic, nullptr);
+        bench_chunk(options, vm, "vm/numeric/jit/typed", typed, nullptr);
+        vm.jit = false;
+    }
+
+    free_chunk(typed);
+    free_chunk(generic);
+    free_vm(vm);
+}
@@ -0,0 +1,468 @@
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define CLOX_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+
+#include "aio.h"
+#include "memory.h"
+#include "object.h"
+
+static constexpr int IO_THREADS = 4;
+static constexpr unsigned URING_ENTRIES = 256;
+
+struct IoRequest
+{
+    Fiber* fiber;
+    int fd;
+    char* buffer;
+    size_t size;
+    size_t reserved; // counted against the heap limit until the read finishes
+    size_t done;  // bytes read so far
+    bool failed;
+#ifdef CLOX_IO_URING
+    iovec iov;    // the rest of the buffer, for IORING_OP_READV
+#endif
+};
+
+#ifdef CLOX_IO_URING
+struct Uring
+{
+    int fd;
+    void* sq_ring;
+    size_t sq_ring_size;
+    void* cq_ring;
+    size_t cq_ring_size;
+    io_uring_sqe* sqes;
+    size_t sqes_size;
+
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned* sq_array;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned cq_mask;
+    io_uring_cqe* cqes;
+};
+#endif
+
+struct IoLoop
+{
+    IoBackend backend;
+    int in_flight; // submitted and not yet collected, counted by the VM's thread
+
+    // IO_BACKEND_THREADS
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable work;         // signalled when queue grows or on stop
+    std::condition_variable done;         // signalled when completed grows
+    std::deque<IoRequest*> queue;
+    std::vector<IoRequest*> completed;
+    bool stopping;
+
+    std::vector<IoRequest*> collected; // reused by complete_reads()
+
+#ifdef CLOX_IO_URING
+    // IO_BACKEND_URING
+    Uring ring;
+    std::deque<IoRequest*> backlog; // waiting for room in the submission queue
+    unsigned submitted;             // in the kernel's hands
+#endif
+};
+
+// Opens the file and finds its size; -1 if it cannot be read.
+static int open_file(const char* path, size_t& size)
+{
+#ifdef _WIN32
+    int fd = _open(path, _O_RDONLY | _O_BINARY);
+    struct _stat64 info;
+    if (fd >= 0 && _fstat64(fd, &info) != 0)
+#else
+    int fd = open(path, O_RDONLY);
+    struct stat info;
+    if (fd >= 0 && fstat(fd, &info) != 0)
+#endif
+    {
+        close(fd);
+        return -1;
+    }
+    if (fd >= 0)
+        size = static_cast<size_t>(info.st_size);
+    return fd;
+}
+
+// Reads until the buffer is full or the file ends.
+static void read_all(IoRequest& request)
+{
+    while (request.done < request.size)
+    {
+#ifdef _WIN32
+        _lseeki64(request.fd, static_cast<long long>(request.done), SEEK_SET);
+        int count = _read(request.fd, request.buffer + request.done, static_cast<unsigned>(request.size - request.done));
+#else
+        ssize_t count = pread(request.fd, request.buffer + request.done, request.size - request.done,
+            static_cast<off_t>(request.done));
+        if (count < 0 && errno == EINTR)
+            continue;
+#endif
+        if (count <= 0)
+        {
+            request.failed = count < 0;
+            return;
+        }
+        request.done += static_cast<size_t>(count);
+    }
+}
+
+static void io_thread_main(IoLoop& loop)
+{
+    std::unique_lock<std::mutex> lock(loop.mutex);
+    for (;;)
+    {
+        loop.work.wait(lock, [&]() { return !loop.queue.empty() || loop.stopping; });
+        if (loop.queue.empty())
+            break;
+        IoRequest* request = loop.queue.front();
+        loop.queue.pop_front();
+
+        lock.unlock();
+        read_all(*request);
+        lock.lock();
+
+        loop.completed.push_back(request);
+        loop.done.notify_one();
+    }
+}
+
+#ifdef CLOX_IO_URING
+static int uring_enter(const Uring& ring, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    int result;
+    do
+        result = static_cast<int>(syscall(__NR_io_uring_enter, ring.fd, to_submit, min_complete, flags, nullptr, 0));
+    while (result < 0 && errno == EINTR);
+    return result;
+}
+
+static bool setup_uring(Uring& ring)
+{
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ring.fd = static_cast<int>(syscall(__NR_io_uring_setup, URING_ENTRIES, &params));
+    if (ring.fd < 0)
+        return false;
+
+    ring.sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring.cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap && ring.cq_ring_size > ring.sq_ring_size)
+        ring.sq_ring_size = ring.cq_ring_size;
+    ring.sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+
+    ring.sq_ring = mmap(nullptr, ring.sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+        ring.fd, IORING_OFF_SQ_RING);
+    ring.cq_ring = single_mmap ? ring.sq_ring : mmap(nullptr, ring.cq_ring_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_CQ_RING);
+    void* sqes = mmap(nullptr, ring.sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+        ring.fd, IORING_OFF_SQES);
+    if (ring.sq_ring == MAP_FAILED || ring.cq_ring == MAP_FAILED || sqes == MAP_FAILED)
+    {
+        if (ring.sq_ring != MAP_FAILED)
+            munmap(ring.sq_ring, ring.sq_ring_size);
+        if (!single_mmap && ring.cq_ring != MAP_FAILED)
+            munmap(ring.cq_ring, ring.cq_ring_size);
+        if (sqes != MAP_FAILED)
+            munmap(sqes, ring.sqes_size);
+        close(ring.fd);
+        return false;
+    }
+
+    char* sq = static_cast<char*>(ring.sq_ring);
+    char* cq = static_cast<char*>(ring.cq_ring);
+    ring.sqes = static_cast<io_uring_sqe*>(sqes);
+    ring.sq_head = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    ring.sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    ring.sq_mask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    ring.sq_entries = params.sq_entries;
+    ring.sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    ring.cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    ring.cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    ring.cq_mask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    ring.cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+    return true;
+}
+
+static void free_uring(Uring& ring)
+{
+    munmap(ring.sqes, ring.sqes_size);
+    if (ring.cq_ring != ring.sq_ring)
+        munmap(ring.cq_ring, ring.cq_ring_size);
+    munmap(ring.sq_ring, ring.sq_ring_size);
+    close(ring.fd);
+}
+
+// Submits the request, or keeps it back while the submission queue is full.
+// The completion queue has room for twice as many, so it cannot overflow.
+static void uring_submit(IoLoop& loop, IoRequest& request)
+{
+    Uring& ring = loop.ring;
+    if (loop.submitted == ring.sq_entries)
+    {
+        loop.backlog.push_back(&request);
+        return;
+    }
+
+    unsigned tail = *ring.sq_tail;
+    unsigned index = tail & ring.sq_mask;
+    io_uring_sqe& sqe = ring.sqes[index];
+    memset(&sqe, 0, sizeof(sqe));
+    request.iov.iov_base = request.buffer + request.done;
+    request.iov.iov_len = request.size - request.done;
+    // READV rather than READ, which needs Linux 5.6.
+    sqe.opcode = IORING_OP_READV;
+    sqe.fd = request.fd;
+    sqe.addr = reinterpret_cast<uintptr_t>(&request.iov);
+    sqe.len = 1;
+    sqe.off = request.done;
+    sqe.user_data = reinterpret_cast<uintptr_t>(&request);
+    ring.sq_array[index] = index;
+    __atomic_store_n(ring.sq_tail, tail + 1, __ATOMIC_RELEASE);
+    loop.submitted++;
+
+    if (uring_enter(ring, 1, 0, 0) < 0)
+    {
+        // The kernel refused it: take it back and fail the read.
+        __atomic_store_n(ring.sq_tail, tail, __ATOMIC_RELEASE);
+        loop.submitted--;
+        request.failed = true;
+        loop.completed.push_back(&request);
+    }
+}
+
+// Moves finished reads to loop.completed and resubmits short ones.
+static void uring_reap(IoLoop& loop, bool wait)
+{
+    Uring& ring = loop.ring;
+    unsigned head = *ring.cq_head;
+    if (wait && head == __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE) && loop.completed.empty())
+        uring_enter(ring, 0, 1, IORING_ENTER_GETEVENTS);
+
+    std::vector<IoRequest*> resubmit;
+    unsigned tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++)
+    {
+        const io_uring_cqe& cqe = ring.cqes[head & ring.cq_mask];
+        IoRequest* request = reinterpret_cast<IoRequest*>(static_cast<uintptr_t>(cqe.user_data));
+        loop.submitted--;
+        if (cqe.res < 0)
+            request->failed = true;
+        else
+            request->done += static_cast<size_t>(cqe.res);
+
+        if (!request->failed && cqe.res > 0 && request->done < request->size)
+            resubmit.push_back(request);
+        else
+            loop.completed.push_back(request);
+    }
+    __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+
+    for (IoRequest* request : resubmit)
+        uring_submit(loop, *request);
+    while (!loop.backlog.empty() && loop.submitted < ring.sq_entries)
+    {
+        IoRequest* request = loop.backlog.front();
+        loop.backlog.pop_front();
+        uring_submit(loop, *request);
+    }
+}
+#endif
+
+IoLoop* start_io(bool uring)
+{
+    IoLoop* loop = new (reallocate(nullptr, 0, sizeof(IoLoop))) IoLoop();
+    loop->backend = IO_BACKEND_THREADS;
+    loop->in_flight = 0;
+    loop->stopping = false;
+#ifdef CLOX_IO_URING
+    loop->submitted = 0;
+    if (uring && setup_uring(loop->ring))
+    {
+        loop->backend = IO_BACKEND_URING;
+        return loop;
+    }
+#else
+    (void)uring;
+#endif
+
+    for (int i = 0; i < IO_THREADS; i++)
+        loop->threads.emplace_back(io_thread_main, std::ref(*loop));
+    return loop;
+}
+
+void stop_io(IoLoop* loop)
+{
+#ifdef CLOX_IO_URING
+    if (loop->backend == IO_BACKEND_URING)
+        free_uring(loop->ring);
+#endif
+    {
+        std::lock_guard<std::mutex> lock(loop->mutex);
+        loop->stopping = true;
+        loop->work.notify_all();
+    }
+    for (std::thread& thread : loop->threads)
+        thread.join();
+
+    loop->~IoLoop();
+    reallocate(loop, sizeof(IoLoop), 0);
+}
+
+IoBackend io_backend(const IoLoop& loop)
+{
+    return loop.backend;
+}
+
+// The string read, or nil. Frees the request.
+static Value finish_read(VM& vm, IoRequest* request)
+{
+    close(request->fd);
+    // The string counts its own bytes, which may be fewer.
+    release_heap(vm.objects, request->reserved);
+    Value result = nil_val();
+    if (request->failed)
+        FREE_ARRAY(char, request->buffer, request->size + 1);
+    else
+    {
+        // The file may have shrunk since it was opened.
+        char* chars = request->buffer;
+        if (request->done < request->size)
+            chars = GROW_ARRAY(chars, char, request->size + 1, request->done + 1);
+        chars[request->done] = '\0';
+        ObjString* string = take_string(vm.objects, chars, static_cast<int>(request->done));
+        if (string != nullptr)
+            result = obj_val(string);
+    }
+    FREE(IoRequest, request);
+    return result;
+}
+
+// A request for the path on top of the stack, or nullptr with the result
+// already on the stack if there is nothing to wait for.
+static IoRequest* open_read(VM& vm)
+{
+    Value* path = vm.stack_top - 1;
+    size_t size = 0;
+    int fd = open_file(as_string(*path)->chars, size);
+    // A file too large for the VM's heap limit is not read at all. The
+    // buffer is counted from now on, so reads in flight at the same time
+    // cannot together pass the limit.
+    size_t reserved = sizeof(ObjString) + size + 1;
+    if (fd < 0 || size > static_cast<size_t>(INT32_MAX) - 1 || !reserve_heap(vm.objects, reserved))
+    {
+        if (fd >= 0)
+            close(fd);
+        *path = nil_val();
+        return nullptr;
+    }
+
+    IoRequest* request = ALLOCATE(IoRequest, 1);
+    request->fiber = vm.fiber;
+    request->fd = fd;
+    request->buffer = ALLOCATE(char, size + 1);
+    request->size = size;
+    request->reserved = reserved;
+    request->done = 0;
+    request->failed = false;
+    if (size == 0)
+    {
+        *path = finish_read(vm, request);
+        return nullptr;
+    }
+    return request;
+}
+
+void read_now(VM& vm)
+{
+    IoRequest* request = open_read(vm);
+    if (request == nullptr)
+        return;
+    read_all(*request);
+    vm.stack_top[-1] = finish_read(vm, request);
+}
+
+void start_read(VM& vm)
+{
+    IoRequest* request = open_read(vm);
+    if (request == nullptr)
+        return;
+
+    IoLoop& loop = *vm.io;
+    loop.in_flight++;
+#ifdef CLOX_IO_URING
+    if (loop.backend == IO_BACKEND_URING)
+        uring_submit(loop, *request);
+    else
+#endif
+    {
+        std::lock_guard<std::mutex> lock(loop.mutex);
+        loop.queue.push_back(request);
+        loop.work.notify_one();
+    }
+    park_fiber(vm);
+}
+
+bool complete_reads(VM& vm, bool wait)
+{
+    IoLoop& loop = *vm.io;
+    if (loop.in_flight == 0)
+        return false;
+
+    std::vector<IoRequest*>& collected = loop.collected;
+#ifdef CLOX_IO_URING
+    if (loop.backend == IO_BACKEND_URING)
+    {
+        uring_reap(loop, wait);
+        collected.swap(loop.completed);
+    }
+    else
+#endif
+    {
+        std::unique_lock<std::mutex> lock(loop.mutex);
+        if (wait)
+            loop.done.wait(lock, [&]() { return !loop.completed.empty(); });
+        collected.swap(loop.completed);
+    }
+
+    // The path the fiber read is the top slot of its saved stack.
+    for (IoRequest* request : collected)
+    {
+        Fiber& fiber = *request->fiber;
+        fiber.stack[fiber.depth - 1] = finish_read(vm, request);
+        wake_fiber(vm, fiber);
+    }
+    loop.in_flight -= static_cast<int>(collected.size());
+    collected.clear();
+    return true;
+}
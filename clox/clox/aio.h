@@ -0,0 +1,39 @@
+#pragma once
+
+#include "vm.h"
+
+// File reads for scripts: `read path` evaluates to the file's contents, or
+// nil if it cannot be read or would not fit under the VM's heap limit, with
+// reads still in flight counted against it. Outside a fiber, or on a VM
+// without an I/O loop, the read blocks. A fiber on a VM with vm.io set is
+// parked instead and the VM runs other fibers until the read completes,
+// when the fiber rejoins the ring with the contents as the value of its
+// `read`. Only opening the file and finding its size happen on the VM's
+// thread.
+//
+// A loop submits reads to io_uring where the kernel provides it and
+// otherwise to a few threads doing blocking reads. Either way, completions
+// are only collected by the VM, at `yield`, at `read` and when no fiber is
+// left to run. A loop serves one VM at a time.
+
+enum IoBackend
+{
+    IO_BACKEND_THREADS,
+    IO_BACKEND_URING,
+};
+
+struct IoLoop;
+
+// With `uring` false, or where io_uring cannot be set up, the loop uses
+// threads.
+IoLoop* start_io(bool uring);
+// Every read must have completed, as it has once run_fibers() returns.
+void stop_io(IoLoop* loop);
+IoBackend io_backend(const IoLoop& loop);
+
+// Used by run() for OP_READ, with the path on top of the stack.
+void read_now(VM& vm);
+void start_read(VM& vm);
+// Wakes the fibers whose reads have completed, first waiting for one if
+// `wait` is set. Returns false if no read is in flight.
+bool complete_reads(VM& vm, bool wait);
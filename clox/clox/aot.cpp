@@ -0,0 +1,410 @@
+#include <cstdio>
+#include <cstring>
+
+#include "aot.h"
+#include "memory.h"
+#include "number.h"
+#include "object.h"
+
+static void write_text(Output& out, const char* text)
+{
+    write_output(out, text, strlen(text));
+}
+
+static void write_format(Output& out, const char* format, int a, int b = 0, int c = 0)
+{
+    char buffer[128];
+    int length = snprintf(buffer, sizeof(buffer), format, a, b, c);
+    write_output(out, buffer, static_cast<size_t>(length));
+}
+
+// A C string literal with the same bytes. Octal escapes always use three
+// digits so a following digit is never taken as part of them.
+static void write_c_string(Output& out, const char* chars, int length)
+{
+    write_output(out, '"');
+    for (int i = 0; i < length; i++)
+    {
+        unsigned char c = static_cast<unsigned char>(chars[i]);
+        if (c == '"' || c == '\\')
+        {
+            write_output(out, '\\');
+            write_output(out, static_cast<char>(c));
+        }
+        else if (c >= 0x20 && c < 0x7F && c != '?')
+            write_output(out, static_cast<char>(c));
+        else
+        {
+            char escape[5];
+            snprintf(escape, sizeof(escape), "\\%03o", c);
+            write_output(out, escape, 4);
+        }
+    }
+    write_output(out, '"');
+}
+
+// Constants become expressions evaluated where they are pushed. Numbers are
+// written in their shortest round-trip form, which C reads back exactly.
+static bool write_constant(Output& out, Value value)
+{
+    switch (value.type)
+    {
+    case VAL_NIL:
+        write_text(out, "lox_nil()");
+        return true;
+    case VAL_BOOL:
+        write_text(out, as_bool(value) ? "lox_bool(true)" : "lox_bool(false)");
+        return true;
+    case VAL_NUMBER:
+    {
+        double number = as_number(value);
+        if (number != number || number - number != 0 || (number == 0 && 1 / number < 0))
+            return false; // no literal for NaN, infinities or -0
+        char buffer[NUMBER_BUFFER_SIZE];
+        format_number(number, buffer);
+        write_text(out, "lox_number(");
+        write_text(out, buffer);
+        write_text(out, ")");
+        return true;
+    }
+    case VAL_OBJ:
+        if (!is_string(value))
+            return false;
+        write_text(out, "lox_string(runtime, ");
+        write_c_string(out, as_cstring(value), as_string(value)->length);
+        write_format(out, ", %d)", as_string(value)->length);
+        return true;
+    }
+    return false;
+}
+
+// Checked binary operators on numbers, as run() does them.
+static void write_number_guard(Output& out, int a, int b, const char* message, int line)
+{
+    write_format(out, "    if (!lox_is_number(s%d) || !lox_is_number(s%d))\n", a, b);
+    write_text(out, "        return lox_runtime_error(runtime, \"");
+    write_text(out, message);
+    write_format(out, "\", %d);\n", line);
+}
+
+static void write_binary(Output& out, int a, int b, const char* result, const char* op)
+{
+    write_format(out, "    s%d = ", a);
+    write_text(out, result);
+    write_format(out, "(s%d.as.number ", a);
+    write_text(out, op);
+    write_format(out, " s%d.as.number);\n", b);
+}
+
+static int jump_target(const Chunk& chunk, int offset)
+{
+    int operand = chunk.code[offset + 1] << 8 | chunk.code[offset + 2];
+    return chunk.code[offset] == OP_LOOP ? offset + 3 - operand : offset + 3 + operand;
+}
+
+// Finds the stack depth before each instruction, -1 where no path reaches,
+// and marks the instructions jumps land on. The compiler's code has one
+// depth wherever paths meet; anything else fails.
+static bool stack_depths(const Chunk& chunk, int* depths, bool* targets)
+{
+    int* pending = ALLOCATE(int, chunk.count);
+    for (int offset = 0; offset < chunk.count; offset++)
+    {
+        depths[offset] = -1;
+        targets[offset] = false;
+    }
+
+    bool valid = true;
+    int pending_count = 0;
+    depths[0] = 0;
+    pending[pending_count++] = 0;
+    while (valid && pending_count > 0)
+    {
+        int offset = pending[--pending_count];
+        uint8_t op = chunk.code[offset];
+        int pops;
+        int pushes;
+        stack_effect(op, pops, pushes);
+        int depth = depths[offset] - pops + pushes;
+
+        int successors[2] = { offset + instruction_length(op), -1 };
+        int successor_count = 1;
+        switch (op)
+        {
+        case OP_JUMP_IF_FALSE:
+            successors[successor_count++] = jump_target(chunk, offset);
+            targets[jump_target(chunk, offset)] = true;
+            break;
+        case OP_JUMP:
+        case OP_LOOP:
+            successors[0] = jump_target(chunk, offset);
+            targets[successors[0]] = true;
+            break;
+        case OP_RETURN:
+        case OP_HALT:
+            successor_count = 0;
+            break;
+        default:
+            break;
+        }
+
+        for (int i = 0; valid && i < successor_count; i++)
+        {
+            int target = successors[i];
+            valid = target < chunk.count && (depths[target] == -1 || depths[target] == depth);
+            if (valid && depths[target] == -1)
+            {
+                depths[target] = depth;
+                pending[pending_count++] = target;
+            }
+        }
+    }
+
+    FREE_ARRAY(int, pending, chunk.count);
+    return valid;
+}
+
+// Globals are reached through their slots, looked up by name once before
+// the script runs. The error messages name them, as run()'s do.
+static void write_undefined_guard(Output& out, const Chunk& chunk, int index, int line)
+{
+    ObjString* name = as_string(chunk.globals.values[index]);
+    write_format(out, "    if (lox_is_undefined(globals[g%d]))\n", index);
+    write_text(out, "        return lox_runtime_error(runtime, ");
+    write_c_string(out, "Undefined variable '", 20);
+    write_text(out, " ");
+    write_c_string(out, name->chars, name->length);
+    write_text(out, " ");
+    write_c_string(out, "'", 1);
+    write_format(out, ", %d);\n", line);
+}
+
+static bool translate(const Chunk& chunk, Output& out, int& max_depth)
+{
+    static const char* NUMBERS_MESSAGE = "Operands must be numbers.";
+
+    int* depths = ALLOCATE(int, chunk.count);
+    bool* targets = ALLOCATE(bool, chunk.count);
+    bool translated = stack_depths(chunk, depths, targets);
+    uint8_t instruction = OP_CONSTANT;
+    for (int offset = 0; translated && offset < chunk.count;)
+    {
+        instruction = chunk.code[offset];
+        int line = chunk.lines[offset];
+        int depth = depths[offset];
+        int a = depth - 2;
+        int b = depth - 1;
+        int index = 0;
+        if (instruction_length(instruction) == 3)
+            index = chunk.code[offset + 1] << 8 | chunk.code[offset + 2];
+
+        // Code no path reaches is left out.
+        if (depth < 0)
+        {
+            offset += instruction_length(instruction);
+            continue;
+        }
+        if (targets[offset])
+            write_format(out, "L%d: ;\n", offset);
+
+        switch (instruction)
+        {
+        case OP_CONSTANT:
+            write_format(out, "    s%d = ", depth);
+            translated = write_constant(out, chunk.constants.values[chunk.code[offset + 1]]);
+            write_text(out, ";\n");
+            depth++;
+            offset += 2;
+            break;
+        case OP_GET_LOCAL:
+            write_format(out, "    s%d = s%d;\n", depth++, chunk.code[offset + 1]);
+            offset += 2;
+            break;
+        case OP_SET_LOCAL:
+            write_format(out, "    s%d = s%d;\n", chunk.code[offset + 1], b);
+            offset += 2;
+            break;
+        case OP_GET_GLOBAL:
+            write_format(out, "    s%d = globals[g%d];\n", depth, index);
+            write_undefined_guard(out, chunk, index, line);
+            depth++;
+            offset += 3;
+            break;
+        case OP_SET_GLOBAL:
+            write_undefined_guard(out, chunk, index, line);
+            write_format(out, "    globals[g%d] = s%d;\n", index, b);
+            offset += 3;
+            break;
+        case OP_DEFINE_GLOBAL:
+            write_format(out, "    globals[g%d] = s%d;\n", index, b);
+            depth--;
+            offset += 3;
+            break;
+        case OP_POP:
+            depth--;
+            offset++;
+            break;
+        case OP_PRINT:
+            write_format(out, "    lox_print(runtime, s%d);\n", b);
+            depth--;
+            offset++;
+            break;
+        case OP_JUMP:
+        case OP_LOOP:
+            write_format(out, "    goto L%d;\n", jump_target(chunk, offset));
+            offset += 3;
+            break;
+        case OP_JUMP_IF_FALSE:
+            write_format(out, "    if (lox_is_falsey(s%d))\n", b);
+            write_format(out, "        goto L%d;\n", jump_target(chunk, offset));
+            offset += 3;
+            break;
+        case OP_NIL:
+            write_format(out, "    s%d = lox_nil();\n", depth++);
+            offset++;
+            break;
+        case OP_TRUE:
+            write_format(out, "    s%d = lox_bool(true);\n", depth++);
+            offset++;
+            break;
+        case OP_FALSE:
+            write_format(out, "    s%d = lox_bool(false);\n", depth++);
+            offset++;
+            break;
+        case OP_EQUAL:
+            write_format(out, "    s%d = lox_bool(lox_equal(s%d, s%d));\n", a, a, b);
+            depth--;
+            offset++;
+            break;
+        case OP_EQUAL_F64:
+            write_binary(out, a, b, "lox_bool", "==");
+            depth--;
+            offset++;
+            break;
+        case OP_GREATER:
+        case OP_GREATER_NUM:
+        case OP_LESS:
+        case OP_LESS_NUM:
+        case OP_SUBTRACT:
+        case OP_SUBTRACT_NUM:
+        case OP_MULTIPLY:
+        case OP_MULTIPLY_NUM:
+        case OP_DIVIDE:
+        case OP_DIVIDE_NUM:
+            write_number_guard(out, a, b, NUMBERS_MESSAGE, line);
+            // fallthrough
+        case OP_GREATER_F64:
+        case OP_LESS_F64:
+        case OP_SUBTRACT_F64:
+        case OP_MULTIPLY_F64:
+        case OP_DIVIDE_F64:
+            switch (instruction)
+            {
+            case OP_GREATER: case OP_GREATER_NUM: case OP_GREATER_F64:
+                write_binary(out, a, b, "lox_bool", ">");
+                break;
+            case OP_LESS: case OP_LESS_NUM: case OP_LESS_F64:
+                write_binary(out, a, b, "lox_bool", "<");
+                break;
+            case OP_SUBTRACT: case OP_SUBTRACT_NUM: case OP_SUBTRACT_F64:
+                write_binary(out, a, b, "lox_number", "-");
+                break;
+            case OP_MULTIPLY: case OP_MULTIPLY_NUM: case OP_MULTIPLY_F64:
+                write_binary(out, a, b, "lox_number", "*");
+                break;
+            default:
+                write_binary(out, a, b, "lox_number", "/");
+                break;
+            }
+            depth--;
+            offset++;
+            break;
+        case OP_ADD:
+        case OP_ADD_NUM_NUM:
+        case OP_ADD_STR_STR:
+            write_format(out, "    if (lox_is_string(s%d) && lox_is_string(s%d))\n", a, b);
+            write_text(out, "    {\n");
+            write_format(out, "        s%d = lox_concatenate(runtime, s%d, s%d);\n", a, a, b);
+            write_format(out, "        if (s%d.type == LOX_NIL)\n", a);
+            write_format(out, "            return lox_runtime_error(runtime, \"Heap limit exceeded\", %d);\n", line);
+            write_text(out, "    }\n");
+            write_format(out, "    else if (lox_is_number(s%d) && lox_is_number(s%d))\n", a, b);
+            write_format(out, "        s%d = lox_number(s%d.as.number + s%d.as.number);\n", a, a, b);
+            write_text(out, "    else\n");
+            write_format(out, "        return lox_runtime_error(runtime, \"Operands must be two numbers or two strings\", %d);\n", line);
+            depth--;
+            offset++;
+            break;
+        case OP_ADD_F64:
+            write_binary(out, a, b, "lox_number", "+");
+            depth--;
+            offset++;
+            break;
+        case OP_NOT:
+            write_format(out, "    s%d = lox_bool(lox_is_falsey(s%d));\n", b, b);
+            offset++;
+            break;
+        case OP_NEGATE:
+        case OP_NEGATE_NUM:
+            write_format(out, "    if (!lox_is_number(s%d))\n", b);
+            write_format(out, "        return lox_runtime_error(runtime, \"Operand must be a number\", %d);\n", line);
+            // fallthrough
+        case OP_NEGATE_F64:
+            write_format(out, "    s%d = lox_number(-s%d.as.number);\n", b, b);
+            offset++;
+            break;
+        case OP_RETURN:
+            write_format(out, "    lox_print(runtime, s%d);\n", b);
+            // fallthrough
+        case OP_HALT:
+            write_text(out, "    return 0;\n");
+            offset++;
+            break;
+        default:
+            translated = false;
+            break;
+        }
+
+        if (depth > max_depth)
+            max_depth = depth;
+    }
+
+    FREE_ARRAY(bool, targets, chunk.count);
+    FREE_ARRAY(int, depths, chunk.count);
+    // The code must end in a return, not run off the end of the function.
+    return translated && (instruction == OP_RETURN || instruction == OP_HALT);
+}
+
+bool emit_c(const Chunk& chunk, Output& out)
+{
+    // The body is translated first so the locals it needs are known.
+    Output body;
+    init_output_memory(body);
+    int max_depth = 0;
+    bool translated = translate(chunk, body, max_depth);
+    if (translated)
+    {
+        write_text(out, "// Generated by clox --emit-c.\n\n");
+        write_text(out, "#include \"lox_runtime.h\"\n\n");
+        write_text(out, "int lox_script(LoxRuntime* runtime)\n{\n");
+        for (int i = 0; i < max_depth; i++)
+            write_format(out, "    LoxValue s%d;\n", i);
+        for (int i = 0; i < chunk.globals.count; i++)
+        {
+            const ObjString* name = as_string(chunk.globals.values[i]);
+            write_format(out, "    int g%d = lox_global(runtime, ", i);
+            write_c_string(out, name->chars, name->length);
+            write_format(out, ", %d);\n", name->length);
+        }
+        if (chunk.globals.count > 0)
+            write_text(out, "    LoxValue* globals = lox_globals(runtime);\n");
+        write_text(out, "\n");
+        write_output(out, body.buffer, body.count);
+        write_text(out, "}\n\n");
+        write_text(out, "#ifndef LOX_NO_MAIN\n");
+        write_text(out, "int main(void)\n{\n    return lox_run(lox_script);\n}\n");
+        write_text(out, "#endif\n");
+    }
+    free_output(body);
+    return translated;
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "chunk.h"
+#include "output.h"
+
+// Ahead-of-time translation of a compiled chunk into a C translation unit
+// built on lox_runtime.h. Every stack slot becomes a local, so the
+// generated code keeps the value stack in registers where the C compiler
+// can; jumps become gotos between labelled statements, and globals are
+// slots in the runtime's table, found by name once before the script
+// runs. The unit defines `int lox_script(LoxRuntime*)` and, unless
+// LOX_NO_MAIN is defined, a main() that runs it.
+
+// Fails, having written nothing useful, if the chunk uses an opcode the
+// translator does not handle.
+bool emit_c(const Chunk& chunk, Output& out);
@@ -1,6 +1,7 @@
 #include <cstdlib>
 
 #include "chunk.h"
+#include "jit.h"
 #include "memory.h"
 
 void init_chunk(Chunk& chunk)
@@ -10,6 +11,14 @@ void init_chunk(Chunk& chunk)
     chunk.code = nullptr;
     chunk.lines = nullptr;
     init_value_array(chunk.constants);
+    init_value_array(chunk.globals);
+    chunk.objects = {};
+    chunk.jit = nullptr;
+    chunk.jit_failed = false;
+    chunk.runs = 0;
+    chunk.optimized = nullptr;
+    chunk.optimize_failed = false;
+    chunk.shared = false;
 }
 
 void free_chunk(Chunk& chunk)
@@ -17,6 +26,18 @@ void free_chunk(Chunk& chunk)
     FREE_ARRAY(uint8_t, chunk.code, chunk.capacity);
     FREE_ARRAY(int, chunk.lines, chunk.capacity);
     free_value_array(chunk.constants);
+    free_value_array(chunk.globals);
+    free_objects(chunk.objects);
+    if (chunk.jit != nullptr)
+    {
+        free_jit_code(*chunk.jit);
+        FREE(JitCode, chunk.jit);
+    }
+    if (chunk.optimized != nullptr)
+    {
+        free_chunk(*chunk.optimized);
+        FREE(Chunk, chunk.optimized);
+    }
     init_chunk(chunk);
 }
 
@@ -40,3 +61,86 @@ int add_constant(Chunk& chunk, Value value)
     write_value_array(chunk.constants, value);
     return chunk.constants.count - 1;
 }
+
+int instruction_length(uint8_t op)
+{
+    switch (op)
+    {
+    case OP_CONSTANT:
+    case OP_GET_LOCAL:
+    case OP_SET_LOCAL:
+        return 2;
+    case OP_GET_GLOBAL:
+    case OP_SET_GLOBAL:
+    case OP_DEFINE_GLOBAL:
+    case OP_JUMP:
+    case OP_JUMP_IF_FALSE:
+    case OP_LOOP:
+        return 3;
+    default:
+        return 1;
+    }
+}
+
+uint8_t generic_opcode(uint8_t op)
+{
+    switch (op)
+    {
+    case OP_GREATER_NUM: return OP_GREATER;
+    case OP_LESS_NUM: return OP_LESS;
+    case OP_ADD_NUM_NUM:
+    case OP_ADD_STR_STR: return OP_ADD;
+    case OP_SUBTRACT_NUM: return OP_SUBTRACT;
+    case OP_MULTIPLY_NUM: return OP_MULTIPLY;
+    case OP_DIVIDE_NUM: return OP_DIVIDE;
+    case OP_NEGATE_NUM: return OP_NEGATE;
+    default: return op;
+    }
+}
+
+// How many values an instruction takes off the stack and how many it puts
+// back, as run() executes it.
+void stack_effect(uint8_t op, int& pops, int& pushes)
+{
+    switch (op)
+    {
+    case OP_CONSTANT:
+    case OP_NIL:
+    case OP_TRUE:
+    case OP_FALSE:
+    case OP_GET_LOCAL:
+    case OP_GET_GLOBAL:
+        pops = 0;
+        pushes = 1;
+        return;
+    case OP_POP:
+    case OP_DEFINE_GLOBAL:
+    case OP_PRINT:
+    case OP_RETURN:
+        pops = 1;
+        pushes = 0;
+        return;
+    case OP_SET_LOCAL:
+    case OP_SET_GLOBAL:
+    case OP_NOT:
+    case OP_NEGATE:
+    case OP_NEGATE_NUM:
+    case OP_NEGATE_F64:
+    case OP_JUMP_IF_FALSE:
+    case OP_YIELD:
+    case OP_READ:
+        pops = 1;
+        pushes = 1;
+        return;
+    case OP_JUMP:
+    case OP_LOOP:
+    case OP_HALT:
+        pops = 0;
+        pushes = 0;
+        return;
+    default: // the binary operators
+        pops = 2;
+        pushes = 1;
+        return;
+    }
+}
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "common.h"
+#include "memory.h"
 #include "value.h"
 
 enum OpCode
@@ -9,6 +10,12 @@ enum OpCode
     OP_NIL,
     OP_TRUE,
     OP_FALSE,
+    OP_POP,
+    OP_GET_LOCAL,
+    OP_SET_LOCAL,
+    OP_GET_GLOBAL,    // these three take a 16-bit index into Chunk::globals
+    OP_SET_GLOBAL,
+    OP_DEFINE_GLOBAL,
     OP_EQUAL,
     OP_GREATER,
     OP_LESS,
@@ -18,9 +25,41 @@ enum OpCode
     OP_DIVIDE,
     OP_NOT,
     OP_NEGATE,
+    OP_PRINT,
+    OP_JUMP,
+    OP_JUMP_IF_FALSE,
+    OP_LOOP,
     OP_RETURN,
+    OP_HALT,
+    OP_YIELD,
+    OP_READ,
+
+    // Quickened forms. run() rewrites a generic opcode in place into one of
+    // these once it has seen the operand types, and rewrites it back when
+    // the guard fails.
+    OP_GREATER_NUM,
+    OP_LESS_NUM,
+    OP_ADD_NUM_NUM,
+    OP_ADD_STR_STR,
+    OP_SUBTRACT_NUM,
+    OP_MULTIPLY_NUM,
+    OP_DIVIDE_NUM,
+    OP_NEGATE_NUM,
+
+    // Unchecked forms, emitted by the compiler where it has proven both
+    // operands are numbers.
+    OP_EQUAL_F64,
+    OP_GREATER_F64,
+    OP_LESS_F64,
+    OP_ADD_F64,
+    OP_SUBTRACT_F64,
+    OP_MULTIPLY_F64,
+    OP_DIVIDE_F64,
+    OP_NEGATE_F64,
 };
 
+struct JitCode;
+
 struct Chunk
 {
     int count;
@@ -29,6 +68,17 @@ struct Chunk
 
     int* lines;
     ValueArray constants;
+    ValueArray globals; // interned names of the globals the code uses, see globals.h
+    ObjList objects; // strings the optimizer folded into the constants, freed with the chunk
+
+    JitCode* jit;    // native code, compiled on first use under --jit
+    bool jit_failed; // the chunk uses an opcode the JIT does not handle
+
+    uint32_t runs;         // counted by interpret(), to find chunks worth optimizing
+    Chunk* optimized;      // built by optimize_chunk() once the chunk is hot
+    bool optimize_failed;  // the chunk uses an opcode the optimizer does not handle
+
+    bool shared; // owned by a Program and possibly running on other threads: read only
 };
 
 void init_chunk(Chunk& chunk);
@@ -36,3 +86,12 @@ void free_chunk(Chunk& chunk);
 
 void write_chunk(Chunk& chunk, uint8_t byte, int line);
 int add_constant(Chunk& chunk, Value value);
+
+// Bytes taken by an instruction with opcode `op`, operands included.
+int instruction_length(uint8_t op);
+// The generic opcode a quickened one stands for; any other opcode is
+// returned as it is.
+uint8_t generic_opcode(uint8_t op);
+// How many values an instruction takes off the stack and how many it puts
+// back, as run() executes it.
+void stack_effect(uint8_t op, int& pops, int& pushes);
@@ -1,25 +1,66 @@
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 
 #include "common.h"
 #include "compiler.h"
 #include "scanner.h"
 #include "object.h"
+#include "intern.h"
+#include "globals.h"
+#include "number.h"
+#include "table.h"
 
 #ifdef DEBUG_PRINT_CODE
 #include "debug.h"
 #endif
 
+// What the compiler can prove about the value an expression leaves on the
+// stack. Operands proven to be numbers get the unchecked _F64 opcodes.
+enum StaticType
+{
+    TYPE_UNKNOWN,
+    TYPE_NIL,
+    TYPE_BOOL,
+    TYPE_NUMBER,
+    TYPE_STRING,
+};
+
+// A variable declared in a block. Locals live in the stack slot matching
+// their index, so they are resolved here and never looked up by name at
+// runtime. Variables declared at the top level are globals.
+struct Local
+{
+    Token name;
+    int depth; // of the enclosing scope, -1 until the initializer is compiled
+};
+
+constexpr int LOCALS_MAX = UINT8_MAX + 1;
+
 struct Parser
 {
-    ScannerState* scanner;
+    TokenCursor tokens;
     Chunk* compiling_chunk;
     Token current;
     Token previous;
     bool had_error;
     bool panic_mode;
 
-    ObjList* constants;
+    StaticType type; // of the expression compiled last
+    bool can_assign; // the prefix being compiled may be an assignment target
+
+    Local locals[LOCALS_MAX];
+    int local_count;
+    int scope_depth;
+
+    // Values on the stack after the code emitted so far, counted along the
+    // straight line. Between statements the stack holds just the locals,
+    // so each statement starts over from local_count.
+    int stack_depth;
+    int next_op; // offset of the next opcode, so operands are not counted
+    bool has_result; // the script ends in an expression, whose value it prints
+
+    Table globals; // global name to its index in the chunk's globals
 };
 
 enum Precedence
@@ -47,11 +88,16 @@ struct ParseRule
 };
 
 static void grouping(Parser&);
+static void variable(Parser&);
+static void and_op(Parser&);
+static void or_op(Parser&);
 static void unary(Parser&);
 static void binary(Parser&);
 static void literal_val(Parser&);
 static void number(Parser&);
 static void string(Parser&);
+static void read(Parser&);
+static void yield(Parser&);
 
 static constexpr ParseRule PARSE_RULES[] =
 {
@@ -74,10 +120,10 @@ static constexpr ParseRule PARSE_RULES[] =
     { nullptr,     binary,  PREC_COMPARISON }, // TOKEN_GREATER_EQUAL   
     { nullptr,     binary,  PREC_COMPARISON }, // TOKEN_LESS            
     { nullptr,     binary,  PREC_COMPARISON }, // TOKEN_LESS_EQUAL      
-    { nullptr,     nullptr, PREC_NONE },       // TOKEN_IDENTIFIER      
+    { variable,    nullptr, PREC_NONE },       // TOKEN_IDENTIFIER      
     { string,      nullptr, PREC_NONE },       // TOKEN_STRING          
     { number,      nullptr, PREC_NONE },       // TOKEN_NUMBER          
-    { nullptr,     nullptr, PREC_NONE },       // TOKEN_AND             
+    { nullptr,     and_op,  PREC_AND },        // TOKEN_AND             
     { nullptr,     nullptr, PREC_NONE },       // TOKEN_CLASS           
     { nullptr,     nullptr, PREC_NONE },       // TOKEN_ELSE            
     { literal_val, nullptr, PREC_NONE },       // TOKEN_FALSE           
@@ -85,14 +131,16 @@ static constexpr ParseRule PARSE_RULES[] =
     { nullptr,     nullptr, PREC_NONE },       // TOKEN_FUN             
     { nullptr,     nullptr, PREC_NONE },       // TOKEN_IF              
     { literal_val, nullptr, PREC_NONE },       // TOKEN_NIL             
-    { nullptr,     nullptr, PREC_NONE },       // TOKEN_OR              
+    { nullptr,     or_op,   PREC_OR },         // TOKEN_OR              
     { nullptr,     nullptr, PREC_NONE },       // TOKEN_PRINT           
+    { read,        nullptr, PREC_NONE },       // TOKEN_READ
     { nullptr,     nullptr, PREC_NONE },       // TOKEN_RETURN          
     { nullptr,     nullptr, PREC_NONE },       // TOKEN_SUPER           
     { nullptr,     nullptr, PREC_NONE },       // TOKEN_THIS            
     { literal_val, nullptr, PREC_NONE },       // TOKEN_TRUE            
     { nullptr,     nullptr, PREC_NONE },       // TOKEN_VAR             
     { nullptr,     nullptr, PREC_NONE },       // TOKEN_WHILE           
+    { yield,       nullptr, PREC_NONE },       // TOKEN_YIELD
     { nullptr,     nullptr, PREC_NONE },       // TOKEN_ERROR           
     { nullptr,     nullptr, PREC_NONE },       // TOKEN_EOF
 };
@@ -134,7 +182,7 @@ static void advance(Parser& parser)
     parser.previous = parser.current;
     for (;;)
     {
-        parser.current = scan_token(*parser.scanner);
+        parser.current = next_token(parser.tokens);
         if (parser.current.type != TOKEN_ERROR)
             break;
         error_at_current(parser, parser.current.start);
@@ -149,6 +197,19 @@ static void consume(Parser& parser, TokenType type, const char* message)
         error_at_current(parser, message);
 }
 
+static bool check(const Parser& parser, TokenType type)
+{
+    return parser.current.type == type;
+}
+
+static bool match(Parser& parser, TokenType type)
+{
+    if (!check(parser, type))
+        return false;
+    advance(parser);
+    return true;
+}
+
 static Chunk* current_chunk(Parser& parser)
 {
     return parser.compiling_chunk;
@@ -165,7 +226,18 @@ static uint8_t make_constant(Parser& parser, Value value)
 
 static void emit_byte(Parser& parser, uint8_t value)
 {
-    write_chunk(*current_chunk(parser), value, parser.previous.line);
+    Chunk& chunk = *current_chunk(parser);
+    if (chunk.count == parser.next_op)
+    {
+        int pops;
+        int pushes;
+        stack_effect(value, pops, pushes);
+        parser.stack_depth += pushes - pops;
+        parser.next_op += instruction_length(value);
+        if (parser.stack_depth > STACK_MAX)
+            error(parser, "Too many local variables and temporaries for the stack");
+    }
+    write_chunk(chunk, value, parser.previous.line);
 }
 
 static void emit_bytes(Parser& parser, uint8_t v0, uint8_t v1)
@@ -174,9 +246,51 @@ static void emit_bytes(Parser& parser, uint8_t v0, uint8_t v1)
     emit_byte(parser, v1);
 }
 
+// Emits a jump with a placeholder offset and returns where to patch it.
+static int emit_jump(Parser& parser, uint8_t instruction)
+{
+    emit_byte(parser, instruction);
+    emit_byte(parser, 0xff);
+    emit_byte(parser, 0xff);
+    return current_chunk(parser)->count - 2;
+}
+
+// Points the jump at `offset` to the next instruction emitted.
+static void patch_jump(Parser& parser, int offset)
+{
+    Chunk& chunk = *current_chunk(parser);
+    int jump = chunk.count - offset - 2;
+    if (jump > UINT16_MAX)
+        error(parser, "Too much code to jump over");
+
+    chunk.code[offset] = static_cast<uint8_t>((jump >> 8) & 0xff);
+    chunk.code[offset + 1] = static_cast<uint8_t>(jump & 0xff);
+}
+
+static void emit_loop(Parser& parser, int loop_start)
+{
+    emit_byte(parser, OP_LOOP);
+
+    int offset = current_chunk(parser)->count - loop_start + 2;
+    if (offset > UINT16_MAX)
+        error(parser, "Loop body too large");
+
+    emit_byte(parser, static_cast<uint8_t>((offset >> 8) & 0xff));
+    emit_byte(parser, static_cast<uint8_t>(offset & 0xff));
+}
+
+// A script that ends in an expression prints its value with OP_RETURN, as
+// when scripts were a single expression. Other scripts end in OP_HALT.
 static void emit_return(Parser& parser)
 {
-    emit_byte(parser, OP_RETURN);
+    emit_byte(parser, parser.has_result ? OP_RETURN : OP_HALT);
+}
+
+static void emit_global(Parser& parser, uint8_t instruction, int index)
+{
+    emit_byte(parser, instruction);
+    emit_byte(parser, static_cast<uint8_t>((index >> 8) & 0xff));
+    emit_byte(parser, static_cast<uint8_t>(index & 0xff));
 }
 
 static void emit_constant(Parser& parser, Value value)
@@ -202,6 +316,8 @@ static void parse_precedence(Parser& parser, Precedence precedence)
         error(parser, "Expect expression");
     else
     {
+        bool can_assign = precedence <= PREC_ASSIGNMENT;
+        parser.can_assign = can_assign;
         prefix_rule(parser);
 
         while (precedence <= get_rule(parser.current.type).precedence)
@@ -211,18 +327,114 @@ static void parse_precedence(Parser& parser, Precedence precedence)
             if (infix_rule != nullptr)
                 infix_rule(parser);
         }
+
+        if (can_assign && match(parser, TOKEN_EQUAL))
+            error(parser, "Invalid assignment target");
     }
 }
 
+static void expression(Parser&);
+
+static bool identifiers_equal(const Token& a, const Token& b)
+{
+    return a.length == b.length && memcmp(a.start, b.start, static_cast<size_t>(a.length)) == 0;
+}
+
+static int resolve_local(Parser& parser, const Token& name)
+{
+    for (int i = parser.local_count - 1; i >= 0; i--)
+    {
+        const Local& local = parser.locals[i];
+        if (identifiers_equal(name, local.name))
+        {
+            if (local.depth == -1)
+                error(parser, "Can't read local variable in its own initializer");
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Any name that is not a local is a global, defined or not: it may be
+// defined later, or by an earlier script on the same VM.
+static int resolve_global(Parser& parser, const Token& name)
+{
+    ObjString* string = intern_string(name.start, name.length);
+    Value index;
+    if (table_get(parser.globals, string, index))
+        return static_cast<int>(as_number(index));
+
+    Chunk& chunk = *current_chunk(parser);
+    if (chunk.globals.count == GLOBALS_MAX)
+    {
+        error(parser, "Too many global variables in one chunk");
+        return 0;
+    }
+    write_value_array(chunk.globals, obj_val(string));
+    table_set(parser.globals, string, number_val(chunk.globals.count - 1));
+    return chunk.globals.count - 1;
+}
+
+static void variable(Parser& parser)
+{
+    bool can_assign = parser.can_assign;
+    Token name = parser.previous;
+    int slot = resolve_local(parser, name);
+    bool global = slot < 0;
+    if (global)
+        slot = resolve_global(parser, name);
+
+    // An assignment leaves the value, and its type, on the stack.
+    if (can_assign && match(parser, TOKEN_EQUAL))
+    {
+        expression(parser);
+        if (global)
+            emit_global(parser, OP_SET_GLOBAL, slot);
+        else
+            emit_bytes(parser, OP_SET_LOCAL, static_cast<uint8_t>(slot));
+    }
+    else
+    {
+        if (global)
+            emit_global(parser, OP_GET_GLOBAL, slot);
+        else
+            emit_bytes(parser, OP_GET_LOCAL, static_cast<uint8_t>(slot));
+        parser.type = TYPE_UNKNOWN;
+    }
+}
+
+// Both leave the deciding operand on the stack.
+static void and_op(Parser& parser)
+{
+    int end_jump = emit_jump(parser, OP_JUMP_IF_FALSE);
+    emit_byte(parser, OP_POP);
+    parse_precedence(parser, PREC_AND);
+    patch_jump(parser, end_jump);
+    parser.type = TYPE_UNKNOWN;
+}
+
+static void or_op(Parser& parser)
+{
+    int else_jump = emit_jump(parser, OP_JUMP_IF_FALSE);
+    int end_jump = emit_jump(parser, OP_JUMP);
+    patch_jump(parser, else_jump);
+    emit_byte(parser, OP_POP);
+    parse_precedence(parser, PREC_OR);
+    patch_jump(parser, end_jump);
+    parser.type = TYPE_UNKNOWN;
+}
+
 static void number(Parser& parser)
 {
-    double value = strtod(parser.previous.start, nullptr);
+    double value = parse_number(parser.previous.start, parser.previous.length);
     emit_constant(parser, number_val(value));
+    parser.type = TYPE_NUMBER;
 }
 
 static void string(Parser& parser)
 {
-    emit_constant(parser, obj_val(copy_string(*parser.constants, parser.previous.start + 1, parser.previous.length - 2)));
+    emit_constant(parser, obj_val(intern_string(parser.previous.start + 1, parser.previous.length - 2)));
+    parser.type = TYPE_STRING;
 }
 
 static void unary(Parser& parser)
@@ -230,40 +442,89 @@ static void unary(Parser& parser)
     TokenType operator_type = parser.previous.type;
 
     parse_precedence(parser, PREC_UNARY);
+    bool numeric = parser.type == TYPE_NUMBER;
 
     switch (operator_type)
     {
-    case TOKEN_BANG: emit_byte(parser, OP_NOT); break;
-    case TOKEN_MINUS: emit_byte(parser, OP_NEGATE); break;
+    case TOKEN_BANG:
+        emit_byte(parser, OP_NOT);
+        parser.type = TYPE_BOOL;
+        break;
+    case TOKEN_MINUS:
+        emit_byte(parser, numeric ? OP_NEGATE_F64 : OP_NEGATE);
+        parser.type = TYPE_NUMBER;
+        break;
 
     default:
         return;
     }
 }
 
+// `yield x` suspends the running fiber and evaluates to x once it is
+// resumed. Outside a fiber there is nothing to switch to and it is just x.
+static void yield(Parser& parser)
+{
+    parse_precedence(parser, PREC_UNARY);
+    emit_byte(parser, OP_YIELD);
+}
+
+// `read path` evaluates to the contents of the file, or nil if it cannot
+// be read. In a fiber the read may suspend it, see aio.h.
+static void read(Parser& parser)
+{
+    parse_precedence(parser, PREC_UNARY);
+    emit_byte(parser, OP_READ);
+    parser.type = TYPE_UNKNOWN;
+}
+
 static void binary(Parser& parser)
 {
     TokenType operator_type = parser.previous.type;
+    StaticType left = parser.type;
 
     const ParseRule& rule = get_rule(operator_type);
     parse_precedence(parser, (Precedence)(rule.precedence + 1));
+    StaticType right = parser.type;
+    bool numeric = left == TYPE_NUMBER && right == TYPE_NUMBER;
 
+    // The checked opcodes fail at runtime unless their operands have the
+    // right types, so whatever follows them can rely on their result type.
     switch (operator_type)
     {
-    case TOKEN_BANG_EQUAL:    emit_bytes(parser, OP_EQUAL, OP_NOT); break;
-    case TOKEN_EQUAL_EQUAL:   emit_byte(parser, OP_EQUAL); break;
-    case TOKEN_GREATER:       emit_byte(parser, OP_GREATER); break;
-    case TOKEN_GREATER_EQUAL: emit_bytes(parser, OP_LESS, OP_NOT); break;
-    case TOKEN_LESS:          emit_byte(parser, OP_LESS); break;
-    case TOKEN_LESS_EQUAL:    emit_bytes(parser, OP_GREATER, OP_NOT); break;
-    case TOKEN_PLUS:          emit_byte(parser, OP_ADD); break;
-    case TOKEN_MINUS:         emit_byte(parser, OP_SUBTRACT); break;
-    case TOKEN_STAR:          emit_byte(parser, OP_MULTIPLY); break;
-    case TOKEN_SLASH:         emit_byte(parser, OP_DIVIDE); break;
+    case TOKEN_BANG_EQUAL:    emit_bytes(parser, numeric ? OP_EQUAL_F64 : OP_EQUAL, OP_NOT); break;
+    case TOKEN_EQUAL_EQUAL:   emit_byte(parser, numeric ? OP_EQUAL_F64 : OP_EQUAL); break;
+    case TOKEN_GREATER:       emit_byte(parser, numeric ? OP_GREATER_F64 : OP_GREATER); break;
+    case TOKEN_GREATER_EQUAL: emit_bytes(parser, numeric ? OP_LESS_F64 : OP_LESS, OP_NOT); break;
+    case TOKEN_LESS:          emit_byte(parser, numeric ? OP_LESS_F64 : OP_LESS); break;
+    case TOKEN_LESS_EQUAL:    emit_bytes(parser, numeric ? OP_GREATER_F64 : OP_GREATER, OP_NOT); break;
+    case TOKEN_PLUS:          emit_byte(parser, numeric ? OP_ADD_F64 : OP_ADD); break;
+    case TOKEN_MINUS:         emit_byte(parser, numeric ? OP_SUBTRACT_F64 : OP_SUBTRACT); break;
+    case TOKEN_STAR:          emit_byte(parser, numeric ? OP_MULTIPLY_F64 : OP_MULTIPLY); break;
+    case TOKEN_SLASH:         emit_byte(parser, numeric ? OP_DIVIDE_F64 : OP_DIVIDE); break;
 
     default:
         return;
     }
+
+    switch (operator_type)
+    {
+    case TOKEN_PLUS:
+        if (numeric)
+            parser.type = TYPE_NUMBER;
+        else if (left == TYPE_STRING && right == TYPE_STRING)
+            parser.type = TYPE_STRING;
+        else
+            parser.type = TYPE_UNKNOWN;
+        break;
+    case TOKEN_MINUS:
+    case TOKEN_STAR:
+    case TOKEN_SLASH:
+        parser.type = TYPE_NUMBER;
+        break;
+    default:
+        parser.type = TYPE_BOOL;
+        break;
+    }
 }
 
 static void literal_val(Parser& parser)
@@ -272,12 +533,15 @@ static void literal_val(Parser& parser)
     {
     case TOKEN_NIL:
         emit_byte(parser, OP_NIL);
+        parser.type = TYPE_NIL;
         break;
     case TOKEN_FALSE:
         emit_byte(parser, OP_FALSE);
+        parser.type = TYPE_BOOL;
         break;
     case TOKEN_TRUE:
         emit_byte(parser, OP_TRUE);
+        parser.type = TYPE_BOOL;
         break;
 
     default:
@@ -296,20 +560,281 @@ static void grouping(Parser& parser)
     consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after expression");
 }
 
-bool compile(const char* source, Chunk& chunk, ObjList& constants)
+static void declaration(Parser& parser);
+static void statement(Parser& parser);
+
+static void begin_scope(Parser& parser)
 {
-    ScannerState scanner_state = {};
-    init_scanner_state(scanner_state, source);
+    parser.scope_depth++;
+}
+
+static void end_scope(Parser& parser)
+{
+    parser.scope_depth--;
+    while (parser.local_count > 0 && parser.locals[parser.local_count - 1].depth > parser.scope_depth)
+    {
+        emit_byte(parser, OP_POP);
+        parser.local_count--;
+    }
+}
+
+static void declare_variable(Parser& parser)
+{
+    const Token& name = parser.previous;
+    for (int i = parser.local_count - 1; i >= 0; i--)
+    {
+        const Local& local = parser.locals[i];
+        if (local.depth != -1 && local.depth < parser.scope_depth)
+            break;
+        if (identifiers_equal(name, local.name))
+            error(parser, "Already a variable with this name in this scope");
+    }
+
+    if (parser.local_count == LOCALS_MAX)
+    {
+        error(parser, "Too many local variables");
+        return;
+    }
+    Local& local = parser.locals[parser.local_count++];
+    local.name = name;
+    local.depth = -1;
+}
+
+static void var_declaration(Parser& parser)
+{
+    consume(parser, TOKEN_IDENTIFIER, "Expect variable name");
+    int global = -1;
+    if (parser.scope_depth > 0)
+        declare_variable(parser);
+    else
+        global = resolve_global(parser, parser.previous);
+
+    if (match(parser, TOKEN_EQUAL))
+        expression(parser);
+    else
+        emit_byte(parser, OP_NIL);
+    consume(parser, TOKEN_SEMICOLON, "Expect ';' after variable declaration");
+
+    if (parser.scope_depth == 0)
+        emit_global(parser, OP_DEFINE_GLOBAL, global);
+    else if (parser.local_count > 0)
+        parser.locals[parser.local_count - 1].depth = parser.scope_depth;
+}
+
+static void expression_statement(Parser& parser)
+{
+    expression(parser);
+    consume(parser, TOKEN_SEMICOLON, "Expect ';' after expression");
+    emit_byte(parser, OP_POP);
+}
+
+static void print_statement(Parser& parser)
+{
+    expression(parser);
+    consume(parser, TOKEN_SEMICOLON, "Expect ';' after value");
+    emit_byte(parser, OP_PRINT);
+}
+
+static void block(Parser& parser)
+{
+    while (!check(parser, TOKEN_RIGHT_BRACE) && !check(parser, TOKEN_EOF))
+        declaration(parser);
+    consume(parser, TOKEN_RIGHT_BRACE, "Expect '}' after block");
+}
+
+static void if_statement(Parser& parser)
+{
+    consume(parser, TOKEN_LEFT_PAREN, "Expect '(' after 'if'");
+    expression(parser);
+    consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after condition");
+
+    int then_jump = emit_jump(parser, OP_JUMP_IF_FALSE);
+    emit_byte(parser, OP_POP);
+    statement(parser);
+    int else_jump = emit_jump(parser, OP_JUMP);
+
+    patch_jump(parser, then_jump);
+    emit_byte(parser, OP_POP);
+    if (match(parser, TOKEN_ELSE))
+        statement(parser);
+    patch_jump(parser, else_jump);
+}
+
+static void while_statement(Parser& parser)
+{
+    int loop_start = current_chunk(parser)->count;
+    consume(parser, TOKEN_LEFT_PAREN, "Expect '(' after 'while'");
+    expression(parser);
+    consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after condition");
+
+    int exit_jump = emit_jump(parser, OP_JUMP_IF_FALSE);
+    emit_byte(parser, OP_POP);
+    statement(parser);
+    emit_loop(parser, loop_start);
+
+    patch_jump(parser, exit_jump);
+    emit_byte(parser, OP_POP);
+}
+
+static void for_statement(Parser& parser)
+{
+    begin_scope(parser);
+    consume(parser, TOKEN_LEFT_PAREN, "Expect '(' after 'for'");
+    if (match(parser, TOKEN_SEMICOLON))
+        ;
+    else if (match(parser, TOKEN_VAR))
+        var_declaration(parser);
+    else
+        expression_statement(parser);
+
+    int loop_start = current_chunk(parser)->count;
+    int exit_jump = -1;
+    if (!match(parser, TOKEN_SEMICOLON))
+    {
+        expression(parser);
+        consume(parser, TOKEN_SEMICOLON, "Expect ';' after loop condition");
+        exit_jump = emit_jump(parser, OP_JUMP_IF_FALSE);
+        emit_byte(parser, OP_POP);
+    }
+
+    // The increment is compiled before the body but runs after it.
+    if (!match(parser, TOKEN_RIGHT_PAREN))
+    {
+        int body_jump = emit_jump(parser, OP_JUMP);
+        int increment_start = current_chunk(parser)->count;
+        expression(parser);
+        emit_byte(parser, OP_POP);
+        consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after for clauses");
+
+        emit_loop(parser, loop_start);
+        loop_start = increment_start;
+        patch_jump(parser, body_jump);
+    }
+
+    statement(parser);
+    emit_loop(parser, loop_start);
+
+    if (exit_jump != -1)
+    {
+        patch_jump(parser, exit_jump);
+        emit_byte(parser, OP_POP);
+    }
+    end_scope(parser);
+}
+
+static void statement(Parser& parser)
+{
+    parser.stack_depth = parser.local_count;
+    if (match(parser, TOKEN_PRINT))
+        print_statement(parser);
+    else if (match(parser, TOKEN_IF))
+        if_statement(parser);
+    else if (match(parser, TOKEN_WHILE))
+        while_statement(parser);
+    else if (match(parser, TOKEN_FOR))
+        for_statement(parser);
+    else if (match(parser, TOKEN_LEFT_BRACE))
+    {
+        begin_scope(parser);
+        block(parser);
+        end_scope(parser);
+    }
+    else
+        expression_statement(parser);
+}
+
+// Skips to a likely statement boundary, so one mistake is reported once.
+static void synchronize(Parser& parser)
+{
+    parser.panic_mode = false;
+
+    while (parser.current.type != TOKEN_EOF)
+    {
+        if (parser.previous.type == TOKEN_SEMICOLON)
+            return;
+        switch (parser.current.type)
+        {
+        case TOKEN_CLASS:
+        case TOKEN_FUN:
+        case TOKEN_VAR:
+        case TOKEN_FOR:
+        case TOKEN_IF:
+        case TOKEN_WHILE:
+        case TOKEN_PRINT:
+        case TOKEN_RETURN:
+            return;
+        default:
+            advance(parser);
+        }
+    }
+}
+
+static void declaration(Parser& parser)
+{
+    parser.stack_depth = parser.local_count;
+    if (match(parser, TOKEN_VAR))
+        var_declaration(parser);
+    else
+        statement(parser);
+
+    if (parser.panic_mode)
+        synchronize(parser);
+}
+
+// Like declaration(), but an expression statement that ends the script
+// may leave out its semicolon to make its value the script's result.
+static void top_level_declaration(Parser& parser)
+{
+    parser.stack_depth = parser.local_count;
+    switch (parser.current.type)
+    {
+    case TOKEN_VAR:
+    case TOKEN_PRINT:
+    case TOKEN_IF:
+    case TOKEN_WHILE:
+    case TOKEN_FOR:
+    case TOKEN_LEFT_BRACE:
+        declaration(parser);
+        return;
+    default:
+        break;
+    }
+
+    expression(parser);
+    if (check(parser, TOKEN_EOF) && !parser.had_error)
+    {
+        parser.has_result = true;
+        return;
+    }
+    consume(parser, TOKEN_SEMICOLON, "Expect ';' after expression");
+    emit_byte(parser, OP_POP);
+
+    if (parser.panic_mode)
+        synchronize(parser);
+}
+
+bool compile(const char* source, Chunk& chunk, int scan_threads)
+{
+    TokenBuffer tokens;
+    init_token_buffer(tokens);
+    if (!scan_all_parallel(tokens, source, scan_threads))
+    {
+        fprintf(stderr, "Error: source is too large to compile\n");
+        free_token_buffer(tokens);
+        return false;
+    }
 
     Parser parser = {};
-    parser.scanner = &scanner_state;
+    init_token_cursor(parser.tokens, tokens);
     parser.compiling_chunk = &chunk;
-    parser.constants = &constants;
+    init_table(parser.globals);
 
     advance(parser);
-    expression(parser);
-    consume(parser, TOKEN_EOF, "Expect end of expression");
+    while (!match(parser, TOKEN_EOF))
+        top_level_declaration(parser);
     end_compiler(parser);
 
+    free_table(parser.globals);
+    free_token_buffer(tokens);
     return !parser.had_error;
 }
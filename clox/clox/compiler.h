@@ -2,4 +2,8 @@
 
 #include "vm.h"
 
-bool compile(const char* source, Chunk& chunk, ObjList& constants);
+// String literals are interned (see intern.h), so the chunk's constants
+// belong to no VM, and nor do the names of the globals the chunk uses,
+// which each VM links to its own slots (see globals.h). The source is
+// scanned on up to `scan_threads` threads, as by scan_all_parallel().
+bool compile(const char* source, Chunk& chunk, int scan_threads = 0);
@@ -0,0 +1,18 @@
+#pragma once
+
+// Runtime CPU feature detection used to pick accelerated code paths once at
+// startup. Every query returns false on architectures the code does not
+// know about, so callers always fall back to their portable implementation.
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define CLOX_X64
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define CLOX_TARGET(features) __attribute__((target(features)))
+#else
+#define CLOX_TARGET(features)
+#endif
+
+bool cpu_has_sse42();
+bool cpu_has_avx2();
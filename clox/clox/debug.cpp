@@ -1,6 +1,7 @@
 #include <cstdio>
 
 #include "debug.h"
+#include "object.h"
 #include "value.h"
 
 static int simple_instruction(const char* name, int offset)
@@ -9,6 +10,27 @@ static int simple_instruction(const char* name, int offset)
     return offset + 1;
 }
 
+static int byte_instruction(const char* name, const Chunk& chunk, int offset)
+{
+    uint8_t slot = chunk.code[offset + 1];
+    printf("%-16s %4d\n", name, slot);
+    return offset + 2;
+}
+
+static int global_instruction(const char* name, const Chunk& chunk, int offset)
+{
+    int index = chunk.code[offset + 1] << 8 | chunk.code[offset + 2];
+    printf("%-16s %4d '%s'\n", name, index, index < chunk.globals.count ? as_cstring(chunk.globals.values[index]) : "?");
+    return offset + 3;
+}
+
+static int jump_instruction(const char* name, int sign, const Chunk& chunk, int offset)
+{
+    uint16_t jump = static_cast<uint16_t>(chunk.code[offset + 1] << 8 | chunk.code[offset + 2]);
+    printf("%-16s %4d -> %d\n", name, offset, offset + 3 + sign * jump);
+    return offset + 3;
+}
+
 static int constant_instruction(const char* name, const Chunk& chunk, int offset)
 {
     uint8_t constant = chunk.code[offset + 1];
@@ -46,6 +68,18 @@ int disassemble_instruction(const Chunk& chunk, int offset) {
         return simple_instruction("OP_TRUE", offset);
     case OP_FALSE:
         return simple_instruction("OP_FALSE", offset);
+    case OP_POP:
+        return simple_instruction("OP_POP", offset);
+    case OP_GET_LOCAL:
+        return byte_instruction("OP_GET_LOCAL", chunk, offset);
+    case OP_SET_LOCAL:
+        return byte_instruction("OP_SET_LOCAL", chunk, offset);
+    case OP_GET_GLOBAL:
+        return global_instruction("OP_GET_GLOBAL", chunk, offset);
+    case OP_SET_GLOBAL:
+        return global_instruction("OP_SET_GLOBAL", chunk, offset);
+    case OP_DEFINE_GLOBAL:
+        return global_instruction("OP_DEFINE_GLOBAL", chunk, offset);
     case OP_EQUAL:
         return simple_instruction("OP_EQUAL", offset);
     case OP_GREATER:
@@ -64,10 +98,149 @@ int disassemble_instruction(const Chunk& chunk, int offset) {
         return simple_instruction("OP_NOT", offset);
     case OP_NEGATE:
         return simple_instruction("OP_NEGATE", offset);
+    case OP_PRINT:
+        return simple_instruction("OP_PRINT", offset);
+    case OP_JUMP:
+        return jump_instruction("OP_JUMP", 1, chunk, offset);
+    case OP_JUMP_IF_FALSE:
+        return jump_instruction("OP_JUMP_IF_FALSE", 1, chunk, offset);
+    case OP_LOOP:
+        return jump_instruction("OP_LOOP", -1, chunk, offset);
     case OP_RETURN:
         return simple_instruction("OP_RETURN", offset);
+    case OP_HALT:
+        return simple_instruction("OP_HALT", offset);
+    case OP_YIELD:
+        return simple_instruction("OP_YIELD", offset);
+    case OP_READ:
+        return simple_instruction("OP_READ", offset);
+    case OP_GREATER_NUM:
+        return simple_instruction("OP_GREATER_NUM", offset);
+    case OP_LESS_NUM:
+        return simple_instruction("OP_LESS_NUM", offset);
+    case OP_ADD_NUM_NUM:
+        return simple_instruction("OP_ADD_NUM_NUM", offset);
+    case OP_ADD_STR_STR:
+        return simple_instruction("OP_ADD_STR_STR", offset);
+    case OP_SUBTRACT_NUM:
+        return simple_instruction("OP_SUBTRACT_NUM", offset);
+    case OP_MULTIPLY_NUM:
+        return simple_instruction("OP_MULTIPLY_NUM", offset);
+    case OP_DIVIDE_NUM:
+        return simple_instruction("OP_DIVIDE_NUM", offset);
+    case OP_NEGATE_NUM:
+        return simple_instruction("OP_NEGATE_NUM", offset);
+    case OP_EQUAL_F64:
+        return simple_instruction("OP_EQUAL_F64", offset);
+    case OP_GREATER_F64:
+        return simple_instruction("OP_GREATER_F64", offset);
+    case OP_LESS_F64:
+        return simple_instruction("OP_LESS_F64", offset);
+    case OP_ADD_F64:
+        return simple_instruction("OP_ADD_F64", offset);
+    case OP_SUBTRACT_F64:
+        return simple_instruction("OP_SUBTRACT_F64", offset);
+    case OP_MULTIPLY_F64:
+        return simple_instruction("OP_MULTIPLY_F64", offset);
+    case OP_DIVIDE_F64:
+        return simple_instruction("OP_DIVIDE_F64", offset);
+    case OP_NEGATE_F64:
+        return simple_instruction("OP_NEGATE_F64", offset);
     default:
         printf("Unknown opcode %d\n", instruction);
         return offset + 1;
     }
+}
+
+void disassemble_reg_chunk(const RegChunk& chunk, const char* name)
+{
+    printf("== %s (%d registers) ==\n", name, chunk.registers);
+
+    for (int i = 0; i < chunk.count; i++)
+        disassemble_reg_instruction(chunk, i);
+}
+
+static const char* reg_op_name(RegOp op)
+{
+    switch (op)
+    {
+    case ROP_MOVE: return "ROP_MOVE";
+    case ROP_LOADK: return "ROP_LOADK";
+    case ROP_EQUAL: return "ROP_EQUAL";
+    case ROP_GREATER: return "ROP_GREATER";
+    case ROP_LESS: return "ROP_LESS";
+    case ROP_ADD: return "ROP_ADD";
+    case ROP_SUBTRACT: return "ROP_SUBTRACT";
+    case ROP_MULTIPLY: return "ROP_MULTIPLY";
+    case ROP_DIVIDE: return "ROP_DIVIDE";
+    case ROP_NOT: return "ROP_NOT";
+    case ROP_NEGATE: return "ROP_NEGATE";
+    case ROP_RETURN: return "ROP_RETURN";
+    case ROP_EQUAL_F64: return "ROP_EQUAL_F64";
+    case ROP_GREATER_F64: return "ROP_GREATER_F64";
+    case ROP_LESS_F64: return "ROP_LESS_F64";
+    case ROP_ADD_F64: return "ROP_ADD_F64";
+    case ROP_SUBTRACT_F64: return "ROP_SUBTRACT_F64";
+    case ROP_MULTIPLY_F64: return "ROP_MULTIPLY_F64";
+    case ROP_DIVIDE_F64: return "ROP_DIVIDE_F64";
+    case ROP_NEGATE_F64: return "ROP_NEGATE_F64";
+    }
+    return nullptr;
+}
+
+static void rk_operand(const RegChunk& chunk, uint8_t operand)
+{
+    if (operand & RK_CONSTANT)
+    {
+        printf(" k%d '", operand & ~RK_CONSTANT);
+        print_value(chunk.constants.values[operand & ~RK_CONSTANT]);
+        printf("'");
+    }
+    else
+        printf(" r%d", operand);
+}
+
+void disassemble_reg_instruction(const RegChunk& chunk, int offset)
+{
+    printf("%04d ", offset);
+
+    if (offset > 0 && chunk.lines[offset] == chunk.lines[offset - 1])
+        printf("   | ");
+    else
+        printf("%4d ", chunk.lines[offset]);
+
+    uint32_t instruction = chunk.code[offset];
+    RegOp op = reg_op(instruction);
+    const char* name = reg_op_name(op);
+    if (name == nullptr)
+    {
+        printf("Unknown opcode %d\n", op);
+        return;
+    }
+
+    printf("%-16s", name);
+    switch (op)
+    {
+    case ROP_LOADK:
+        printf(" r%d k%d '", reg_a(instruction), reg_bc(instruction));
+        print_value(chunk.constants.values[reg_bc(instruction)]);
+        printf("'");
+        break;
+    case ROP_RETURN:
+        rk_operand(chunk, reg_b(instruction));
+        break;
+    case ROP_MOVE:
+    case ROP_NOT:
+    case ROP_NEGATE:
+    case ROP_NEGATE_F64:
+        printf(" r%d", reg_a(instruction));
+        rk_operand(chunk, reg_b(instruction));
+        break;
+    default:
+        printf(" r%d", reg_a(instruction));
+        rk_operand(chunk, reg_b(instruction));
+        rk_operand(chunk, reg_c(instruction));
+        break;
+    }
+    printf("\n");
 }
\ No newline at end of file
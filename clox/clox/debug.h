@@ -1,6 +1,10 @@
 #pragma once
 
 #include "chunk.h"
+#include "regchunk.h"
 
 void disassemble_chunk(const Chunk& chunk, const char* name);
 int disassemble_instruction(const Chunk& chunk, int i);
+
+void disassemble_reg_chunk(const RegChunk& chunk, const char* name);
+void disassemble_reg_instruction(const RegChunk& chunk, int i);
@@ -0,0 +1,150 @@
+#include <cstddef>
+#include <cstring>
+
+#include "fiber.h"
+#include "aio.h"
+#include "memory.h"
+#include "vm.h"
+
+static size_t fiber_size(const Fiber& fiber)
+{
+    return sizeof(Fiber) + sizeof(int) * static_cast<size_t>(fiber.chunk->globals.count) +
+        sizeof(Value) * static_cast<size_t>(fiber.capacity);
+}
+
+static void add_fiber_bytes(VM& vm, ptrdiff_t bytes)
+{
+    vm.fiber_bytes += static_cast<size_t>(bytes);
+    if (vm.fiber_bytes > vm.fiber_peak)
+        vm.fiber_peak = vm.fiber_bytes;
+}
+
+Fiber* spawn_fiber(VM& vm, Chunk& chunk)
+{
+    Fiber* fiber = ALLOCATE(Fiber, 1);
+    fiber->chunk = &chunk;
+    fiber->ip = chunk.code;
+    fiber->global_slots = ALLOCATE(int, chunk.globals.count);
+    link_globals(vm.globals, chunk, fiber->global_slots);
+    fiber->depth = 0;
+    fiber->capacity = 0;
+    fiber->stack = nullptr;
+
+    wake_fiber(vm, *fiber);
+    add_fiber_bytes(vm, static_cast<ptrdiff_t>(fiber_size(*fiber)));
+    return fiber;
+}
+
+// The ring is in run order from vm.fibers, so the fiber goes last.
+void wake_fiber(VM& vm, Fiber& fiber)
+{
+    Fiber* first = vm.fibers;
+    if (first == nullptr)
+    {
+        fiber.prev = fiber.next = &fiber;
+        vm.fibers = &fiber;
+    }
+    else
+    {
+        fiber.prev = first->prev;
+        fiber.next = first;
+        first->prev->next = &fiber;
+        first->prev = &fiber;
+    }
+}
+
+void save_fiber(VM& vm, Fiber& fiber)
+{
+    int depth = static_cast<int>(vm.stack_top - vm.stack);
+    if (depth > fiber.capacity)
+    {
+        size_t old_size = fiber_size(fiber);
+        int old_capacity = fiber.capacity;
+        while (fiber.capacity < depth)
+            fiber.capacity = GROW_CAPACITY(fiber.capacity);
+        fiber.stack = GROW_ARRAY(fiber.stack, Value, old_capacity, fiber.capacity);
+        add_fiber_bytes(vm, static_cast<ptrdiff_t>(fiber_size(fiber) - old_size));
+    }
+    memcpy(fiber.stack, vm.stack, sizeof(Value) * static_cast<size_t>(depth));
+    fiber.depth = depth;
+    fiber.chunk = vm.chunk;
+    fiber.ip = vm.ip;
+}
+
+void load_fiber(VM& vm, Fiber& fiber)
+{
+    // A fiber that has never yielded has no saved stack.
+    if (fiber.depth > 0)
+        memcpy(vm.stack, fiber.stack, sizeof(Value) * static_cast<size_t>(fiber.depth));
+    vm.stack_top = vm.stack + fiber.depth;
+    vm.chunk = fiber.chunk;
+    vm.ip = fiber.ip;
+    vm.global_slots = fiber.global_slots;
+    vm.fiber = vm.fibers = &fiber;
+}
+
+static void free_fiber(VM& vm, Fiber* fiber)
+{
+    add_fiber_bytes(vm, -static_cast<ptrdiff_t>(fiber_size(*fiber)));
+    FREE_ARRAY(Value, fiber->stack, fiber->capacity);
+    FREE_ARRAY(int, fiber->global_slots, fiber->chunk->globals.count);
+    FREE(Fiber, fiber);
+}
+
+void switch_fiber(VM& vm)
+{
+    Fiber& fiber = *vm.fiber;
+    if (fiber.next == &fiber)
+        return;
+    save_fiber(vm, fiber);
+    load_fiber(vm, *fiber.next);
+}
+
+// Takes the running fiber out of the ring and loads the one after it,
+// waiting for parked fibers to wake if there is none.
+static bool unlink_fiber(VM& vm)
+{
+    Fiber* fiber = vm.fiber;
+    Fiber* next = fiber->next;
+    if (next == fiber)
+        next = nullptr;
+    else
+    {
+        fiber->prev->next = next;
+        next->prev = fiber->prev;
+    }
+
+    vm.fiber = vm.fibers = next;
+    while (vm.fibers == nullptr && vm.io != nullptr && complete_reads(vm, true))
+        ;
+    if (vm.fibers == nullptr)
+        return false;
+    load_fiber(vm, *vm.fibers);
+    return true;
+}
+
+void park_fiber(VM& vm)
+{
+    save_fiber(vm, *vm.fiber);
+    unlink_fiber(vm);
+}
+
+bool retire_fiber(VM& vm)
+{
+    Fiber* fiber = vm.fiber;
+    bool loaded = unlink_fiber(vm);
+    free_fiber(vm, fiber);
+    return loaded;
+}
+
+void free_fibers(VM& vm)
+{
+    while (vm.fibers != nullptr)
+    {
+        Fiber* fiber = vm.fibers;
+        vm.fibers = fiber->next == fiber ? nullptr : fiber->next;
+        fiber->prev->next = fiber->next;
+        fiber->next->prev = fiber->prev;
+        free_fiber(vm, fiber);
+    }
+}
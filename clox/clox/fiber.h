@@ -0,0 +1,55 @@
+#pragma once
+
+#include "chunk.h"
+#include "value.h"
+
+struct VM;
+
+// A script activation that can be suspended at `yield` and resumed later,
+// many to one VM and one OS thread. The VM runs one fiber at a time on its
+// own stack; switching away copies the fiber's live slots out and the next
+// fiber's in, so a suspended fiber holds only as many values as it had on
+// the stack when it yielded, and a switch costs as much as those copies.
+//
+// Queued fibers form a ring through vm.fibers, which run_fibers() turns
+// round: each `yield` passes control to the next fiber and each fiber that
+// finishes, or fails, leaves the ring. vm.fiber is the running one, and
+// nullptr outside run_fibers(), where `yield` does not switch.
+struct Fiber
+{
+    Chunk* chunk;
+    uint8_t* ip;
+    int* global_slots; // the chunk's globals as the VM's slots, see VM
+
+    // Saved slots while suspended: stack[0, depth) are vm.stack[0, depth).
+    int depth;
+    int capacity;
+    Value* stack;
+
+    Fiber* prev;
+    Fiber* next;
+};
+
+// Queues a fiber that runs the chunk from the start, after those already
+// queued, linking the chunk's globals to the VM's. The chunk must outlive
+// the fiber; fibers share it like threads share a Program, but only one
+// runs at a time, so quickening still applies.
+Fiber* spawn_fiber(VM& vm, Chunk& chunk);
+
+// Used by the VM as it switches. load_fiber() makes the fiber the running
+// one; retire_fiber() frees the running fiber and loads the next, returning
+// false once there is none.
+void save_fiber(VM& vm, Fiber& fiber);
+void load_fiber(VM& vm, Fiber& fiber);
+bool retire_fiber(VM& vm);
+// Saves the running fiber and loads the next, if there is another.
+void switch_fiber(VM& vm);
+
+// Used for reads, see aio.h. park_fiber() takes the running fiber out of
+// the ring and loads the next, waiting for a read to complete if every
+// fiber is parked. wake_fiber() puts a parked fiber back, last in line.
+void park_fiber(VM& vm);
+void wake_fiber(VM& vm, Fiber& fiber);
+
+// Frees fibers that never ran to the end.
+void free_fibers(VM& vm);
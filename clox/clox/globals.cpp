@@ -0,0 +1,41 @@
+#include "globals.h"
+#include "memory.h"
+#include "object.h"
+
+void init_global_table(GlobalTable& table)
+{
+    init_table(table.slots);
+    table.values = nullptr;
+    table.count = 0;
+    table.capacity = 0;
+}
+
+void free_global_table(GlobalTable& table)
+{
+    free_table(table.slots);
+    FREE_ARRAY(Value, table.values, table.capacity);
+    init_global_table(table);
+}
+
+int global_slot(GlobalTable& table, ObjString* name)
+{
+    Value slot;
+    if (table_get(table.slots, name, slot))
+        return static_cast<int>(as_number(slot));
+
+    if (table.capacity < table.count + 1)
+    {
+        int old_capacity = table.capacity;
+        table.capacity = GROW_CAPACITY(old_capacity);
+        table.values = GROW_ARRAY(table.values, Value, old_capacity, table.capacity);
+    }
+    table.values[table.count] = undefined_val();
+    table_set(table.slots, name, number_val(table.count));
+    return table.count++;
+}
+
+void link_globals(GlobalTable& table, const Chunk& chunk, int* slots)
+{
+    for (int i = 0; i < chunk.globals.count; i++)
+        slots[i] = global_slot(table, as_string(chunk.globals.values[i]));
+}
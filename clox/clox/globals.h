@@ -0,0 +1,32 @@
+#pragma once
+
+#include "chunk.h"
+#include "table.h"
+
+// The global variables of one VM. A chunk lists the names of the globals
+// it uses in chunk.globals, and its global instructions take an index into
+// that list. Before the chunk runs, the VM links each name to a slot of its
+// own table, giving a name it has not seen a slot holding undefined_val().
+// Running code then reaches a global through the chunk's links and the
+// table's values, without hashing its name, and a name keeps its slot from
+// one interpret() to the next. A VM numbers only the names of the chunks it
+// has run, so no other VM's scripts make its table grow.
+
+struct GlobalTable
+{
+    Table slots;   // interned name to slot
+    Value* values; // by slot, undefined_val() where never defined
+    int count;
+    int capacity;
+};
+
+// Most globals one chunk can name: the instructions take a 16-bit index.
+constexpr int GLOBALS_MAX = UINT16_MAX + 1;
+
+void init_global_table(GlobalTable& table);
+void free_global_table(GlobalTable& table);
+
+// The slot of `name`, which must be interned, numbering it if it has none.
+int global_slot(GlobalTable& table, ObjString* name);
+// Sets slots[i] to the slot of chunk.globals.values[i], for each name.
+void link_globals(GlobalTable& table, const Chunk& chunk, int* slots);
@@ -1,6 +1,16 @@
+#include <atomic>
 #include <cstring>
+#include <mutex>
 
 #include "hash.h"
+#include "cpu.h"
+
+#ifdef CLOX_X64
+#include <nmmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
 
 static constexpr uint64_t PRIME64_1 = 0x9E3779B185EBCA87ULL;
 static constexpr uint64_t PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
@@ -8,6 +18,12 @@ static constexpr uint64_t PRIME64_3 = 0x165667B19E3779F9ULL;
 static constexpr uint64_t PRIME64_4 = 0x85EBCA77C2B2AE63ULL;
 static constexpr uint64_t PRIME64_5 = 0x27D4EB2F165667C5ULL;
 
+// Keys mixed into the short-key paths, one per 8-byte lane.
+static constexpr uint64_t SECRET_1 = 0xBE4BA423396CFEB8ULL;
+static constexpr uint64_t SECRET_2 = 0x1CAD21F72C81017CULL;
+static constexpr uint64_t SECRET_3 = 0xDB979083E96DD4DEULL;
+static constexpr uint64_t SECRET_4 = 0x1F67B3B7A4A44072ULL;
+
 static inline uint64_t read64(const void* ptr)
 {
     uint64_t val;
@@ -53,6 +69,30 @@ static constexpr uint64_t hash_avalanche(uint64_t h64)
     return h64;
 }
 
+// Multiplies two 64-bit values and folds the 128-bit product into 64 bits.
+static inline uint64_t mul128_fold64(uint64_t a, uint64_t b)
+{
+#if defined(__SIZEOF_INT128__)
+    __uint128_t product = static_cast<__uint128_t>(a) * b;
+    return static_cast<uint64_t>(product) ^ static_cast<uint64_t>(product >> 64);
+#elif defined(_MSC_VER) && defined(CLOX_X64)
+    uint64_t high;
+    uint64_t low = _umul128(a, b, &high);
+    return low ^ high;
+#else
+    uint64_t a_lo = a & 0xFFFFFFFF, a_hi = a >> 32;
+    uint64_t b_lo = b & 0xFFFFFFFF, b_hi = b >> 32;
+    uint64_t lo_lo = a_lo * b_lo;
+    uint64_t hi_lo = a_hi * b_lo;
+    uint64_t lo_hi = a_lo * b_hi;
+    uint64_t hi_hi = a_hi * b_hi;
+    uint64_t cross = (lo_lo >> 32) + (hi_lo & 0xFFFFFFFF) + lo_hi;
+    uint64_t upper = (hi_lo >> 32) + (cross >> 32) + hi_hi;
+    uint64_t lower = (cross << 32) | (lo_lo & 0xFFFFFFFF);
+    return lower ^ upper;
+#endif
+}
+
 static uint64_t hash_finalize(uint64_t h64, const void* ptr, size_t length)
 {
     const uint8_t* p = reinterpret_cast<const uint8_t*>(ptr);
@@ -82,41 +122,222 @@ static uint64_t hash_finalize(uint64_t h64, const void* ptr, size_t length)
     return  hash_avalanche(h64);
 }
 
-uint64_t hash64(const void* input, size_t length, uint64_t seed)
+// Short keys read the input as (possibly overlapping) words from both ends
+// instead of walking the tail byte by byte, so every length up to 32 is
+// handled with a fixed number of loads and no loops.
+static uint64_t hash_short_portable(const uint8_t* p, size_t length, uint64_t seed)
 {
-    const uint8_t* p = reinterpret_cast<const uint8_t*>(input);
-    const uint8_t* end = p + length;
-    uint64_t h64;
+    if (length <= 16)
+    {
+        if (length >= 8)
+        {
+            uint64_t lo = read64(p) ^ (SECRET_1 + seed);
+            uint64_t hi = read64(p + length - 8) ^ (SECRET_2 - seed);
+            uint64_t acc = length + rotl64(lo, 32) + hi + mul128_fold64(lo, hi);
+            return hash_avalanche(acc);
+        }
+        if (length >= 4)
+        {
+            uint64_t lo = read32(p);
+            uint64_t hi = read32(p + length - 4);
+            uint64_t combined = (lo << 32) + hi;
+            uint64_t acc = mul128_fold64(combined ^ (SECRET_3 + seed), PRIME64_1 + length);
+            return hash_avalanche(acc);
+        }
+        if (length > 0)
+        {
+            uint32_t c1 = p[0];
+            uint32_t c2 = p[length >> 1];
+            uint32_t c3 = p[length - 1];
+            uint64_t combined = (c1 << 16) | (c2 << 24) | c3 | (static_cast<uint32_t>(length) << 8);
+            return hash_avalanche((combined ^ (SECRET_4 + seed)) * PRIME64_1);
+        }
+        return hash_avalanche(seed ^ SECRET_1 ^ PRIME64_5);
+    }
 
-    if (length > 32)
+    uint64_t acc = length * PRIME64_1;
+    acc += mul128_fold64(read64(p) ^ (SECRET_1 + seed), read64(p + 8) ^ (SECRET_2 - seed));
+    acc += mul128_fold64(read64(p + length - 16) ^ (SECRET_3 + seed), read64(p + length - 8) ^ (SECRET_4 - seed));
+    return hash_avalanche(acc);
+}
+
+#ifdef CLOX_X64
+// Same shape as the portable path, but the words are folded with the
+// hardware CRC32C instruction in two independent lanes. CRC is linear, so
+// the lanes are combined with a folded 128-bit multiply, which mixes well
+// enough that the avalanche step can be skipped.
+CLOX_TARGET("sse4.2")
+static uint64_t hash_short_crc32c(const uint8_t* p, size_t length, uint64_t seed)
+{
+    uint64_t a, b;
+    uint64_t c = 0, d = 0;
+    if (length >= 8)
+    {
+        if (length > 16)
+        {
+            c = read64(p + length - 16);
+            d = read64(p + 8);
+        }
+        a = read64(p);
+        b = read64(p + length - 8);
+    }
+    else if (length >= 4)
     {
-        const uint8_t* const limit = end - 32;
-        uint64_t v1 = seed + PRIME64_1 + PRIME64_2;
-        uint64_t v2 = seed + PRIME64_2;
-        uint64_t v3 = seed + 0;
-        uint64_t v4 = seed - PRIME64_1;
-
-        do {
-            v1 = hash_round(v1, read64(p)); p += 8;
-            v2 = hash_round(v2, read64(p)); p += 8;
-            v3 = hash_round(v3, read64(p)); p += 8;
-            v4 = hash_round(v4, read64(p)); p += 8;
-        } while (p <= limit);
-
-        h64 = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
-        h64 = hash_merge_round(h64, v1);
-        h64 = hash_merge_round(h64, v2);
-        h64 = hash_merge_round(h64, v3);
-        h64 = hash_merge_round(h64, v4);
+        a = read32(p);
+        b = read32(p + length - 4);
+    }
+    else if (length > 0)
+    {
+        a = static_cast<uint64_t>(p[0]) | (static_cast<uint64_t>(p[length >> 1]) << 8) | (static_cast<uint64_t>(p[length - 1]) << 16);
+        b = 0;
     }
     else
-        h64 = seed + PRIME64_5;
+        a = b = 0;
+
+    uint64_t lane1 = _mm_crc32_u64(_mm_crc32_u64(static_cast<uint32_t>(seed ^ SECRET_1), a), c);
+    uint64_t lane2 = _mm_crc32_u64(_mm_crc32_u64(static_cast<uint32_t>((seed >> 32) ^ SECRET_2), b), d);
+    return mul128_fold64((lane1 << 32 | lane2) ^ SECRET_3, PRIME64_1 + length);
+}
+#endif
+
+typedef uint64_t (*ShortHashFn)(const uint8_t* p, size_t length, uint64_t seed);
+
+static ShortHashFn short_hash_fn(HashImplementation implementation)
+{
+#ifdef CLOX_X64
+    if (implementation == HASH_CRC32C)
+        return hash_short_crc32c;
+#endif
+    return hash_short_portable;
+}
+
+static HashImplementation detect_hash_implementation()
+{
+#ifdef CLOX_X64
+    if (cpu_has_sse42())
+        return HASH_CRC32C;
+#endif
+    return HASH_PORTABLE;
+}
+
+static uint64_t hash_short_first(const uint8_t* p, size_t length, uint64_t seed);
+
+// Constant-initialized, so hashing from other files' static initializers
+// sees them set. The first short hash detects the CPU and replaces
+// hash_short_first.
+static std::atomic<HashImplementation> current_implementation{ HASH_PORTABLE };
+static std::atomic<ShortHashFn> short_hash{ hash_short_first };
+static std::once_flag detected;
+static std::atomic<bool> frozen{ false };
+
+static void set_implementation(HashImplementation implementation)
+{
+    current_implementation.store(implementation, std::memory_order_relaxed);
+    short_hash.store(short_hash_fn(implementation), std::memory_order_relaxed);
+}
+
+static void detect_once()
+{
+    std::call_once(detected, [] { set_implementation(detect_hash_implementation()); });
+}
+
+static uint64_t hash_short_first(const uint8_t* p, size_t length, uint64_t seed)
+{
+    detect_once();
+    return short_hash.load(std::memory_order_relaxed)(p, length, seed);
+}
+
+HashImplementation hash_implementation()
+{
+    detect_once();
+    return current_implementation.load(std::memory_order_relaxed);
+}
+
+const char* hash_implementation_name(HashImplementation implementation)
+{
+    switch (implementation)
+    {
+    case HASH_PORTABLE: return "portable";
+    case HASH_CRC32C: return "crc32c";
+    }
+    return "unknown";
+}
+
+bool hash_implementation_supported(HashImplementation implementation)
+{
+    switch (implementation)
+    {
+    case HASH_PORTABLE:
+        return true;
+    case HASH_CRC32C:
+        return cpu_has_sse42();
+    }
+    return false;
+}
+
+bool select_hash_implementation(HashImplementation implementation)
+{
+    if (!hash_implementation_supported(implementation))
+        return false;
+
+    // Kept hashes would go stale: the intern table and VM tables would
+    // probe for a string under a different hash than it was stored with.
+    if (implementation != hash_implementation() && frozen.load(std::memory_order_relaxed))
+        return false;
+
+    set_implementation(implementation);
+    return true;
+}
+
+void freeze_hash_implementation()
+{
+    if (!frozen.load(std::memory_order_relaxed))
+        frozen.store(true, std::memory_order_relaxed);
+}
+
+static uint64_t hash_long(const uint8_t* p, size_t length, uint64_t seed)
+{
+    const uint8_t* end = p + length;
+    const uint8_t* const limit = end - 32;
+    uint64_t v1 = seed + PRIME64_1 + PRIME64_2;
+    uint64_t v2 = seed + PRIME64_2;
+    uint64_t v3 = seed + 0;
+    uint64_t v4 = seed - PRIME64_1;
+
+    do {
+        v1 = hash_round(v1, read64(p)); p += 8;
+        v2 = hash_round(v2, read64(p)); p += 8;
+        v3 = hash_round(v3, read64(p)); p += 8;
+        v4 = hash_round(v4, read64(p)); p += 8;
+    } while (p <= limit);
+
+    uint64_t h64 = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+    h64 = hash_merge_round(h64, v1);
+    h64 = hash_merge_round(h64, v2);
+    h64 = hash_merge_round(h64, v3);
+    h64 = hash_merge_round(h64, v4);
 
     h64 += static_cast<uint64_t>(length);
     return hash_finalize(h64, p, length);
 }
 
+uint64_t hash64(const void* input, size_t length, uint64_t seed)
+{
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(input);
+    if (length <= 32)
+        return short_hash.load(std::memory_order_relaxed)(p, length, seed);
+    return hash_long(p, length, seed);
+}
+
+uint64_t hash64_using(HashImplementation implementation, const void* input, size_t length, uint64_t seed)
+{
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(input);
+    if (length <= 32)
+        return short_hash_fn(implementation)(p, length, seed);
+    return hash_long(p, length, seed);
+}
+
 uint32_t hash32(const void* input, size_t length, uint64_t seed)
 {
     return hash_truncate(hash64(input, length, seed));
-}
\ No newline at end of file
+}
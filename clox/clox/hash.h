@@ -11,3 +11,30 @@ constexpr uint32_t hash_truncate(uint64_t hash)
 
 uint32_t hash32(const void* input, size_t length, uint64_t seed = 0);
 uint64_t hash64(const void* input, size_t length, uint64_t seed = 0);
+
+// Keys of up to 32 bytes take a dedicated short-key path. On CPUs that support
+// it, that path uses the CRC32C instruction; the choice is made on first use,
+// so hash values are stable for the lifetime of the process but may differ
+// between machines. They must never be persisted.
+enum HashImplementation
+{
+    HASH_PORTABLE,
+    HASH_CRC32C,
+};
+
+HashImplementation hash_implementation();
+const char* hash_implementation_name(HashImplementation implementation);
+bool hash_implementation_supported(HashImplementation implementation);
+
+// Switches the short-key implementation. Any hash computed before the switch
+// becomes stale, so this must be called before strings are created; it
+// fails, as for an unsupported implementation, once the implementation is
+// frozen.
+bool select_hash_implementation(HashImplementation implementation);
+// Called by whoever keeps a hash, such as hash_string() for every string
+// hash the VM stores, so the implementation can no longer change.
+void freeze_hash_implementation();
+
+// Hashes with the given supported short-key implementation, whichever is
+// selected, so benchmarks can compare them.
+uint64_t hash64_using(HashImplementation implementation, const void* input, size_t length, uint64_t seed = 0);
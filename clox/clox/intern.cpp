@@ -0,0 +1,120 @@
+#include <atomic>
+#include <cstring>
+#include <mutex>
+#include <new>
+
+#include "intern.h"
+
+struct InternSlots
+{
+    int capacity; // a power of two, at least twice the shard's count
+    std::atomic<ObjString*>* entries;
+    InternSlots* retired; // the array this one replaced
+};
+
+struct InternShard
+{
+    std::atomic<InternSlots*> slots;
+    std::mutex mutex; // held while inserting
+    int count;        // guarded by mutex
+};
+
+static InternShard shards[INTERN_SHARDS];
+
+static ObjString* find_interned(const InternSlots* slots, const char* chars, int length, uint32_t hash)
+{
+    if (slots == nullptr)
+        return nullptr;
+
+    uint32_t mask = static_cast<uint32_t>(slots->capacity - 1);
+    for (uint32_t index = hash & mask;; index = (index + 1) & mask)
+    {
+        ObjString* string = slots->entries[index].load(std::memory_order_acquire);
+        if (string == nullptr)
+            return nullptr;
+        if (string->hash == hash && string->length == length && memcmp(string->chars, chars, length) == 0)
+            return string;
+    }
+}
+
+static void insert_slot(InternSlots* slots, ObjString* string)
+{
+    uint32_t mask = static_cast<uint32_t>(slots->capacity - 1);
+    uint32_t index = string->hash & mask;
+    while (slots->entries[index].load(std::memory_order_relaxed) != nullptr)
+        index = (index + 1) & mask;
+    slots->entries[index].store(string, std::memory_order_release);
+}
+
+// Publishes a copy twice the size. Readers may still be probing the old
+// array, so it is kept rather than freed.
+static InternSlots* grow_shard(InternShard& shard, InternSlots* old_slots)
+{
+    InternSlots* slots = ALLOCATE(InternSlots, 1);
+    slots->capacity = old_slots ? old_slots->capacity * 2 : 16;
+    slots->entries = ALLOCATE(std::atomic<ObjString*>, slots->capacity);
+    for (int i = 0; i < slots->capacity; i++)
+        new (&slots->entries[i]) std::atomic<ObjString*>(nullptr);
+    slots->retired = old_slots;
+
+    for (int i = 0; old_slots && i < old_slots->capacity; i++)
+    {
+        ObjString* string = old_slots->entries[i].load(std::memory_order_relaxed);
+        if (string != nullptr)
+            insert_slot(slots, string);
+    }
+
+    shard.slots.store(slots, std::memory_order_release);
+    return slots;
+}
+
+// Built in full, hash included, before any other thread can see it.
+static ObjString* new_interned(const char* chars, int length, uint32_t hash)
+{
+    char* heap_chars = ALLOCATE(char, length + 1);
+    memcpy(heap_chars, chars, length);
+    heap_chars[length] = '\0';
+
+    ObjString* string = ALLOCATE(ObjString, 1);
+    string->obj.type = OBJ_STRING;
+    string->obj.next = nullptr;
+    string->length = length;
+    string->chars = heap_chars;
+    string->hash = hash;
+    string->interned = true;
+    return string;
+}
+
+ObjString* intern_string(const char* chars, int length)
+{
+    uint32_t hash = hash_string(chars, length);
+    InternShard& shard = shards[hash >> (32 - INTERN_SHARD_BITS)];
+
+    ObjString* string = find_interned(shard.slots.load(std::memory_order_acquire), chars, length, hash);
+    if (string != nullptr)
+        return string;
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    InternSlots* slots = shard.slots.load(std::memory_order_relaxed);
+    string = find_interned(slots, chars, length, hash);
+    if (string != nullptr)
+        return string;
+
+    if (slots == nullptr || (shard.count + 1) * 2 > slots->capacity)
+        slots = grow_shard(shard, slots);
+    string = new_interned(chars, length, hash);
+    insert_slot(slots, string);
+    shard.count++;
+    return string;
+}
+
+int interned_count()
+{
+    int count = 0;
+    for (InternShard& shard : shards)
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        count += shard.count;
+    }
+    return count;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include "object.h"
+
+// Process-wide table of immutable strings, shared by every VM on every
+// thread. An interned string is never freed and belongs to no ObjList, so
+// a VM holds no copy of the literals it runs, and two interned strings are
+// equal exactly when they are the same object.
+//
+// The table is split into INTERN_SHARDS shards by the top bits of the
+// hash. Lookups take no lock: each shard publishes its slot array and its
+// strings with release stores. Insertions lock only their shard, and a
+// grown shard keeps its old arrays for lookups still probing them.
+
+constexpr int INTERN_SHARD_BITS = 6;
+constexpr int INTERN_SHARDS = 1 << INTERN_SHARD_BITS;
+
+ObjString* intern_string(const char* chars, int length);
+
+// Strings in the table, for tests and benchmarks.
+int interned_count();
@@ -0,0 +1,706 @@
+#include <cstddef>
+#include <cstring>
+#include <initializer_list>
+
+#include "jit.h"
+#include "memory.h"
+#include "vm.h"
+
+#ifdef CLOX_JIT
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#ifdef CLOX_JIT
+
+// Register use inside compiled code:
+//   rbx  VM*
+//   r12  stack top; the operands of an instruction sit below it
+//   r13  saved only to keep the stack 16-byte aligned for helper calls
+
+static_assert(sizeof(Value) == 16, "templates assume 16-byte values");
+static_assert(offsetof(Value, number) == 8, "templates assume the payload at offset 8");
+
+static constexpr int8_t TYPE_OFFSET = static_cast<int8_t>(offsetof(Value, type));
+static constexpr int8_t PAYLOAD_OFFSET = static_cast<int8_t>(offsetof(Value, number));
+static constexpr int8_t TOP = -static_cast<int8_t>(sizeof(Value));     // peek(0)
+static constexpr int8_t SECOND = -2 * static_cast<int8_t>(sizeof(Value)); // peek(1)
+
+struct Assembler
+{
+    uint8_t* code;
+    int count;
+    int capacity;
+};
+
+// A rel32 jump to an exit stub, patched once the stubs are laid out.
+struct ExitJump
+{
+    int position;
+    int offset;
+};
+
+struct ExitList
+{
+    ExitJump* jumps;
+    int count;
+    int capacity;
+};
+
+static void emit(Assembler& as, uint8_t byte)
+{
+    if (as.capacity < as.count + 1)
+    {
+        int old_capacity = as.capacity;
+        as.capacity = GROW_CAPACITY(old_capacity);
+        as.code = GROW_ARRAY(as.code, uint8_t, old_capacity, as.capacity);
+    }
+    as.code[as.count++] = byte;
+}
+
+static void emit(Assembler& as, std::initializer_list<uint8_t> bytes)
+{
+    for (uint8_t byte : bytes)
+        emit(as, byte);
+}
+
+static void emit32(Assembler& as, uint32_t value)
+{
+    for (int i = 0; i < 4; i++)
+        emit(as, static_cast<uint8_t>(value >> (8 * i)));
+}
+
+static void emit64(Assembler& as, uint64_t value)
+{
+    for (int i = 0; i < 8; i++)
+        emit(as, static_cast<uint8_t>(value >> (8 * i)));
+}
+
+static void patch32(Assembler& as, int position, int32_t value)
+{
+    memcpy(as.code + position, &value, sizeof(value));
+}
+
+static void add_exit(ExitList& exits, int position, int offset)
+{
+    if (exits.capacity < exits.count + 1)
+    {
+        int old_capacity = exits.capacity;
+        exits.capacity = GROW_CAPACITY(old_capacity);
+        exits.jumps = GROW_ARRAY(exits.jumps, ExitJump, old_capacity, exits.capacity);
+    }
+    exits.jumps[exits.count++] = { position, offset };
+}
+
+// jne to the exit stub of the instruction at `offset`.
+static void emit_exit_if_not_equal(Assembler& as, ExitList& exits, int offset)
+{
+    emit(as, { 0x0F, 0x85 });
+    add_exit(exits, as.count, offset);
+    emit32(as, 0);
+}
+
+// je to the exit stub of the instruction at `offset`.
+static void emit_exit_if_equal(Assembler& as, ExitList& exits, int offset)
+{
+    emit(as, { 0x0F, 0x84 });
+    add_exit(exits, as.count, offset);
+    emit32(as, 0);
+}
+
+// jmp to the exit stub of the instruction at `offset`.
+static void emit_exit(Assembler& as, ExitList& exits, int offset)
+{
+    emit(as, 0xE9);
+    add_exit(exits, as.count, offset);
+    emit32(as, 0);
+}
+
+// Short forward jumps within one template.
+static int emit_jump8(Assembler& as, uint8_t opcode)
+{
+    emit(as, { opcode, 0x00 });
+    return as.count;
+}
+
+static void patch_jump8(Assembler& as, int position)
+{
+    as.code[position - 1] = static_cast<uint8_t>(as.count - position);
+}
+
+// r12-relative memory operands with an 8-bit displacement: ModRM mod=01,
+// rm=100 (SIB follows), SIB base=r12 with no index.
+static void emit_r12(Assembler& as, uint8_t reg, int8_t displacement)
+{
+    emit(as, { static_cast<uint8_t>(0x44 | (reg << 3)), 0x24, static_cast<uint8_t>(displacement) });
+}
+
+// cmp dword [r12 + slot + type], type; jne exit
+static void emit_type_guard(Assembler& as, ExitList& exits, int8_t slot, ValueType type, int offset)
+{
+    emit(as, { 0x41, 0x83 });
+    emit_r12(as, 7, slot + TYPE_OFFSET);
+    emit(as, static_cast<uint8_t>(type));
+    emit_exit_if_not_equal(as, exits, offset);
+}
+
+static void emit_push_slot(Assembler& as)
+{
+    emit(as, { 0x49, 0x83, 0xC4, static_cast<uint8_t>(sizeof(Value)) }); // add r12, 16
+}
+
+static void emit_pop_slot(Assembler& as)
+{
+    emit(as, { 0x49, 0x83, 0xEC, static_cast<uint8_t>(sizeof(Value)) }); // sub r12, 16
+}
+
+// mov dword [r12 + slot + type], type
+static void emit_store_type(Assembler& as, int8_t slot, ValueType type)
+{
+    emit(as, 0x41);
+    emit(as, 0xC7);
+    emit_r12(as, 0, slot + TYPE_OFFSET);
+    emit32(as, static_cast<uint32_t>(type));
+}
+
+// mov qword [r12 + slot + payload], imm32
+static void emit_store_payload(Assembler& as, int8_t slot, int32_t value)
+{
+    emit(as, { 0x49, 0xC7 });
+    emit_r12(as, 0, slot + PAYLOAD_OFFSET);
+    emit32(as, static_cast<uint32_t>(value));
+}
+
+// Stores al, zero-extended, as a bool into the slot below the operands and
+// drops the top one.
+static void emit_store_bool_al(Assembler& as)
+{
+    emit(as, { 0x0F, 0xB6, 0xC0 });           // movzx eax, al
+    emit(as, { 0x49, 0x89 });                 // mov [r12 + SECOND + payload], rax
+    emit_r12(as, 0, SECOND + PAYLOAD_OFFSET);
+    emit_store_type(as, SECOND, VAL_BOOL);
+    emit_pop_slot(as);
+}
+
+static void emit_load_xmm0(Assembler& as, int8_t slot)
+{
+    emit(as, { 0xF2, 0x41, 0x0F, 0x10 }); // movsd xmm0, [r12 + slot + payload]
+    emit_r12(as, 0, slot + PAYLOAD_OFFSET);
+}
+
+static void emit_arithmetic(Assembler& as, uint8_t sse_opcode)
+{
+    emit_load_xmm0(as, SECOND);
+    emit(as, { 0xF2, 0x41, 0x0F, sse_opcode }); // op xmm0, [r12 + TOP + payload]
+    emit_r12(as, 0, TOP + PAYLOAD_OFFSET);
+    emit(as, { 0xF2, 0x41, 0x0F, 0x11 });       // movsd [r12 + SECOND + payload], xmm0
+    emit_r12(as, 0, SECOND + PAYLOAD_OFFSET);
+    emit_pop_slot(as);
+}
+
+// ucomisd xmm0, [r12 + slot + payload]
+static void emit_compare_xmm0(Assembler& as, int8_t slot)
+{
+    emit(as, { 0x66, 0x41, 0x0F, 0x2E });
+    emit_r12(as, 0, slot + PAYLOAD_OFFSET);
+}
+
+static void emit_greater(Assembler& as)
+{
+    emit_load_xmm0(as, SECOND);
+    emit_compare_xmm0(as, TOP);
+    emit(as, { 0x0F, 0x97, 0xC0 }); // seta al; false when unordered
+    emit_store_bool_al(as);
+}
+
+static void emit_less(Assembler& as)
+{
+    emit_load_xmm0(as, TOP);
+    emit_compare_xmm0(as, SECOND);
+    emit(as, { 0x0F, 0x97, 0xC0 }); // seta al, with the operands swapped
+    emit_store_bool_al(as);
+}
+
+static void emit_equal_f64(Assembler& as)
+{
+    emit_load_xmm0(as, SECOND);
+    emit_compare_xmm0(as, TOP);
+    emit(as, { 0x0F, 0x94, 0xC0 }); // sete al
+    emit(as, { 0x0F, 0x9B, 0xC1 }); // setnp cl; NaN compares unequal
+    emit(as, { 0x20, 0xC8 });       // and al, cl
+    emit_store_bool_al(as);
+}
+
+static void jit_equal(Value* top)
+{
+    top[-2] = bool_val(values_equal(top[-2], top[-1]));
+}
+
+static void emit_call_equal(Assembler& as)
+{
+    emit(as, { 0x4C, 0x89, 0xE7 }); // mov rdi, r12
+    emit(as, { 0x48, 0xB8 });       // mov rax, jit_equal
+    emit64(as, reinterpret_cast<uint64_t>(&jit_equal));
+    emit(as, { 0xFF, 0xD0 });       // call rax
+    emit_pop_slot(as);
+}
+
+static void emit_not(Assembler& as)
+{
+    emit(as, { 0x41, 0x8B });                       // mov eax, [r12 + TOP + type]
+    emit_r12(as, 0, TOP + TYPE_OFFSET);
+    emit(as, { 0xB9, 0x01, 0x00, 0x00, 0x00 });     // mov ecx, 1
+    emit(as, { 0x83, 0xF8, VAL_NIL });              // cmp eax, VAL_NIL
+    int nil = emit_jump8(as, 0x74);                 // je store
+    emit(as, { 0x83, 0xF8, VAL_BOOL });             // cmp eax, VAL_BOOL
+    int truthy = emit_jump8(as, 0x75);              // jne falsey
+    emit(as, { 0x41, 0x80 });                       // cmp byte [r12 + TOP + payload], 0
+    emit_r12(as, 7, TOP + PAYLOAD_OFFSET);
+    emit(as, 0x00);
+    int is_false = emit_jump8(as, 0x74);            // je store
+    patch_jump8(as, truthy);
+    emit(as, { 0x31, 0xC9 });                       // xor ecx, ecx
+    patch_jump8(as, nil);
+    patch_jump8(as, is_false);
+    emit(as, { 0x49, 0x89 });                       // mov [r12 + TOP + payload], rcx
+    emit_r12(as, 1, TOP + PAYLOAD_OFFSET);
+    emit_store_type(as, TOP, VAL_BOOL);
+}
+
+static void emit_negate(Assembler& as)
+{
+    emit(as, { 0x49, 0x0F, 0xBA });                 // btc qword [r12 + TOP + payload], 63
+    emit_r12(as, 7, TOP + PAYLOAD_OFFSET);
+    emit(as, 63);
+}
+
+static void emit_constant(Assembler& as, const Value* constant)
+{
+    emit(as, { 0x48, 0xB8 });                       // mov rax, constant
+    emit64(as, reinterpret_cast<uint64_t>(constant));
+    emit(as, { 0x0F, 0x10, 0x00 });                 // movups xmm0, [rax]
+    emit(as, { 0x41, 0x0F, 0x11 });                 // movups [r12], xmm0
+    emit_r12(as, 0, 0);
+    emit_push_slot(as);
+}
+
+// Locals live at fixed slots from the bottom of the VM stack, which rbx
+// reaches with a 32-bit displacement.
+static uint32_t local_displacement(uint8_t slot)
+{
+    return static_cast<uint32_t>(offsetof(VM, stack) + slot * sizeof(Value));
+}
+
+static void emit_get_local(Assembler& as, uint8_t slot)
+{
+    emit(as, { 0x0F, 0x10, 0x83 });                 // movups xmm0, [rbx + local]
+    emit32(as, local_displacement(slot));
+    emit(as, { 0x41, 0x0F, 0x11 });                 // movups [r12], xmm0
+    emit_r12(as, 0, 0);
+    emit_push_slot(as);
+}
+
+static void emit_set_local(Assembler& as, uint8_t slot)
+{
+    emit(as, { 0x41, 0x0F, 0x10 });                 // movups xmm0, [r12 + TOP]
+    emit_r12(as, 0, TOP);
+    emit(as, { 0x0F, 0x11, 0x83 });                 // movups [rbx + local], xmm0
+    emit32(as, local_displacement(slot));
+}
+
+// Leaves the address of the global's value in rax, going through the
+// chunk's links as run() does.
+static void emit_global_address(Assembler& as, uint16_t index)
+{
+    emit(as, { 0x48, 0x8B, 0x83 });                 // mov rax, [rbx + global_slots]
+    emit32(as, static_cast<uint32_t>(offsetof(VM, global_slots)));
+    emit(as, { 0x8B, 0x80 });                       // mov eax, [rax + index * 4]
+    emit32(as, static_cast<uint32_t>(index * sizeof(int)));
+    emit(as, { 0x48, 0xC1, 0xE0, 0x04 });           // shl rax, 4
+    emit(as, { 0x48, 0x03, 0x83 });                 // add rax, [rbx + globals.values]
+    emit32(as, static_cast<uint32_t>(offsetof(VM, globals) + offsetof(GlobalTable, values)));
+}
+
+// Exits if the value rax points to is undefined_val(), so the interpreter
+// reports the error.
+static void emit_defined_guard(Assembler& as, ExitList& exits, int offset)
+{
+    emit(as, { 0x83, 0x78, static_cast<uint8_t>(TYPE_OFFSET), VAL_OBJ }); // cmp dword [rax + type], VAL_OBJ
+    int defined = emit_jump8(as, 0x75);                                  // jne defined
+    emit(as, { 0x48, 0x83, 0x78, static_cast<uint8_t>(PAYLOAD_OFFSET), 0x00 }); // cmp qword [rax + payload], 0
+    emit_exit_if_equal(as, exits, offset);
+    patch_jump8(as, defined);
+}
+
+static void emit_get_global(Assembler& as, ExitList& exits, uint16_t index, int offset)
+{
+    emit_global_address(as, index);
+    emit_defined_guard(as, exits, offset);
+    emit(as, { 0x0F, 0x10, 0x00 });                 // movups xmm0, [rax]
+    emit(as, { 0x41, 0x0F, 0x11 });                 // movups [r12], xmm0
+    emit_r12(as, 0, 0);
+    emit_push_slot(as);
+}
+
+// Assignment also stores without popping; a definition pops afterwards.
+static void emit_store_global(Assembler& as)
+{
+    emit(as, { 0x41, 0x0F, 0x10 });                 // movups xmm0, [r12 + TOP]
+    emit_r12(as, 0, TOP);
+    emit(as, { 0x0F, 0x11, 0x00 });                 // movups [rax], xmm0
+}
+
+static void jit_print(VM* vm, const Value* top)
+{
+    write_value(vm->output, top[-1]);
+    write_output(vm->output, '\n');
+}
+
+static void emit_print(Assembler& as)
+{
+    emit(as, { 0x48, 0x89, 0xDF });                 // mov rdi, rbx
+    emit(as, { 0x4C, 0x89, 0xE6 });                 // mov rsi, r12
+    emit(as, { 0x48, 0xB8 });                       // mov rax, jit_print
+    emit64(as, reinterpret_cast<uint64_t>(&jit_print));
+    emit(as, { 0xFF, 0xD0 });                       // call rax
+    emit_pop_slot(as);
+}
+
+// A rel32 jump to the code of the instruction at `offset`, patched once all
+// of it is laid out.
+static void emit_branch(Assembler& as, ExitList& branches, std::initializer_list<uint8_t> opcode, int offset)
+{
+    emit(as, opcode);
+    add_exit(branches, as.count, offset);
+    emit32(as, 0);
+}
+
+// Jumps if the top value is falsey, leaving it on the stack.
+static void emit_jump_if_false(Assembler& as, ExitList& branches, int target)
+{
+    emit(as, { 0x41, 0x8B });                       // mov eax, [r12 + TOP + type]
+    emit_r12(as, 0, TOP + TYPE_OFFSET);
+    emit(as, { 0x83, 0xF8, VAL_NIL });              // cmp eax, VAL_NIL
+    emit_branch(as, branches, { 0x0F, 0x84 }, target); // je target
+    emit(as, { 0x83, 0xF8, VAL_BOOL });             // cmp eax, VAL_BOOL
+    int truthy = emit_jump8(as, 0x75);              // jne truthy
+    emit(as, { 0x41, 0x80 });                       // cmp byte [r12 + TOP + payload], 0
+    emit_r12(as, 7, TOP + PAYLOAD_OFFSET);
+    emit(as, 0x00);
+    emit_branch(as, branches, { 0x0F, 0x84 }, target); // je target
+    patch_jump8(as, truthy);
+}
+
+// A safepoint, as in run(): the budget is charged here unless this charge
+// would use it up. Then the interpreter takes over at the OP_LOOP, charges
+// it and ends the slice, and the run goes on there.
+static void emit_loop(Assembler& as, ExitList& exits, ExitList& branches, int offset, int target)
+{
+    uint32_t budget = static_cast<uint32_t>(offsetof(VM, budget));
+    emit(as, { 0x83, 0xBB });                       // cmp dword [rbx + budget], 1
+    emit32(as, budget);
+    emit(as, 0x01);
+    emit_exit_if_equal(as, exits, offset);
+    emit(as, { 0xFF, 0x8B });                       // dec dword [rbx + budget]
+    emit32(as, budget);
+    emit_branch(as, branches, { 0xE9 }, target);    // jmp target
+}
+
+static void emit_literal(Assembler& as, ValueType type, int32_t payload)
+{
+    emit_store_type(as, 0, type);
+    emit_store_payload(as, 0, payload);
+    emit_push_slot(as);
+}
+
+static void emit_number_guards(Assembler& as, ExitList& exits, int offset)
+{
+    emit_type_guard(as, exits, TOP, VAL_NUMBER, offset);
+    emit_type_guard(as, exits, SECOND, VAL_NUMBER, offset);
+}
+
+// Branches between instructions are laid out as in the bytecode, so
+// `natives` maps each instruction's offset to the start of its code.
+static bool translate(const Chunk& chunk, Assembler& as, ExitList& exits, ExitList& branches, int* natives)
+{
+    uint32_t stack_top = static_cast<uint32_t>(offsetof(VM, stack_top));
+
+    emit(as, 0x53);                                 // push rbx
+    emit(as, { 0x41, 0x54 });                       // push r12
+    emit(as, { 0x41, 0x55 });                       // push r13
+    emit(as, { 0x48, 0x89, 0xFB });                 // mov rbx, rdi
+    emit(as, { 0x4C, 0x8B, 0xA3 });                 // mov r12, [rbx + stack_top]
+    emit32(as, stack_top);
+
+    uint8_t instruction = OP_CONSTANT;
+    for (int offset = 0; offset < chunk.count;)
+    {
+        instruction = chunk.code[offset];
+        natives[offset] = as.count;
+        uint16_t operand = 0;
+        if (instruction_length(instruction) == 3)
+            operand = static_cast<uint16_t>(chunk.code[offset + 1] << 8 | chunk.code[offset + 2]);
+        switch (instruction)
+        {
+        case OP_CONSTANT:
+            emit_constant(as, &chunk.constants.values[chunk.code[offset + 1]]);
+            offset += 2;
+            continue;
+        case OP_GET_LOCAL:
+            emit_get_local(as, chunk.code[offset + 1]);
+            offset += 2;
+            continue;
+        case OP_SET_LOCAL:
+            emit_set_local(as, chunk.code[offset + 1]);
+            offset += 2;
+            continue;
+        case OP_GET_GLOBAL:
+            emit_get_global(as, exits, operand, offset);
+            offset += 3;
+            continue;
+        case OP_SET_GLOBAL:
+            emit_global_address(as, operand);
+            emit_defined_guard(as, exits, offset);
+            emit_store_global(as);
+            offset += 3;
+            continue;
+        case OP_DEFINE_GLOBAL:
+            emit_global_address(as, operand);
+            emit_store_global(as);
+            emit_pop_slot(as);
+            offset += 3;
+            continue;
+        case OP_JUMP:
+            emit_branch(as, branches, { 0xE9 }, offset + 3 + operand);
+            offset += 3;
+            continue;
+        case OP_JUMP_IF_FALSE:
+            emit_jump_if_false(as, branches, offset + 3 + operand);
+            offset += 3;
+            continue;
+        case OP_LOOP:
+            emit_loop(as, exits, branches, offset, offset + 3 - operand);
+            offset += 3;
+            continue;
+        case OP_POP:
+            emit_pop_slot(as);
+            break;
+        case OP_PRINT:
+            emit_print(as);
+            break;
+        case OP_NIL:
+            emit_literal(as, VAL_NIL, 0);
+            break;
+        case OP_TRUE:
+            emit_literal(as, VAL_BOOL, 1);
+            break;
+        case OP_FALSE:
+            emit_literal(as, VAL_BOOL, 0);
+            break;
+        case OP_EQUAL:
+            emit_call_equal(as);
+            break;
+        case OP_EQUAL_F64:
+            emit_equal_f64(as);
+            break;
+        case OP_GREATER:
+        case OP_GREATER_NUM:
+            emit_number_guards(as, exits, offset);
+            emit_greater(as);
+            break;
+        case OP_GREATER_F64:
+            emit_greater(as);
+            break;
+        case OP_LESS:
+        case OP_LESS_NUM:
+            emit_number_guards(as, exits, offset);
+            emit_less(as);
+            break;
+        case OP_LESS_F64:
+            emit_less(as);
+            break;
+        // A generic add of two strings fails the guard and concatenates in
+        // the interpreter.
+        case OP_ADD:
+        case OP_ADD_NUM_NUM:
+            emit_number_guards(as, exits, offset);
+            emit_arithmetic(as, 0x58);
+            break;
+        case OP_ADD_F64:
+            emit_arithmetic(as, 0x58);
+            break;
+        case OP_SUBTRACT:
+        case OP_SUBTRACT_NUM:
+            emit_number_guards(as, exits, offset);
+            emit_arithmetic(as, 0x5C);
+            break;
+        case OP_SUBTRACT_F64:
+            emit_arithmetic(as, 0x5C);
+            break;
+        case OP_MULTIPLY:
+        case OP_MULTIPLY_NUM:
+            emit_number_guards(as, exits, offset);
+            emit_arithmetic(as, 0x59);
+            break;
+        case OP_MULTIPLY_F64:
+            emit_arithmetic(as, 0x59);
+            break;
+        case OP_DIVIDE:
+        case OP_DIVIDE_NUM:
+            emit_number_guards(as, exits, offset);
+            emit_arithmetic(as, 0x5E);
+            break;
+        case OP_DIVIDE_F64:
+            emit_arithmetic(as, 0x5E);
+            break;
+        case OP_NOT:
+            emit_not(as);
+            break;
+        case OP_NEGATE:
+        case OP_NEGATE_NUM:
+            emit_type_guard(as, exits, TOP, VAL_NUMBER, offset);
+            emit_negate(as);
+            break;
+        case OP_NEGATE_F64:
+            emit_negate(as);
+            break;
+        case OP_ADD_STR_STR:
+        case OP_RETURN:
+        case OP_HALT:
+            emit_exit(as, exits, offset);
+            break;
+        default:
+            return false;
+        }
+        offset++;
+    }
+
+    // The code must not fall through into the epilogue without an offset.
+    if (instruction != OP_RETURN && instruction != OP_HALT)
+        return false;
+
+    for (int i = 0; i < branches.count; i++)
+    {
+        const ExitJump& branch = branches.jumps[i];
+        patch32(as, branch.position, natives[branch.offset] - (branch.position + 4));
+    }
+
+    int epilogue = as.count;
+    emit(as, { 0x4C, 0x89, 0xA3 });                 // mov [rbx + stack_top], r12
+    emit32(as, stack_top);
+    emit(as, { 0x41, 0x5D });                       // pop r13
+    emit(as, { 0x41, 0x5C });                       // pop r12
+    emit(as, 0x5B);                                 // pop rbx
+    emit(as, 0xC3);                                 // ret
+
+    // One stub per exit: mov eax, offset; jmp epilogue. Exits from the same
+    // instruction are adjacent in the list and share a stub.
+    int stub = -1;
+    for (int i = 0; i < exits.count; i++)
+    {
+        const ExitJump& jump = exits.jumps[i];
+        if (i == 0 || exits.jumps[i - 1].offset != jump.offset)
+        {
+            stub = as.count;
+            emit(as, 0xB8);
+            emit32(as, static_cast<uint32_t>(jump.offset));
+            emit(as, 0xE9);
+            emit32(as, static_cast<uint32_t>(epilogue - (as.count + 4)));
+        }
+        patch32(as, jump.position, stub - (jump.position + 4));
+    }
+    return true;
+}
+
+bool jit_supported()
+{
+    return true;
+}
+
+bool jit_compile(const Chunk& chunk, JitCode& code)
+{
+    code = {};
+
+    Assembler as = {};
+    ExitList exits = {};
+    ExitList branches = {};
+    int* natives = ALLOCATE(int, chunk.count);
+    bool translated = translate(chunk, as, exits, branches, natives);
+    FREE_ARRAY(int, natives, chunk.count);
+    FREE_ARRAY(ExitJump, branches.jumps, branches.capacity);
+    FREE_ARRAY(ExitJump, exits.jumps, exits.capacity);
+    if (!translated)
+    {
+        FREE_ARRAY(uint8_t, as.code, as.capacity);
+        return false;
+    }
+
+    // Written while mapped read+write, then flipped to read+execute: the
+    // mapping is never writable and executable at the same time.
+    size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t size = (static_cast<size_t>(as.count) + page - 1) / page * page;
+    void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED)
+    {
+        FREE_ARRAY(uint8_t, as.code, as.capacity);
+        return false;
+    }
+
+    memcpy(memory, as.code, static_cast<size_t>(as.count));
+    FREE_ARRAY(uint8_t, as.code, as.capacity);
+    if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0)
+    {
+        munmap(memory, size);
+        return false;
+    }
+
+    code.memory = static_cast<uint8_t*>(memory);
+    code.size = size;
+    code.entry = reinterpret_cast<JitEntry>(memory);
+    return true;
+}
+
+void free_jit_code(JitCode& code)
+{
+    if (code.memory != nullptr)
+        munmap(code.memory, code.size);
+    code = {};
+}
+
+#else
+
+bool jit_supported()
+{
+    return false;
+}
+
+bool jit_compile(const Chunk&, JitCode& code)
+{
+    code = {};
+    return false;
+}
+
+void free_jit_code(JitCode& code)
+{
+    code = {};
+}
+
+#endif // CLOX_JIT
+
+void jit_run(VM& vm, Chunk& chunk)
+{
+    if (chunk.jit == nullptr && !chunk.jit_failed)
+    {
+        JitCode code;
+        if (jit_compile(chunk, code))
+        {
+            chunk.jit = ALLOCATE(JitCode, 1);
+            *chunk.jit = code;
+        }
+        else
+            chunk.jit_failed = true;
+    }
+
+    if (chunk.jit != nullptr)
+        vm.ip = chunk.code + chunk.jit->entry(&vm);
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "common.h"
+#include "chunk.h"
+#include "cpu.h"
+
+// Baseline template JIT for x86-64 Linux. Each opcode is translated into a
+// fixed machine code template that works on the VM stack in place, and
+// jumps become native branches. Anything the templates do not handle
+// inline, such as a string concatenation, an operand of the wrong type, an
+// undefined global, a slice running out at OP_LOOP, or OP_RETURN and
+// OP_HALT themselves, exits the native code with the stack intact and the
+// interpreter resumes at that instruction, so errors are reported with the
+// interpreter's line information.
+
+#if defined(CLOX_X64) && defined(__linux__)
+#define CLOX_JIT
+#endif
+
+struct VM;
+
+// Returns the bytecode offset the interpreter resumes at.
+typedef int (*JitEntry)(VM* vm);
+
+struct JitCode
+{
+    uint8_t* memory; // mapped read+execute once the code is written
+    size_t size;
+    JitEntry entry;
+};
+
+// False on targets without a JIT.
+bool jit_supported();
+
+// Fails if the chunk uses an opcode the templates do not cover.
+bool jit_compile(const Chunk& chunk, JitCode& code);
+void free_jit_code(JitCode& code);
+
+// Compiles the chunk on first use and runs its native code from the start,
+// leaving vm.ip at the instruction the interpreter should continue with.
+// Backward branches charge vm.budget as run() does. Does nothing if the
+// chunk cannot be compiled.
+void jit_run(VM& vm, Chunk& chunk);
@@ -0,0 +1,92 @@
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+
+#include "lox_runtime.h"
+#include "object.h"
+#include "intern.h"
+#include "output.h"
+#include "vm.h"
+
+struct LoxRuntime
+{
+    VM vm;
+};
+
+static_assert(sizeof(LoxValue) == sizeof(Value), "LoxValue must mirror Value");
+static_assert(offsetof(LoxValue, as) == offsetof(Value, number), "LoxValue must mirror Value");
+static_assert(LOX_NIL == static_cast<int>(VAL_NIL) && LOX_BOOL == static_cast<int>(VAL_BOOL)
+    && LOX_NUMBER == static_cast<int>(VAL_NUMBER) && LOX_OBJ == static_cast<int>(VAL_OBJ),
+    "LoxValue tags must match ValueType");
+
+// The exit status clox uses for runtime errors.
+static constexpr int RUNTIME_ERROR_STATUS = 70;
+
+static Value to_value(LoxValue value)
+{
+    Value result;
+    memcpy(&result, &value, sizeof(result));
+    return result;
+}
+
+static LoxValue from_value(Value value)
+{
+    LoxValue result;
+    memcpy(&result, &value, sizeof(result));
+    return result;
+}
+
+bool lox_is_string(LoxValue value)
+{
+    return is_string(to_value(value));
+}
+
+LoxValue lox_string(LoxRuntime* runtime, const char* chars, int length)
+{
+    // Literals are interned, so they belong to no runtime.
+    (void)runtime;
+    return from_value(obj_val(intern_string(chars, length)));
+}
+
+LoxValue lox_concatenate(LoxRuntime* runtime, LoxValue a, LoxValue b)
+{
+    ObjString* result = concatenate_strings(runtime->vm.objects, as_string(to_value(a)), as_string(to_value(b)));
+    return result != nullptr ? from_value(obj_val(result)) : lox_nil();
+}
+
+bool lox_equal(LoxValue a, LoxValue b)
+{
+    return values_equal(to_value(a), to_value(b));
+}
+
+void lox_print(LoxRuntime* runtime, LoxValue value)
+{
+    write_value(runtime->vm.output, to_value(value));
+    write_output(runtime->vm.output, '\n');
+}
+
+int lox_global(LoxRuntime* runtime, const char* name, int length)
+{
+    return global_slot(runtime->vm.globals, intern_string(name, length));
+}
+
+LoxValue* lox_globals(LoxRuntime* runtime)
+{
+    return reinterpret_cast<LoxValue*>(runtime->vm.globals.values);
+}
+
+int lox_runtime_error(LoxRuntime* runtime, const char* message, int line)
+{
+    flush_output(runtime->vm.output);
+    fprintf(stderr, "%s\n[line %d] in script\n", message, line);
+    return RUNTIME_ERROR_STATUS;
+}
+
+int lox_run(int (*script)(LoxRuntime* runtime))
+{
+    LoxRuntime runtime = {};
+    init_vm(runtime.vm);
+    int status = script(&runtime);
+    free_vm(runtime.vm);
+    return status;
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+// Runtime for C translation units produced by `clox --emit-c`. This header
+// is plain C so the generated code can be built by a C compiler; link the
+// result against clox_core with the C++ driver (or add the C++ runtime
+// library). Define LOX_NO_MAIN to build a script into a shared object and
+// call lox_run(lox_script) from the host instead.
+
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct LoxRuntime LoxRuntime;
+
+// Same layout and tags as Value and ValueType.
+enum
+{
+    LOX_NIL,
+    LOX_BOOL,
+    LOX_NUMBER,
+    LOX_OBJ,
+};
+
+typedef struct LoxValue
+{
+    int type;
+    union
+    {
+        bool boolean;
+        double number;
+        void* obj;
+    } as;
+} LoxValue;
+
+static inline LoxValue lox_nil(void)
+{
+    LoxValue value;
+    value.type = LOX_NIL;
+    value.as.number = 0;
+    return value;
+}
+
+static inline LoxValue lox_bool(bool boolean)
+{
+    LoxValue value;
+    value.type = LOX_BOOL;
+    value.as.number = 0;
+    value.as.boolean = boolean;
+    return value;
+}
+
+static inline LoxValue lox_number(double number)
+{
+    LoxValue value;
+    value.type = LOX_NUMBER;
+    value.as.number = number;
+    return value;
+}
+
+static inline bool lox_is_number(LoxValue value) { return value.type == LOX_NUMBER; }
+// What a global holds until it is defined.
+static inline bool lox_is_undefined(LoxValue value) { return value.type == LOX_OBJ && !value.as.obj; }
+
+static inline bool lox_is_falsey(LoxValue value)
+{
+    return value.type == LOX_NIL || (value.type == LOX_BOOL && !value.as.boolean);
+}
+
+bool lox_is_string(LoxValue value);
+LoxValue lox_string(LoxRuntime* runtime, const char* chars, int length);
+// Returns nil if the runtime's heap limit rejects the result.
+LoxValue lox_concatenate(LoxRuntime* runtime, LoxValue a, LoxValue b);
+bool lox_equal(LoxValue a, LoxValue b);
+void lox_print(LoxRuntime* runtime, LoxValue value);
+
+// The slot of the global `name`, numbering it if needed, and the values of
+// all the globals by slot. Numbering a new name may move the values.
+int lox_global(LoxRuntime* runtime, const char* name, int length);
+LoxValue* lox_globals(LoxRuntime* runtime);
+
+// Reports the error the way the interpreter does and returns its exit
+// status, for the script to return.
+int lox_runtime_error(LoxRuntime* runtime, const char* message, int line);
+
+// Runs a script with a fresh runtime and returns the process exit status:
+// 0, or the interpreter's status for a runtime error.
+int lox_run(int (*script)(LoxRuntime* runtime));
+
+#ifdef __cplusplus
+}
+#endif
@@ -26,6 +26,8 @@ void free_objects(ObjList& objects)
         free_object(object);
         object = next;
     }
+    objects.head = nullptr;
+    objects.bytes = 0;
 }
 
 void* reallocate(void* previous, size_t old_size, size_t new_size)
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cstddef>
+
 #define ALLOCATE(type, count) \
     (type*)reallocate(nullptr, 0, sizeof(type) * (count));
 
@@ -20,8 +22,28 @@ struct Obj;
 struct ObjList
 {
     Obj* head;
+    size_t bytes; // asked of reallocate() for the objects in the list
+    size_t limit; // most `bytes` may reach, 0 for no limit
 };
 
+// Counts `size` more bytes against the list, or returns false, counting
+// nothing, if that would take it past its limit. Allocator overhead is not
+// counted, nor are interned strings, which belong to no list.
+inline bool reserve_heap(ObjList& objects, size_t size)
+{
+    if (objects.limit != 0 && size > objects.limit - objects.bytes)
+        return false;
+    objects.bytes += size;
+    return true;
+}
+
+// Gives back bytes reserve_heap() counted for an allocation that was given
+// up or handed to an object that counts them itself.
+inline void release_heap(ObjList& objects, size_t size)
+{
+    objects.bytes -= size;
+}
+
 void free_objects(ObjList& objects);
 
 void* reallocate(void* previous, size_t old_size, size_t new_size);
\ No newline at end of file
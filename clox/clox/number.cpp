@@ -0,0 +1,112 @@
+#include <charconv>
+#include <cmath>
+#include <cstring>
+
+#include "number.h"
+
+// Doubles represent every integer up to 2^53 and every power of ten up to
+// 10^22 exactly, so a product or quotient of the two is correctly rounded.
+static constexpr uint64_t MAX_EXACT_MANTISSA = 1ULL << 53;
+static constexpr int MAX_EXACT_POWER = 22;
+
+static constexpr double POWERS_OF_TEN[MAX_EXACT_POWER + 1] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+static double parse_number_slow(const char* start, int length)
+{
+    double value = 0;
+    std::from_chars(start, start + length, value);
+    return value;
+}
+
+double parse_number(const char* start, int length)
+{
+    const char* p = start;
+    const char* end = start + length;
+
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+
+    for (; p < end && *p != '.'; p++)
+    {
+        if (digits < 19)
+        {
+            mantissa = mantissa * 10 + static_cast<uint64_t>(*p - '0');
+            if (mantissa != 0)
+                digits++;
+        }
+        else
+            exponent++;
+    }
+
+    if (p < end)
+    {
+        for (p++; p < end; p++)
+        {
+            if (digits < 19)
+            {
+                mantissa = mantissa * 10 + static_cast<uint64_t>(*p - '0');
+                if (mantissa != 0)
+                    digits++;
+                exponent--;
+            }
+        }
+    }
+
+    // A mantissa this small means no digits were dropped above. Everything
+    // outside the exact range goes through the correctly rounding slow path.
+    if (mantissa <= MAX_EXACT_MANTISSA && exponent >= -MAX_EXACT_POWER && exponent <= MAX_EXACT_POWER)
+    {
+        double value = static_cast<double>(mantissa);
+        return exponent < 0 ? value / POWERS_OF_TEN[-exponent] : value * POWERS_OF_TEN[exponent];
+    }
+
+    return parse_number_slow(start, length);
+}
+
+static int format_integer(uint64_t magnitude, bool negative, char* buffer)
+{
+    char digits[20];
+    int count = 0;
+    do
+    {
+        digits[count++] = static_cast<char>('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude != 0);
+
+    int length = 0;
+    if (negative)
+        buffer[length++] = '-';
+    while (count > 0)
+        buffer[length++] = digits[--count];
+    buffer[length] = '\0';
+    return length;
+}
+
+int format_number(double value, char* buffer)
+{
+    if (std::isnan(value))
+    {
+        memcpy(buffer, "nan", 4);
+        return 3;
+    }
+    if (std::isinf(value))
+    {
+        const char* text = value < 0 ? "-inf" : "inf";
+        int length = static_cast<int>(strlen(text));
+        memcpy(buffer, text, length + 1);
+        return length;
+    }
+
+    // Integers are by far the most common numbers scripts print.
+    double magnitude = std::fabs(value);
+    if (magnitude < 1e15 && magnitude == std::floor(magnitude))
+        return format_integer(static_cast<uint64_t>(magnitude), std::signbit(value), buffer);
+
+    std::to_chars_result result = std::to_chars(buffer, buffer + NUMBER_BUFFER_SIZE - 1, value);
+    *result.ptr = '\0';
+    return static_cast<int>(result.ptr - buffer);
+}
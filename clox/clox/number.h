@@ -0,0 +1,17 @@
+#pragma once
+
+#include "common.h"
+
+// Locale-independent conversions between Lox number literals and doubles.
+
+// Parses a literal of the form digits [ '.' digits ] exactly; the result is
+// the double nearest to the decimal value, as strtod would give in the C
+// locale.
+double parse_number(const char* start, int length);
+
+// Longest text format_number can produce, including the terminator.
+constexpr int NUMBER_BUFFER_SIZE = 32;
+
+// Writes the shortest text that reads back as exactly `value` and returns
+// its length. The output is NUL-terminated.
+int format_number(double value, char* buffer);
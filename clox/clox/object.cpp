@@ -2,6 +2,7 @@
 #include <cstring>
 
 #include "object.h"
+#include "output.h"
 #include "vm.h"
 #include "hash.h"
 
@@ -17,44 +18,74 @@ static TObj* allocate_obj(ObjList& objects, ObjType type)
     return reinterpret_cast<TObj*>(object);
 }
 
-static ObjString* allocate_string(ObjList& objects, char* chars, int length, uint32_t hash)
+static ObjString* allocate_string(ObjList& objects, char* chars, int length)
 {
     ObjString* string = allocate_obj<ObjString>(objects, OBJ_STRING);
     string->chars = chars;
     string->length = length;
-    string->hash = hash;
+    string->hash = HASH_UNSET;
+    string->interned = false;
 
     return string;
 }
 
-static uint32_t hash_string(const char* key, int length)
+uint32_t hash_string(const char* key, int length)
 {
-    return hash32(key, length, 0);
+    freeze_hash_implementation();
+    uint32_t hash = hash32(key, length, 0);
+    return hash != HASH_UNSET ? hash : 1;
 }
 
-void print_object(Value value)
+void write_object(Output& out, Value value)
 {
     switch (obj_type(value))
     {
     case OBJ_STRING:
-        printf("%s", as_cstring(value));
+    {
+        ObjString* string = as_string(value);
+        write_output(out, string->chars, static_cast<size_t>(string->length));
         break;
     }
+    }
+}
+
+static inline bool reserve_string(ObjList& objects, int length)
+{
+    return reserve_heap(objects, sizeof(ObjString) + static_cast<size_t>(length) + 1);
 }
 
 ObjString* take_string(ObjList& objects, char* chars, int length)
 {
-    uint32_t hash = hash_string(chars, length);
-    return allocate_string(objects, chars, length, hash);
+    if (!reserve_string(objects, length))
+    {
+        FREE_ARRAY(char, chars, length + 1);
+        return nullptr;
+    }
+    return allocate_string(objects, chars, length);
+}
+
+// Checked before the characters are copied, so a string over the limit
+// costs no allocation.
+ObjString* concatenate_strings(ObjList& objects, const ObjString* a, const ObjString* b)
+{
+    int length = a->length + b->length;
+    if (!reserve_string(objects, length))
+        return nullptr;
+    char* chars = ALLOCATE(char, length + 1);
+    memcpy(chars, a->chars, a->length);
+    memcpy(chars + a->length, b->chars, b->length);
+    chars[length] = '\0';
+
+    return allocate_string(objects, chars, length);
 }
 
 ObjString* copy_string(ObjList& objects, const char* chars, int length)
 {
-    uint32_t hash = hash_string(chars, length);
-
+    if (!reserve_string(objects, length))
+        return nullptr;
     char* heap_buffer = ALLOCATE(char, length + 1);
     memcpy(heap_buffer, chars, length);
     heap_buffer[length] = '\0';
 
-    return allocate_string(objects, heap_buffer, length, hash);
+    return allocate_string(objects, heap_buffer, length);
 }
@@ -20,13 +20,31 @@ struct ObjString
     Obj obj;
     int length;
     char* chars;
-    uint32_t hash;
+    uint32_t hash; // HASH_UNSET until first needed, see string_hash()
+    bool interned; // owned by the intern table, see intern.h
 };
 
-void print_object(Value value);
+// Strings are hashed lazily: most results of concatenation are printed once
+// and never used as a key. hash_string() never returns HASH_UNSET, so the
+// sentinel cannot collide with a real hash.
+constexpr uint32_t HASH_UNSET = 0;
 
+uint32_t hash_string(const char* key, int length);
+
+inline uint32_t string_hash(ObjString* string)
+{
+    if (string->hash == HASH_UNSET)
+        string->hash = hash_string(string->chars, string->length);
+    return string->hash;
+}
+
+void write_object(Output& out, Value value);
+
+// Each returns nullptr if the string would take the list past its limit,
+// see reserve_heap(). take_string() then frees `chars`.
 ObjString* take_string(ObjList& objects, char* chars, int length);
 ObjString* copy_string(ObjList& objects, const char* chars, int length);
+ObjString* concatenate_strings(ObjList& objects, const ObjString* a, const ObjString* b);
 
 constexpr ObjType obj_type(Value value) { return as_obj(value)->type; }
 constexpr bool is_obj_type(Value value, ObjType type) { return is_obj(value) && as_obj(value)->type == type; }
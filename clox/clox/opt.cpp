@@ -0,0 +1,597 @@
+#include <cstring>
+
+#include "opt.h"
+#include "object.h"
+#include "vm.h"
+
+enum IrOp
+{
+    IR_CONSTANT,
+    IR_NOT,
+    IR_NEGATE,
+    IR_EQUAL,
+    IR_GREATER,
+    IR_LESS,
+    IR_ADD,
+    IR_SUBTRACT,
+    IR_MULTIPLY,
+    IR_DIVIDE,
+};
+
+struct IrNode
+{
+    IrOp op;
+    int args[2];
+    Value constant; // IR_CONSTANT only
+    int line;
+    bool number;    // the value is known to be a number
+};
+
+struct IrGraph
+{
+    IrNode* nodes;
+    int count;
+    int capacity;
+    int root; // the value OP_RETURN prints
+    int root_line;
+};
+
+static constexpr int NO_NODE = -1;
+
+static void init_graph(IrGraph& graph)
+{
+    graph.nodes = nullptr;
+    graph.count = 0;
+    graph.capacity = 0;
+    graph.root = NO_NODE;
+    graph.root_line = 0;
+}
+
+static void free_graph(IrGraph& graph)
+{
+    FREE_ARRAY(IrNode, graph.nodes, graph.capacity);
+    init_graph(graph);
+}
+
+static int add_node(IrGraph& graph, IrOp op, int a, int b, int line)
+{
+    if (graph.capacity < graph.count + 1)
+    {
+        int old_capacity = graph.capacity;
+        graph.capacity = GROW_CAPACITY(old_capacity);
+        graph.nodes = GROW_ARRAY(graph.nodes, IrNode, old_capacity, graph.capacity);
+    }
+
+    IrNode& node = graph.nodes[graph.count];
+    node.op = op;
+    node.args[0] = a;
+    node.args[1] = b;
+    node.constant = nil_val();
+    node.line = line;
+    node.number = false;
+    return graph.count++;
+}
+
+static int add_constant_node(IrGraph& graph, Value value, int line)
+{
+    int node = add_node(graph, IR_CONSTANT, NO_NODE, NO_NODE, line);
+    graph.nodes[node].constant = value;
+    return node;
+}
+
+static int arity(IrOp op)
+{
+    switch (op)
+    {
+    case IR_CONSTANT:
+        return 0;
+    case IR_NOT:
+    case IR_NEGATE:
+        return 1;
+    default:
+        return 2;
+    }
+}
+
+static bool binary_op(uint8_t instruction, IrOp& op)
+{
+    switch (instruction)
+    {
+    case OP_EQUAL: case OP_EQUAL_F64: op = IR_EQUAL; return true;
+    case OP_GREATER: case OP_GREATER_NUM: case OP_GREATER_F64: op = IR_GREATER; return true;
+    case OP_LESS: case OP_LESS_NUM: case OP_LESS_F64: op = IR_LESS; return true;
+    case OP_ADD: case OP_ADD_NUM_NUM: case OP_ADD_STR_STR: case OP_ADD_F64: op = IR_ADD; return true;
+    case OP_SUBTRACT: case OP_SUBTRACT_NUM: case OP_SUBTRACT_F64: op = IR_SUBTRACT; return true;
+    case OP_MULTIPLY: case OP_MULTIPLY_NUM: case OP_MULTIPLY_F64: op = IR_MULTIPLY; return true;
+    case OP_DIVIDE: case OP_DIVIDE_NUM: case OP_DIVIDE_F64: op = IR_DIVIDE; return true;
+    default: return false;
+    }
+}
+
+// Simulates the stack, turning each value the bytecode would push into a
+// node. Quickened and unchecked opcodes lift to the generic operation;
+// their checks are reconstructed from the graph when lowering.
+static bool lift(const Chunk& chunk, IrGraph& graph)
+{
+    int stack[STACK_MAX];
+    int depth = 0;
+
+    for (int offset = 0; offset < chunk.count;)
+    {
+        uint8_t instruction = chunk.code[offset];
+        int line = chunk.lines[offset];
+        IrOp op;
+
+        if (instruction == OP_GET_LOCAL || instruction == OP_SET_LOCAL || instruction == OP_CONSTANT)
+        {
+            if (offset + 1 >= chunk.count)
+                return false;
+            uint8_t operand = chunk.code[offset + 1];
+            if (instruction == OP_CONSTANT)
+            {
+                if (depth == STACK_MAX)
+                    return false;
+                stack[depth++] = add_constant_node(graph, chunk.constants.values[operand], line);
+            }
+            else if (instruction == OP_GET_LOCAL)
+            {
+                if (operand >= depth || depth == STACK_MAX)
+                    return false;
+                stack[depth] = stack[operand];
+                depth++;
+            }
+            else
+            {
+                if (operand >= depth || depth == 0)
+                    return false;
+                stack[operand] = stack[depth - 1];
+            }
+            offset += 2;
+            continue;
+        }
+
+        switch (instruction)
+        {
+        case OP_NIL:
+        case OP_TRUE:
+        case OP_FALSE:
+            if (depth == STACK_MAX)
+                return false;
+            stack[depth++] = add_constant_node(graph,
+                instruction == OP_NIL ? nil_val() : bool_val(instruction == OP_TRUE), line);
+            break;
+        case OP_POP:
+            if (depth == 0)
+                return false;
+            depth--;
+            break;
+        case OP_NOT:
+        case OP_NEGATE:
+        case OP_NEGATE_NUM:
+        case OP_NEGATE_F64:
+            if (depth < 1)
+                return false;
+            stack[depth - 1] = add_node(graph, instruction == OP_NOT ? IR_NOT : IR_NEGATE, stack[depth - 1], NO_NODE, line);
+            break;
+        case OP_RETURN:
+            if (depth < 1 || offset + 1 != chunk.count)
+                return false;
+            graph.root = stack[depth - 1];
+            graph.root_line = line;
+            return true;
+        default:
+            if (!binary_op(instruction, op) || depth < 2)
+                return false;
+            stack[depth - 2] = add_node(graph, op, stack[depth - 2], stack[depth - 1], line);
+            depth--;
+            break;
+        }
+        offset++;
+    }
+    return false;
+}
+
+static bool is_falsey(Value value)
+{
+    return is_nil(value) || (is_bool(value) && !as_bool(value));
+}
+
+// Computes the node's value from constant operands, exactly as run() would.
+// Fails for operations run() would report as an error.
+static bool fold(const IrNode& node, const IrNode* a, const IrNode* b, ObjList& objects, Value& result)
+{
+    Value x = a->constant;
+    Value y = b ? b->constant : nil_val();
+
+    switch (node.op)
+    {
+    case IR_NOT:
+        result = bool_val(is_falsey(x));
+        return true;
+    case IR_NEGATE:
+        if (!is_number(x))
+            return false;
+        result = number_val(-as_number(x));
+        return true;
+    case IR_EQUAL:
+        result = bool_val(values_equal(x, y));
+        return true;
+    case IR_ADD:
+        if (is_string(x) && is_string(y))
+        {
+            // Over the heap limit, left for run() to report.
+            ObjString* string = concatenate_strings(objects, as_string(x), as_string(y));
+            result = obj_val(string);
+            return string != nullptr;
+        }
+        // fallthrough
+    default:
+        if (!is_number(x) || !is_number(y))
+            return false;
+        break;
+    }
+
+    double p = as_number(x);
+    double q = as_number(y);
+    switch (node.op)
+    {
+    case IR_GREATER: result = bool_val(p > q); return true;
+    case IR_LESS: result = bool_val(p < q); return true;
+    case IR_ADD: result = number_val(p + q); return true;
+    case IR_SUBTRACT: result = number_val(p - q); return true;
+    case IR_MULTIPLY: result = number_val(p * q); return true;
+    case IR_DIVIDE: result = number_val(p / q); return true;
+    default: return false;
+    }
+}
+
+// Nodes are created in evaluation order, so operands always come first and
+// one forward pass sees every operand already folded.
+static void propagate_constants(IrGraph& graph, ObjList& objects)
+{
+    for (int i = 0; i < graph.count; i++)
+    {
+        IrNode& node = graph.nodes[i];
+        if (node.op == IR_CONSTANT)
+            continue;
+
+        const IrNode* a = &graph.nodes[node.args[0]];
+        const IrNode* b = arity(node.op) == 2 ? &graph.nodes[node.args[1]] : nullptr;
+        if (a->op != IR_CONSTANT || (b && b->op != IR_CONSTANT))
+            continue;
+
+        Value result;
+        if (fold(node, a, b, objects, result))
+        {
+            node.op = IR_CONSTANT;
+            node.args[0] = node.args[1] = NO_NODE;
+            node.constant = result;
+        }
+    }
+}
+
+// Constants are the same node only if they print the same, so numbers are
+// compared by bits: 0 and -0 are equal values but not interchangeable.
+static bool same_constant(Value a, Value b)
+{
+    if (a.type != b.type)
+        return false;
+    switch (a.type)
+    {
+    case VAL_NIL:
+        return true;
+    case VAL_BOOL:
+        return as_bool(a) == as_bool(b);
+    case VAL_NUMBER:
+    {
+        double x = as_number(a);
+        double y = as_number(b);
+        return memcmp(&x, &y, sizeof(double)) == 0;
+    }
+    case VAL_OBJ:
+        return values_equal(a, b);
+    }
+    return false;
+}
+
+static bool same_node(const IrNode& a, const IrNode& b)
+{
+    if (a.op != b.op)
+        return false;
+    if (a.op == IR_CONSTANT)
+        return same_constant(a.constant, b.constant);
+    return a.args[0] == b.args[0] && a.args[1] == b.args[1];
+}
+
+static uint32_t node_hash(const IrNode& node)
+{
+    uint32_t hash = static_cast<uint32_t>(node.op) * 0x9E3779B1u;
+    if (node.op == IR_CONSTANT)
+    {
+        const Value& value = node.constant;
+        uint64_t bits = 0;
+        if (is_number(value))
+            memcpy(&bits, &value.number, sizeof(bits));
+        else if (is_bool(value))
+            bits = as_bool(value);
+        else if (is_string(value))
+            bits = string_hash(as_string(value));
+        return hash ^ static_cast<uint32_t>((bits ^ (bits >> 32)) * 0x85EBCA6Bu) ^ static_cast<uint32_t>(value.type);
+    }
+    hash ^= static_cast<uint32_t>(node.args[0]) * 0x85EBCA6Bu;
+    hash ^= static_cast<uint32_t>(node.args[1]) * 0xC2B2AE35u;
+    return hash;
+}
+
+// Value numbering: each node's operands are first replaced by the earliest
+// equivalent node, then the node itself is looked up among earlier nodes.
+// `canonical[i]` ends up as the earliest node equivalent to node i.
+static void eliminate_common_subexpressions(IrGraph& graph, int* canonical)
+{
+    int capacity = 16;
+    while (capacity < graph.count * 2)
+        capacity *= 2;
+    int* table = ALLOCATE(int, capacity);
+    for (int i = 0; i < capacity; i++)
+        table[i] = NO_NODE;
+
+    for (int i = 0; i < graph.count; i++)
+    {
+        IrNode& node = graph.nodes[i];
+        for (int arg = 0; arg < arity(node.op); arg++)
+            node.args[arg] = canonical[node.args[arg]];
+
+        uint32_t index = node_hash(node) & (capacity - 1);
+        for (;;)
+        {
+            int candidate = table[index];
+            if (candidate == NO_NODE)
+            {
+                table[index] = i;
+                canonical[i] = i;
+                break;
+            }
+            if (same_node(graph.nodes[candidate], node))
+            {
+                canonical[i] = candidate;
+                break;
+            }
+            index = (index + 1) & (capacity - 1);
+        }
+    }
+
+    graph.root = canonical[graph.root];
+    FREE_ARRAY(int, table, capacity);
+}
+
+// Counts the uses of every node reachable from the root; unreachable nodes
+// keep a count of zero and are never lowered.
+static void count_uses(const IrGraph& graph, int* uses)
+{
+    for (int i = 0; i < graph.count; i++)
+        uses[i] = 0;
+    uses[graph.root] = 1;
+
+    for (int i = graph.count - 1; i >= 0; i--)
+    {
+        if (uses[i] == 0)
+            continue;
+        const IrNode& node = graph.nodes[i];
+        for (int arg = 0; arg < arity(node.op); arg++)
+            uses[node.args[arg]]++;
+    }
+}
+
+static void infer_numbers(IrGraph& graph)
+{
+    for (int i = 0; i < graph.count; i++)
+    {
+        IrNode& node = graph.nodes[i];
+        switch (node.op)
+        {
+        case IR_CONSTANT:
+            node.number = is_number(node.constant);
+            break;
+        case IR_NEGATE:
+        case IR_SUBTRACT:
+        case IR_MULTIPLY:
+        case IR_DIVIDE:
+            node.number = true; // or the operation failed
+            break;
+        case IR_ADD:
+            node.number = graph.nodes[node.args[0]].number && graph.nodes[node.args[1]].number;
+            break;
+        default:
+            node.number = false;
+            break;
+        }
+    }
+}
+
+// A value popped unused is dead, but dropping it is only safe if computing
+// it cannot report an error. Nodes merged away by CSE are not dead.
+static bool drops_error(const IrGraph& graph, const int* canonical, const int* uses)
+{
+    for (int i = 0; i < graph.count; i++)
+    {
+        const IrNode& node = graph.nodes[i];
+        if (uses[i] > 0 || canonical[i] != i)
+            continue;
+        switch (node.op)
+        {
+        case IR_CONSTANT:
+        case IR_NOT:
+        case IR_EQUAL:
+            break;
+        default:
+            for (int arg = 0; arg < arity(node.op); arg++)
+            {
+                if (!graph.nodes[node.args[arg]].number)
+                    return true;
+            }
+            break;
+        }
+    }
+    return false;
+}
+
+struct Lowering
+{
+    const IrGraph* graph;
+    const int* uses;
+    int* locals;     // slot of each node used more than once, or NO_NODE
+    bool* computed;  // whether the local already holds the value
+    Chunk* chunk;
+    bool failed;
+};
+
+static void emit(Lowering& lowering, uint8_t byte, int line)
+{
+    write_chunk(*lowering.chunk, byte, line);
+}
+
+static void emit_constant(Lowering& lowering, Value value, int line)
+{
+    if (is_nil(value))
+    {
+        emit(lowering, OP_NIL, line);
+        return;
+    }
+    if (is_bool(value))
+    {
+        emit(lowering, as_bool(value) ? OP_TRUE : OP_FALSE, line);
+        return;
+    }
+
+    Chunk& chunk = *lowering.chunk;
+    int constant = 0;
+    while (constant < chunk.constants.count && !same_constant(chunk.constants.values[constant], value))
+        constant++;
+    if (constant == chunk.constants.count)
+        constant = add_constant(chunk, value);
+    if (constant > UINT8_MAX)
+    {
+        lowering.failed = true;
+        return;
+    }
+    emit(lowering, OP_CONSTANT, line);
+    emit(lowering, static_cast<uint8_t>(constant), line);
+}
+
+static uint8_t lowered_op(const IrNode& node, bool numeric)
+{
+    switch (node.op)
+    {
+    case IR_NOT: return OP_NOT;
+    case IR_NEGATE: return numeric ? OP_NEGATE_F64 : OP_NEGATE;
+    case IR_EQUAL: return numeric ? OP_EQUAL_F64 : OP_EQUAL;
+    case IR_GREATER: return numeric ? OP_GREATER_F64 : OP_GREATER;
+    case IR_LESS: return numeric ? OP_LESS_F64 : OP_LESS;
+    case IR_ADD: return numeric ? OP_ADD_F64 : OP_ADD;
+    case IR_SUBTRACT: return numeric ? OP_SUBTRACT_F64 : OP_SUBTRACT;
+    case IR_MULTIPLY: return numeric ? OP_MULTIPLY_F64 : OP_MULTIPLY;
+    default: return numeric ? OP_DIVIDE_F64 : OP_DIVIDE;
+    }
+}
+
+// Emits the node as an expression tree in the original evaluation order.
+static void lower_node(Lowering& lowering, int index)
+{
+    const IrNode& node = lowering.graph->nodes[index];
+    int local = lowering.locals[index];
+    if (local != NO_NODE && lowering.computed[index])
+    {
+        emit(lowering, OP_GET_LOCAL, node.line);
+        emit(lowering, static_cast<uint8_t>(local), node.line);
+        return;
+    }
+
+    if (node.op == IR_CONSTANT)
+        emit_constant(lowering, node.constant, node.line);
+    else
+    {
+        bool numeric = true;
+        for (int arg = 0; arg < arity(node.op); arg++)
+        {
+            lower_node(lowering, node.args[arg]);
+            numeric = numeric && lowering.graph->nodes[node.args[arg]].number;
+        }
+        emit(lowering, lowered_op(node, numeric), node.line);
+    }
+
+    if (local != NO_NODE)
+    {
+        emit(lowering, OP_SET_LOCAL, node.line);
+        emit(lowering, static_cast<uint8_t>(local), node.line);
+        lowering.computed[index] = true;
+    }
+}
+
+static bool lower(const IrGraph& graph, const int* uses, Chunk& optimized)
+{
+    int* locals = ALLOCATE(int, graph.count);
+    bool* computed = ALLOCATE(bool, graph.count);
+
+    // Constants are cheaper to push again than to keep in a local.
+    int local_count = 0;
+    for (int i = 0; i < graph.count; i++)
+    {
+        bool shared = uses[i] > 1 && graph.nodes[i].op != IR_CONSTANT;
+        locals[i] = shared ? local_count++ : NO_NODE;
+        computed[i] = false;
+    }
+
+    Lowering lowering = { &graph, uses, locals, computed, &optimized, local_count > UINT8_MAX };
+    if (!lowering.failed)
+    {
+        for (int i = 0; i < local_count; i++)
+            emit(lowering, OP_NIL, graph.root_line);
+
+        lower_node(lowering, graph.root);
+
+        // Leave only the result on the stack for OP_RETURN.
+        if (local_count > 0)
+        {
+            emit(lowering, OP_SET_LOCAL, graph.root_line);
+            emit(lowering, 0, graph.root_line);
+            for (int i = 0; i < local_count; i++)
+                emit(lowering, OP_POP, graph.root_line);
+        }
+        emit(lowering, OP_RETURN, graph.root_line);
+    }
+
+    FREE_ARRAY(int, locals, graph.count);
+    FREE_ARRAY(bool, computed, graph.count);
+    return !lowering.failed;
+}
+
+bool optimize_chunk(const Chunk& chunk, Chunk& optimized, size_t heap_limit)
+{
+    init_chunk(optimized);
+    optimized.objects.limit = heap_limit;
+
+    IrGraph graph;
+    init_graph(graph);
+    if (!lift(chunk, graph))
+    {
+        free_graph(graph);
+        return false;
+    }
+
+    int* canonical = ALLOCATE(int, graph.count);
+    int* uses = ALLOCATE(int, graph.count);
+
+    propagate_constants(graph, optimized.objects);
+    eliminate_common_subexpressions(graph, canonical);
+    count_uses(graph, uses);
+    infer_numbers(graph);
+    bool lowered = !drops_error(graph, canonical, uses) && lower(graph, uses, optimized);
+
+    FREE_ARRAY(int, canonical, graph.count);
+    FREE_ARRAY(int, uses, graph.count);
+    free_graph(graph);
+
+    if (!lowered)
+        free_chunk(optimized);
+    return lowered;
+}
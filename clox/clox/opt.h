@@ -0,0 +1,27 @@
+#pragma once
+
+#include "chunk.h"
+#include "memory.h"
+
+// Second tier. A chunk that has run OPT_THRESHOLD times is lifted into an
+// SSA graph, one node per value the bytecode computes, and optimized:
+//
+//   - constant propagation folds operations on constants, including string
+//     concatenation, unless the operation would fail at runtime;
+//   - common subexpression elimination merges nodes with the same
+//     operation and operands;
+//   - dead code elimination drops nodes the result no longer depends on.
+//
+// The graph is lowered back into a chunk. A value used more than once
+// lives in a local slot reserved at the bottom of the stack. It is computed
+// where the original code first computed it and read back with
+// OP_GET_LOCAL, so errors happen in the same order and on the same lines.
+// There are no loops yet, so nothing is hoisted.
+
+constexpr uint32_t OPT_THRESHOLD = 8;
+
+// Fails if the chunk uses an opcode the optimizer does not handle, or if
+// the result would not fit in a chunk. Strings created by folding belong to
+// `optimized.objects`, so the optimized chunk outlives the VM that built it,
+// and together they may take up to `heap_limit` bytes (0 for no limit).
+bool optimize_chunk(const Chunk& chunk, Chunk& optimized, size_t heap_limit);
@@ -0,0 +1,148 @@
+#include <cerrno>
+#include <cstring>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "output.h"
+#include "memory.h"
+
+static void init_output(Output& out, OutputSink sink, size_t capacity)
+{
+    out.sink = sink;
+    out.fd = -1;
+    out.file = nullptr;
+    out.buffer = nullptr;
+    if (capacity > 0)
+        out.buffer = ALLOCATE(char, capacity);
+    out.count = 0;
+    out.capacity = capacity;
+    out.limit = 0;
+    out.failed = false;
+}
+
+void init_output_fd(Output& out, int fd, size_t capacity)
+{
+    init_output(out, OUTPUT_FD, capacity);
+    out.fd = fd;
+}
+
+void init_output_file(Output& out, FILE* file, size_t capacity)
+{
+    init_output(out, OUTPUT_FILE, capacity);
+    out.file = file;
+}
+
+void init_output_memory(Output& out, size_t limit)
+{
+    init_output(out, OUTPUT_MEMORY, 0);
+    out.limit = limit;
+}
+
+void free_output(Output& out)
+{
+    flush_output(out);
+    FREE_ARRAY(char, out.buffer, out.capacity);
+    out.buffer = nullptr;
+    out.count = 0;
+    out.capacity = 0;
+}
+
+static bool write_fd(int fd, const char* chars, size_t length)
+{
+    while (length > 0)
+    {
+#ifdef _WIN32
+        int written = _write(fd, chars, static_cast<unsigned>(length));
+#else
+        ssize_t written = write(fd, chars, length);
+#endif
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        chars += written;
+        length -= static_cast<size_t>(written);
+    }
+    return true;
+}
+
+static void write_sink(Output& out, const char* chars, size_t length)
+{
+    if (out.failed || length == 0)
+        return;
+
+    switch (out.sink)
+    {
+    case OUTPUT_FD:
+        out.failed = !write_fd(out.fd, chars, length);
+        break;
+    case OUTPUT_FILE:
+        out.failed = fwrite(chars, 1, length, out.file) != length;
+        break;
+    case OUTPUT_MEMORY:
+        break;
+    }
+}
+
+bool flush_output(Output& out)
+{
+    if (out.sink == OUTPUT_MEMORY)
+        return !out.failed;
+
+    write_sink(out, out.buffer, out.count);
+    out.count = 0;
+    if (out.sink == OUTPUT_FILE && !out.failed)
+        out.failed = fflush(out.file) != 0;
+    return !out.failed;
+}
+
+void write_output(Output& out, const char* chars, size_t length)
+{
+    if (out.count + length <= out.capacity)
+    {
+        memcpy(out.buffer + out.count, chars, length);
+        out.count += length;
+        return;
+    }
+
+    if (out.sink == OUTPUT_MEMORY)
+    {
+        if (out.failed)
+            return;
+        size_t capacity = out.capacity;
+        while (capacity < out.count + length)
+            capacity = GROW_CAPACITY(capacity);
+        if (out.limit != 0 && capacity > out.limit)
+            capacity = out.limit;
+        // Whatever fits is kept. The buffer is then full, so every later
+        // write comes here and is dropped.
+        if (out.count + length > capacity)
+        {
+            length = capacity - out.count;
+            out.failed = true;
+        }
+        out.buffer = GROW_ARRAY(out.buffer, char, out.capacity, capacity);
+        out.capacity = capacity;
+        memcpy(out.buffer + out.count, chars, length);
+        out.count += length;
+        return;
+    }
+
+    write_sink(out, out.buffer, out.count);
+    out.count = 0;
+
+    // Anything that would not fit in an empty buffer skips the copy.
+    if (length >= out.capacity)
+        write_sink(out, chars, length);
+    else
+    {
+        memcpy(out.buffer, chars, length);
+        out.count = length;
+    }
+}
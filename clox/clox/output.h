@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdio>
+
+#include "common.h"
+
+// Buffered output for everything a script prints. Writes collect in the
+// buffer and reach the sink in large blocks; embedders pick the sink.
+
+enum OutputSink
+{
+    OUTPUT_FD,     // write(2) on a file descriptor
+    OUTPUT_FILE,   // fwrite on a stdio stream
+    OUTPUT_MEMORY, // kept in the buffer, which grows instead of flushing
+};
+
+constexpr size_t OUTPUT_BUFFER_SIZE = 64 * 1024;
+
+struct Output
+{
+    OutputSink sink;
+    int fd;
+    FILE* file;
+
+    char* buffer;
+    size_t count;
+    size_t capacity;
+    size_t limit; // most a memory sink keeps, 0 for no limit
+
+    bool failed; // a write to the sink failed; later output is dropped
+};
+
+// A capacity of 0 writes straight through to the sink.
+void init_output_fd(Output& out, int fd, size_t capacity = OUTPUT_BUFFER_SIZE);
+void init_output_file(Output& out, FILE* file, size_t capacity = OUTPUT_BUFFER_SIZE);
+// The text written so far is out.buffer[0, out.count). Output past `limit`
+// bytes is dropped, as if the sink had failed there.
+void init_output_memory(Output& out, size_t limit = 0);
+// Flushes, then releases the buffer. The fd or file stays open.
+void free_output(Output& out);
+
+// Returns false if the sink failed at any point since initialization.
+bool flush_output(Output& out);
+
+void write_output(Output& out, const char* chars, size_t length);
+
+inline void write_output(Output& out, char c)
+{
+    if (out.count < out.capacity)
+        out.buffer[out.count++] = c;
+    else
+        write_output(out, &c, 1);
+}
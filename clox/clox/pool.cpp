@@ -0,0 +1,220 @@
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <vector>
+
+#include "pool.h"
+
+struct WorkQueue
+{
+    std::mutex mutex;
+    std::deque<PoolJob*> jobs;
+};
+
+struct Pool
+{
+    PoolOptions options;
+    std::vector<std::thread> workers;
+    std::deque<WorkQueue> queues; // a deque, since WorkQueue cannot move
+
+    std::mutex mutex;              // guards the waits below
+    std::condition_variable work;  // signalled when queued rises or on stop
+    std::condition_variable done;  // signalled when pending reaches zero
+    std::atomic<int> queued;       // jobs in the queues
+    std::atomic<int> pending;      // jobs submitted and not finished
+    std::atomic<unsigned> next_queue;
+    bool stopping;
+};
+
+void init_job(PoolJob& job)
+{
+    job.path = nullptr;
+    job.source = nullptr;
+    job.program = nullptr;
+    job.result = INTERPRET_OK;
+    job.unreadable = false;
+    init_output_memory(job.output);
+}
+
+void free_job(PoolJob& job)
+{
+    free_output(job.output);
+}
+
+// Like clox's read_file(), but reports failure instead of exiting.
+static char* read_source(const char* path)
+{
+    FILE* file = fopen(path, "rb");
+    if (!file)
+        return nullptr;
+
+    fseek(file, 0L, SEEK_END);
+    long file_size = ftell(file);
+    rewind(file);
+
+    char* buffer = file_size < 0 ? nullptr : static_cast<char*>(malloc(static_cast<size_t>(file_size) + 1));
+    if (buffer)
+    {
+        size_t bytes_read = fread(buffer, sizeof(char), static_cast<size_t>(file_size), file);
+        if (bytes_read < static_cast<size_t>(file_size))
+        {
+            free(buffer);
+            buffer = nullptr;
+        }
+        else
+            buffer[bytes_read] = '\0';
+    }
+
+    fclose(file);
+    return buffer;
+}
+
+static void run_job(VM& vm, PoolJob& job)
+{
+    if (job.program)
+        job.result = interpret(vm, *job.program);
+    else if (job.source)
+        job.result = interpret(vm, job.source);
+    else
+    {
+        char* source = read_source(job.path);
+        job.unreadable = source == nullptr;
+        if (source)
+            job.result = interpret(vm, source);
+        free(source);
+    }
+    // Workers do not slice their VMs, but a preempted run is finished here
+    // all the same.
+    while (job.result == INTERPRET_PREEMPTED)
+        job.result = resume(vm);
+
+    // The job keeps what was printed; the VM starts the next job with a
+    // fresh buffer, an empty heap and no globals.
+    free_output(job.output);
+    job.output = vm.output;
+    init_output_memory(vm.output, vm.objects.limit);
+    free_objects(vm.objects);
+    clear_globals(vm);
+}
+
+// The newest job of our own queue, else the oldest of someone else's.
+static PoolJob* take_job(Pool& pool, int self)
+{
+    int count = static_cast<int>(pool.queues.size());
+    for (int i = 0; i < count; i++)
+    {
+        WorkQueue& queue = pool.queues[static_cast<size_t>((self + i) % count)];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.jobs.empty())
+            continue;
+
+        PoolJob* job;
+        if (i == 0)
+        {
+            job = queue.jobs.back();
+            queue.jobs.pop_back();
+        }
+        else
+        {
+            job = queue.jobs.front();
+            queue.jobs.pop_front();
+        }
+        pool.queued.fetch_sub(1);
+        return job;
+    }
+    return nullptr;
+}
+
+static void worker_main(Pool& pool, int self)
+{
+    Output output;
+    init_output_memory(output, pool.options.heap_limit);
+    VM vm = {};
+    init_vm(vm, output);
+    vm.jit = pool.options.jit;
+    vm.registers = pool.options.registers;
+    // The workers already keep the cores busy; a job's scanner threads
+    // would only add to them.
+    vm.scan_threads = 1;
+    vm.objects.limit = pool.options.heap_limit;
+
+    for (;;)
+    {
+        PoolJob* job = take_job(pool, self);
+        if (job)
+        {
+            run_job(vm, *job);
+            if (pool.pending.fetch_sub(1) == 1)
+            {
+                std::lock_guard<std::mutex> lock(pool.mutex);
+                pool.done.notify_all();
+            }
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(pool.mutex);
+        pool.work.wait(lock, [&]() { return pool.queued.load() > 0 || pool.stopping; });
+        if (pool.stopping && pool.queued.load() == 0)
+            break;
+    }
+
+    free_vm(vm);
+}
+
+Pool* start_pool(const PoolOptions& options)
+{
+    Pool* pool = new (reallocate(nullptr, 0, sizeof(Pool))) Pool();
+    pool->options = options;
+    if (pool->options.workers < 1)
+        pool->options.workers = 1;
+    pool->queued.store(0);
+    pool->pending.store(0);
+    pool->next_queue.store(0);
+    pool->stopping = false;
+
+    pool->queues.resize(static_cast<size_t>(pool->options.workers));
+    for (int i = 0; i < pool->options.workers; i++)
+        pool->workers.emplace_back(worker_main, std::ref(*pool), i);
+    return pool;
+}
+
+void submit_job(Pool& pool, PoolJob& job)
+{
+    pool.pending.fetch_add(1);
+
+    unsigned index = pool.next_queue.fetch_add(1) % static_cast<unsigned>(pool.queues.size());
+    WorkQueue& queue = pool.queues[index];
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.jobs.push_back(&job);
+    }
+
+    std::lock_guard<std::mutex> lock(pool.mutex);
+    pool.queued.fetch_add(1);
+    pool.work.notify_one();
+}
+
+void wait_pool(Pool& pool)
+{
+    std::unique_lock<std::mutex> lock(pool.mutex);
+    pool.done.wait(lock, [&]() { return pool.pending.load() == 0; });
+}
+
+void stop_pool(Pool* pool)
+{
+    {
+        std::lock_guard<std::mutex> lock(pool->mutex);
+        pool->stopping = true;
+        pool->work.notify_all();
+    }
+    for (std::thread& worker : pool->workers)
+        worker.join();
+
+    pool->~Pool();
+    reallocate(pool, sizeof(Pool), 0);
+}
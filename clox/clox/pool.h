@@ -0,0 +1,62 @@
+#pragma once
+
+#include "output.h"
+#include "program.h"
+#include "vm.h"
+
+// Runs scripts on a fixed set of worker threads, each owning a VM and the
+// heap that goes with it. Jobs are spread over one queue per worker; a
+// worker takes the newest job from its own queue and, once that is empty,
+// steals the oldest from another's.
+//
+// What workers share, and why it is safe:
+//   - compile() and the scanner keep their state in locals and the Parser,
+//     and workers compile with a single scanner thread, so a pool never
+//     runs more threads than it has workers;
+//   - reallocate() is realloc and free, which are thread-safe;
+//   - the hash and scan kernels are chosen during static initialization;
+//   - a Program is read only while it runs (see program.h);
+//   - runtime and compile errors go straight to stderr, so lines from
+//     jobs running at the same time may interleave;
+//   - DEBUG_PRINT_CODE and DEBUG_TRACE_EXECUTION output is not ordered
+//     between workers.
+
+struct PoolJob
+{
+    // The script, exactly one of: a file to read and compile, source to
+    // compile, or a compiled program.
+    const char* path;
+    const char* source;
+    Program* program;
+
+    // Set by the worker that ran the job.
+    InterpretResult result;
+    bool unreadable; // `path` could not be read; `result` is meaningless
+    Output output;   // memory output holding what the script printed, see heap_limit
+};
+
+void init_job(PoolJob& job);
+void free_job(PoolJob& job);
+
+struct PoolOptions
+{
+    int workers;
+    bool jit;       // as VM::jit
+    bool registers; // as VM::registers
+    // Caps each job's strings, as ObjList::limit, and separately what it
+    // prints, as Output::limit; 0 for no limit. Neither counts the VM's
+    // stack and fiber stacks, its globals or the chunk compiled from the
+    // job's source.
+    size_t heap_limit;
+};
+
+struct Pool;
+
+Pool* start_pool(const PoolOptions& options);
+// Queues a job. It must stay alive, and untouched, until wait_pool()
+// returns.
+void submit_job(Pool& pool, PoolJob& job);
+// Returns once every job submitted so far has finished.
+void wait_pool(Pool& pool);
+// Finishes the queued jobs, then joins the workers and frees the pool.
+void stop_pool(Pool* pool);
@@ -0,0 +1,49 @@
+#include <new>
+
+#include "program.h"
+#include "compiler.h"
+#include "object.h"
+
+Program* compile_program(const char* source)
+{
+    Program* program = new (reallocate(nullptr, 0, sizeof(Program))) Program();
+    program->references.store(1, std::memory_order_relaxed);
+    init_chunk(program->chunk);
+
+    if (!compile(source, program->chunk))
+    {
+        release_program(program);
+        return nullptr;
+    }
+
+    program->chunk.shared = true;
+    for (int i = 0; i < program->chunk.constants.count; i++)
+    {
+        Value constant = program->chunk.constants.values[i];
+        if (is_string(constant))
+            string_hash(as_string(constant));
+    }
+    return program;
+}
+
+Program* retain_program(Program* program)
+{
+    program->references.fetch_add(1, std::memory_order_relaxed);
+    return program;
+}
+
+void release_program(Program* program)
+{
+    if (program->references.fetch_sub(1, std::memory_order_acq_rel) != 1)
+        return;
+
+    free_chunk(program->chunk);
+    program->~Program();
+    reallocate(program, sizeof(Program), 0);
+}
+
+InterpretResult interpret(VM& vm, const Program& program)
+{
+    // interpret() only reads a shared chunk.
+    return interpret(vm, const_cast<Chunk&>(program.chunk));
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <atomic>
+
+#include "chunk.h"
+#include "memory.h"
+#include "vm.h"
+
+// A compiled script that can be run many times, by any number of VMs on
+// any number of threads at once. Nothing in it changes after
+// compile_program() returns: its chunk is marked shared, so run() does not
+// quicken it and interpret() neither optimizes nor JIT-compiles it, and
+// the hashes of its strings are computed up front rather than on first
+// use. Strings a run creates belong to the VM running it.
+struct Program
+{
+    std::atomic<int> references;
+    Chunk chunk; // its string constants are interned
+};
+
+// Returns a program holding one reference, or nullptr after reporting a
+// compile error.
+Program* compile_program(const char* source);
+
+// References may be taken and dropped from any thread. The program is
+// freed with the last one.
+Program* retain_program(Program* program);
+void release_program(Program* program);
+
+InterpretResult interpret(VM& vm, const Program& program);
@@ -0,0 +1,237 @@
+#include "regchunk.h"
+#include "memory.h"
+#include "vm.h"
+
+void init_reg_chunk(RegChunk& chunk)
+{
+    chunk.count = 0;
+    chunk.capacity = 0;
+    chunk.code = nullptr;
+    chunk.lines = nullptr;
+    init_value_array(chunk.constants);
+    chunk.registers = 0;
+}
+
+void free_reg_chunk(RegChunk& chunk)
+{
+    FREE_ARRAY(uint32_t, chunk.code, chunk.capacity);
+    FREE_ARRAY(int, chunk.lines, chunk.capacity);
+    free_value_array(chunk.constants);
+    init_reg_chunk(chunk);
+}
+
+void write_reg_chunk(RegChunk& chunk, uint32_t instruction, int line)
+{
+    if (chunk.capacity < chunk.count + 1)
+    {
+        int old_capacity = chunk.capacity;
+        chunk.capacity = GROW_CAPACITY(old_capacity);
+        chunk.code = GROW_ARRAY(chunk.code, uint32_t, old_capacity, chunk.capacity);
+        chunk.lines = GROW_ARRAY(chunk.lines, int, old_capacity, chunk.capacity);
+    }
+
+    chunk.code[chunk.count] = instruction;
+    chunk.lines[chunk.count] = line;
+    chunk.count++;
+}
+
+// Where a value on the simulated stack lives. Pushing a constant or reading
+// a local emits nothing; the instruction that consumes the value reads the
+// constant or the local's register directly.
+struct Operand
+{
+    bool constant;
+    int index; // constant index, or register
+};
+
+struct Translation
+{
+    const Chunk* chunk;
+    RegChunk* out;
+    Operand stack[STACK_MAX];
+    int depth;
+    int literals[3]; // constant index of nil, false and true, once added
+    bool failed;
+};
+
+static void emit(Translation& t, RegOp op, int a, int b, int c, int line)
+{
+    if (a >= MAX_REGISTERS)
+    {
+        t.failed = true;
+        return;
+    }
+    if (a >= t.out->registers)
+        t.out->registers = a + 1;
+    write_reg_chunk(*t.out, encode_reg(op, static_cast<uint8_t>(a), static_cast<uint8_t>(b), static_cast<uint8_t>(c)), line);
+}
+
+static void push_literal(Translation& t, int literal, Value value)
+{
+    if (t.literals[literal] < 0)
+    {
+        write_value_array(t.out->constants, value);
+        t.literals[literal] = t.out->constants.count - 1;
+    }
+    t.stack[t.depth++] = { true, t.literals[literal] };
+}
+
+// The RK operand for the value at `slot`. Constants beyond RK's reach are
+// loaded into the slot's own register first.
+static int rk(Translation& t, int slot, int line)
+{
+    Operand& operand = t.stack[slot];
+    if (!operand.constant)
+        return operand.index;
+    if (operand.index < RK_CONSTANT)
+        return RK_CONSTANT | operand.index;
+
+    emit(t, ROP_LOADK, slot, operand.index & 0xFF, operand.index >> 8, line);
+    operand = { false, slot };
+    return slot;
+}
+
+// Values above a local that still read its register must get their own
+// copy before the local is assigned.
+static void detach(Translation& t, int local, int line)
+{
+    for (int slot = local + 1; slot < t.depth; slot++)
+    {
+        if (!t.stack[slot].constant && t.stack[slot].index == local)
+        {
+            emit(t, ROP_MOVE, slot, local, 0, line);
+            t.stack[slot] = { false, slot };
+        }
+    }
+}
+
+static bool binary_reg_op(uint8_t instruction, RegOp& op)
+{
+    switch (instruction)
+    {
+    case OP_EQUAL: op = ROP_EQUAL; return true;
+    case OP_GREATER: case OP_GREATER_NUM: op = ROP_GREATER; return true;
+    case OP_LESS: case OP_LESS_NUM: op = ROP_LESS; return true;
+    case OP_ADD: case OP_ADD_NUM_NUM: case OP_ADD_STR_STR: op = ROP_ADD; return true;
+    case OP_SUBTRACT: case OP_SUBTRACT_NUM: op = ROP_SUBTRACT; return true;
+    case OP_MULTIPLY: case OP_MULTIPLY_NUM: op = ROP_MULTIPLY; return true;
+    case OP_DIVIDE: case OP_DIVIDE_NUM: op = ROP_DIVIDE; return true;
+    case OP_EQUAL_F64: op = ROP_EQUAL_F64; return true;
+    case OP_GREATER_F64: op = ROP_GREATER_F64; return true;
+    case OP_LESS_F64: op = ROP_LESS_F64; return true;
+    case OP_ADD_F64: op = ROP_ADD_F64; return true;
+    case OP_SUBTRACT_F64: op = ROP_SUBTRACT_F64; return true;
+    case OP_MULTIPLY_F64: op = ROP_MULTIPLY_F64; return true;
+    case OP_DIVIDE_F64: op = ROP_DIVIDE_F64; return true;
+    default: return false;
+    }
+}
+
+// Each stack slot is a register; an instruction writes its result to the
+// register of the slot the result lands in.
+static bool translate(Translation& t)
+{
+    const Chunk& chunk = *t.chunk;
+    for (int offset = 0; offset < chunk.count && !t.failed;)
+    {
+        uint8_t instruction = chunk.code[offset];
+        int line = chunk.lines[offset];
+        int top = t.depth - 1;
+        RegOp op;
+
+        if (instruction != OP_POP && instruction != OP_RETURN && t.depth == STACK_MAX)
+            return false;
+
+        switch (instruction)
+        {
+        case OP_CONSTANT:
+            t.stack[t.depth++] = { true, chunk.code[offset + 1] };
+            offset += 2;
+            continue;
+        case OP_GET_LOCAL:
+        {
+            uint8_t local = chunk.code[offset + 1];
+            if (local >= t.depth)
+                return false;
+            t.stack[t.depth++] = t.stack[local];
+            offset += 2;
+            continue;
+        }
+        case OP_SET_LOCAL:
+        {
+            uint8_t local = chunk.code[offset + 1];
+            if (local >= t.depth)
+                return false;
+            detach(t, local, line);
+            if (t.stack[top].constant || t.stack[top].index != local)
+                emit(t, ROP_MOVE, local, rk(t, top, line), 0, line);
+            t.stack[local] = { false, local };
+            offset += 2;
+            continue;
+        }
+        case OP_NIL:
+            push_literal(t, 0, nil_val());
+            break;
+        case OP_FALSE:
+            push_literal(t, 1, bool_val(false));
+            break;
+        case OP_TRUE:
+            push_literal(t, 2, bool_val(true));
+            break;
+        case OP_POP:
+            if (t.depth == 0)
+                return false;
+            t.depth--;
+            break;
+        case OP_NOT:
+        case OP_NEGATE:
+        case OP_NEGATE_NUM:
+        case OP_NEGATE_F64:
+            if (t.depth < 1)
+                return false;
+            op = instruction == OP_NOT ? ROP_NOT : instruction == OP_NEGATE_F64 ? ROP_NEGATE_F64 : ROP_NEGATE;
+            emit(t, op, top, rk(t, top, line), 0, line);
+            t.stack[top] = { false, top };
+            break;
+        case OP_RETURN:
+            if (t.depth < 1 || offset + 1 != chunk.count)
+                return false;
+            emit(t, ROP_RETURN, 0, rk(t, top, line), 0, line);
+            return !t.failed;
+        default:
+        {
+            if (!binary_reg_op(instruction, op) || t.depth < 2)
+                return false;
+            int b = rk(t, top - 1, line);
+            int c = rk(t, top, line);
+            emit(t, op, top - 1, b, c, line);
+            t.stack[top - 1] = { false, top - 1 };
+            t.depth--;
+            break;
+        }
+        }
+        offset++;
+    }
+    return false;
+}
+
+bool compile_registers(const Chunk& chunk, RegChunk& registers)
+{
+    init_reg_chunk(registers);
+    for (int i = 0; i < chunk.constants.count; i++)
+        write_value_array(registers.constants, chunk.constants.values[i]);
+
+    Translation t;
+    t.chunk = &chunk;
+    t.out = &registers;
+    t.depth = 0;
+    t.literals[0] = t.literals[1] = t.literals[2] = -1;
+    t.failed = false;
+
+    if (!translate(t) || registers.constants.count > UINT16_MAX + 1)
+    {
+        free_reg_chunk(registers);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "common.h"
+#include "chunk.h"
+#include "value.h"
+
+// Register form of a chunk. Each instruction is one 32-bit word holding an
+// opcode and three 8-bit operands, A, B and C:
+//
+//   ROP_ADD      A B C    R(A) = RK(B) + RK(C)
+//   ROP_NEGATE   A B      R(A) = -RK(B)
+//   ROP_MOVE     A B      R(A) = RK(B)
+//   ROP_LOADK    A BC     R(A) = K(BC), for constants RK cannot reach
+//   ROP_RETURN     B      print RK(B)
+//
+// Registers are the VM's stack slots. An RK operand with RK_CONSTANT set
+// reads a constant instead of a register, so literals feed instructions
+// without first being moved anywhere.
+enum RegOp
+{
+    ROP_MOVE,
+    ROP_LOADK,
+    ROP_EQUAL,
+    ROP_GREATER,
+    ROP_LESS,
+    ROP_ADD,
+    ROP_SUBTRACT,
+    ROP_MULTIPLY,
+    ROP_DIVIDE,
+    ROP_NOT,
+    ROP_NEGATE,
+    ROP_RETURN,
+
+    // Unchecked forms, translated from the stack chunk's F64 opcodes.
+    ROP_EQUAL_F64,
+    ROP_GREATER_F64,
+    ROP_LESS_F64,
+    ROP_ADD_F64,
+    ROP_SUBTRACT_F64,
+    ROP_MULTIPLY_F64,
+    ROP_DIVIDE_F64,
+    ROP_NEGATE_F64,
+};
+
+constexpr uint8_t RK_CONSTANT = 0x80;
+constexpr int MAX_REGISTERS = RK_CONSTANT;
+
+constexpr uint32_t encode_reg(RegOp op, uint8_t a, uint8_t b, uint8_t c)
+{
+    return static_cast<uint32_t>(op) | (a << 8) | (b << 16) | (static_cast<uint32_t>(c) << 24);
+}
+
+constexpr RegOp reg_op(uint32_t instruction) { return static_cast<RegOp>(instruction & 0xFF); }
+constexpr uint8_t reg_a(uint32_t instruction) { return (instruction >> 8) & 0xFF; }
+constexpr uint8_t reg_b(uint32_t instruction) { return (instruction >> 16) & 0xFF; }
+constexpr uint8_t reg_c(uint32_t instruction) { return instruction >> 24; }
+constexpr uint16_t reg_bc(uint32_t instruction) { return instruction >> 16; }
+
+struct RegChunk
+{
+    int count;
+    int capacity;
+    uint32_t* code;
+
+    int* lines;
+    ValueArray constants; // the stack chunk's, plus any literals used as RK operands
+    int registers;        // stack slots the code uses
+};
+
+void init_reg_chunk(RegChunk& chunk);
+void free_reg_chunk(RegChunk& chunk);
+
+void write_reg_chunk(RegChunk& chunk, uint32_t instruction, int line);
+
+// The register-allocating backend: translates a compiled chunk into
+// register form. Fails on opcodes it does not handle and on chunks that
+// need more than MAX_REGISTERS registers.
+bool compile_registers(const Chunk& chunk, RegChunk& registers);
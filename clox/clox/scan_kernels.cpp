@@ -0,0 +1,322 @@
+#include <atomic>
+#include <mutex>
+
+#include "scan_kernels.h"
+#include "cpu.h"
+
+#ifdef CLOX_X64
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define NO_SANITIZE_ADDRESS __attribute__((no_sanitize_address))
+#else
+#define NO_SANITIZE_ADDRESS
+#endif
+
+static constexpr bool is_identifier_char(char c)
+{
+    return (c >= 'a' && c <= 'z')
+        || (c >= 'A' && c <= 'Z')
+        || (c >= '0' && c <= '9')
+        || c == '_';
+}
+
+static const char* scalar_skip_whitespace(const char* p, int& line)
+{
+    for (;; p++)
+    {
+        switch (*p)
+        {
+        case '\n':
+            line++;
+            break;
+        case ' ':
+        case '\r':
+        case '\t':
+            break;
+        default:
+            return p;
+        }
+    }
+}
+
+static const char* scalar_skip_comment(const char* p)
+{
+    while (*p != '\n' && *p != '\0')
+        p++;
+    return p;
+}
+
+static const char* scalar_skip_string(const char* p, int& line)
+{
+    while (*p != '"' && *p != '\0')
+    {
+        if (*p == '\n')
+            line++;
+        p++;
+    }
+    return p;
+}
+
+static const char* scalar_skip_identifier(const char* p)
+{
+    while (is_identifier_char(*p))
+        p++;
+    return p;
+}
+
+#ifdef CLOX_X64
+
+static inline int lowest_bit(uint32_t mask)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return static_cast<int>(index);
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+// POPCNT is not part of the x86-64 baseline, so count bits the portable way.
+static inline int count_bits(uint32_t mask)
+{
+    mask = mask - ((mask >> 1) & 0x55555555);
+    mask = (mask & 0x33333333) + ((mask >> 2) & 0x33333333);
+    return static_cast<int>((((mask + (mask >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24);
+}
+
+// Bits of the stop mask up to and including the first stop; newlines that
+// come after the end of the run must not be counted.
+static inline uint32_t before_first(uint32_t stops)
+{
+    return stops == 0 ? ~0u : (stops & (0u - stops)) - 1;
+}
+
+// Each vector kernel loads the aligned block that contains `p` and masks off
+// the bytes in front of it, then walks forward one aligned block at a time.
+
+struct Sse2
+{
+    static constexpr int WIDTH = 16;
+    typedef __m128i Block;
+
+    NO_SANITIZE_ADDRESS static inline Block load(const char* p) { return _mm_load_si128(reinterpret_cast<const __m128i*>(p)); }
+    static inline Block splat(char c) { return _mm_set1_epi8(c); }
+    static inline Block eq(Block a, Block b) { return _mm_cmpeq_epi8(a, b); }
+    static inline Block gt(Block a, Block b) { return _mm_cmpgt_epi8(a, b); }
+    static inline Block either(Block a, Block b) { return _mm_or_si128(a, b); }
+    static inline Block both(Block a, Block b) { return _mm_and_si128(a, b); }
+    static inline uint32_t mask(Block a) { return static_cast<uint32_t>(_mm_movemask_epi8(a)); }
+    static inline uint32_t all() { return 0xFFFF; }
+};
+
+struct Avx2
+{
+    static constexpr int WIDTH = 32;
+    typedef __m256i Block;
+
+    CLOX_TARGET("avx2") NO_SANITIZE_ADDRESS static inline Block load(const char* p) { return _mm256_load_si256(reinterpret_cast<const __m256i*>(p)); }
+    CLOX_TARGET("avx2") static inline Block splat(char c) { return _mm256_set1_epi8(c); }
+    CLOX_TARGET("avx2") static inline Block eq(Block a, Block b) { return _mm256_cmpeq_epi8(a, b); }
+    CLOX_TARGET("avx2") static inline Block gt(Block a, Block b) { return _mm256_cmpgt_epi8(a, b); }
+    CLOX_TARGET("avx2") static inline Block either(Block a, Block b) { return _mm256_or_si256(a, b); }
+    CLOX_TARGET("avx2") static inline Block both(Block a, Block b) { return _mm256_and_si256(a, b); }
+    CLOX_TARGET("avx2") static inline uint32_t mask(Block a) { return static_cast<uint32_t>(_mm256_movemask_epi8(a)); }
+    static inline uint32_t all() { return 0xFFFFFFFF; }
+};
+
+// Signed compares are fine for the ranges below: bytes >= 0x80 are negative
+// and fall outside every ASCII range we test for. The kernels, like load(),
+// are left uninstrumented, since their blocks start before `p` and run past
+// the terminator.
+#define DEFINE_VECTOR_KERNELS(V, PREFIX, TARGET)                                                        \
+    TARGET static inline V::Block PREFIX##_in_range(V::Block bytes, char lo, char hi)                   \
+    {                                                                                                   \
+        return V::both(V::gt(bytes, V::splat(lo - 1)), V::gt(V::splat(hi + 1), bytes));                 \
+    }                                                                                                   \
+                                                                                                        \
+    TARGET static const char* PREFIX##_skip_whitespace(const char* p, int& line)                        \
+    {                                                                                                   \
+        uint32_t offset = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(p) & (V::WIDTH - 1));       \
+        const char* block = p - offset;                                                                 \
+        uint32_t valid = V::all() & (V::all() << offset);                                               \
+        for (;;)                                                                                        \
+        {                                                                                               \
+            V::Block bytes = V::load(block);                                                            \
+            V::Block newline = V::eq(bytes, V::splat('\n'));                                            \
+            V::Block space = V::either(V::either(V::eq(bytes, V::splat(' ')), newline),                 \
+                V::either(V::eq(bytes, V::splat('\t')), V::eq(bytes, V::splat('\r'))));                 \
+            uint32_t stops = ~V::mask(space) & valid;                                                   \
+            line += count_bits(V::mask(newline) & valid & before_first(stops));                         \
+            if (stops != 0)                                                                             \
+                return block + lowest_bit(stops);                                                       \
+            block += V::WIDTH;                                                                          \
+            valid = V::all();                                                                           \
+        }                                                                                               \
+    }                                                                                                   \
+                                                                                                        \
+    TARGET static const char* PREFIX##_skip_comment(const char* p)                                      \
+    {                                                                                                   \
+        uint32_t offset = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(p) & (V::WIDTH - 1));       \
+        const char* block = p - offset;                                                                 \
+        uint32_t valid = V::all() & (V::all() << offset);                                               \
+        for (;;)                                                                                        \
+        {                                                                                               \
+            V::Block bytes = V::load(block);                                                            \
+            V::Block end = V::either(V::eq(bytes, V::splat('\n')), V::eq(bytes, V::splat('\0')));       \
+            uint32_t stops = V::mask(end) & valid;                                                      \
+            if (stops != 0)                                                                             \
+                return block + lowest_bit(stops);                                                       \
+            block += V::WIDTH;                                                                          \
+            valid = V::all();                                                                           \
+        }                                                                                               \
+    }                                                                                                   \
+                                                                                                        \
+    TARGET static const char* PREFIX##_skip_string(const char* p, int& line)                            \
+    {                                                                                                   \
+        uint32_t offset = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(p) & (V::WIDTH - 1));       \
+        const char* block = p - offset;                                                                 \
+        uint32_t valid = V::all() & (V::all() << offset);                                               \
+        for (;;)                                                                                        \
+        {                                                                                               \
+            V::Block bytes = V::load(block);                                                            \
+            V::Block end = V::either(V::eq(bytes, V::splat('"')), V::eq(bytes, V::splat('\0')));        \
+            uint32_t stops = V::mask(end) & valid;                                                      \
+            line += count_bits(V::mask(V::eq(bytes, V::splat('\n'))) & valid & before_first(stops));    \
+            if (stops != 0)                                                                             \
+                return block + lowest_bit(stops);                                                       \
+            block += V::WIDTH;                                                                          \
+            valid = V::all();                                                                           \
+        }                                                                                               \
+    }                                                                                                   \
+                                                                                                        \
+    TARGET static const char* PREFIX##_skip_identifier(const char* p)                                   \
+    {                                                                                                   \
+        uint32_t offset = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(p) & (V::WIDTH - 1));       \
+        const char* block = p - offset;                                                                 \
+        uint32_t valid = V::all() & (V::all() << offset);                                               \
+        for (;;)                                                                                        \
+        {                                                                                               \
+            V::Block bytes = V::load(block);                                                            \
+            V::Block folded = V::either(bytes, V::splat(0x20));                                         \
+            V::Block word = V::either(V::either(PREFIX##_in_range(folded, 'a', 'z'),                    \
+                PREFIX##_in_range(bytes, '0', '9')), V::eq(bytes, V::splat('_')));                      \
+            uint32_t stops = ~V::mask(word) & valid;                                                    \
+            if (stops != 0)                                                                             \
+                return block + lowest_bit(stops);                                                       \
+            block += V::WIDTH;                                                                          \
+            valid = V::all();                                                                           \
+        }                                                                                               \
+    }
+
+DEFINE_VECTOR_KERNELS(Sse2, sse2, NO_SANITIZE_ADDRESS)
+DEFINE_VECTOR_KERNELS(Avx2, avx2, CLOX_TARGET("avx2") NO_SANITIZE_ADDRESS)
+
+#undef DEFINE_VECTOR_KERNELS
+
+#endif // CLOX_X64
+
+static const ScanKernels scalar_kernels = { scalar_skip_whitespace, scalar_skip_comment, scalar_skip_string, scalar_skip_identifier };
+#ifdef CLOX_X64
+static const ScanKernels sse2_kernels = { sse2_skip_whitespace, sse2_skip_comment, sse2_skip_string, sse2_skip_identifier };
+static const ScanKernels avx2_kernels = { avx2_skip_whitespace, avx2_skip_comment, avx2_skip_string, avx2_skip_identifier };
+#endif
+
+static const ScanKernels* kernels_for(ScanKernelSet set)
+{
+    switch (set)
+    {
+#ifdef CLOX_X64
+    case SCAN_AVX2:
+        return &avx2_kernels;
+    case SCAN_SSE2:
+        return &sse2_kernels;
+#endif
+    default:
+        return &scalar_kernels;
+    }
+}
+
+static ScanKernelSet detect_scan_kernel_set()
+{
+    if (cpu_has_avx2())
+        return SCAN_AVX2;
+#ifdef CLOX_X64
+    return SCAN_SSE2;
+#else
+    return SCAN_SCALAR;
+#endif
+}
+
+// Constant-initialized, so scanning from other files' static initializers
+// sees them set. The first query detects the CPU.
+static std::atomic<ScanKernelSet> current_set{ SCAN_SCALAR };
+static std::atomic<const ScanKernels*> current_kernels{ &scalar_kernels };
+static std::once_flag detected;
+
+static void set_kernels(ScanKernelSet set)
+{
+    current_set.store(set, std::memory_order_relaxed);
+    current_kernels.store(kernels_for(set), std::memory_order_relaxed);
+}
+
+static void detect_once()
+{
+    std::call_once(detected, [] { set_kernels(detect_scan_kernel_set()); });
+}
+
+const ScanKernels& scan_kernels()
+{
+    detect_once();
+    return *current_kernels.load(std::memory_order_relaxed);
+}
+
+ScanKernelSet scan_kernel_set()
+{
+    detect_once();
+    return current_set.load(std::memory_order_relaxed);
+}
+
+const char* scan_kernel_set_name(ScanKernelSet set)
+{
+    switch (set)
+    {
+    case SCAN_SCALAR: return "scalar";
+    case SCAN_SSE2: return "sse2";
+    case SCAN_AVX2: return "avx2";
+    }
+    return "unknown";
+}
+
+bool scan_kernel_set_supported(ScanKernelSet set)
+{
+    switch (set)
+    {
+    case SCAN_SCALAR:
+        return true;
+    case SCAN_SSE2:
+#ifdef CLOX_X64
+        return true;
+#else
+        return false;
+#endif
+    case SCAN_AVX2:
+        return cpu_has_avx2();
+    }
+    return false;
+}
+
+bool select_scan_kernel_set(ScanKernelSet set)
+{
+    if (!scan_kernel_set_supported(set))
+        return false;
+
+    detect_once();
+    set_kernels(set);
+    return true;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "common.h"
+
+// Kernels the scanner uses to skip over runs of characters many bytes at a
+// time. All of them rely on the source being NUL-terminated: '\0' always ends
+// a run, and the vector variants only ever load aligned blocks, which cannot
+// cross into an unmapped page past the terminator. Those blocks may still
+// take in bytes on either side of the string, so the vector kernels are not
+// instrumented by AddressSanitizer.
+struct ScanKernels
+{
+    // Returns the first character that is not ' ', '\t', '\r' or '\n',
+    // adding the newlines skipped on the way to `line`.
+    const char* (*skip_whitespace)(const char* p, int& line);
+    // Returns the '\n' or '\0' that ends a line comment.
+    const char* (*skip_comment)(const char* p);
+    // Returns the closing '"' or the terminating '\0' of a string literal,
+    // adding the newlines inside the literal to `line`.
+    const char* (*skip_string)(const char* p, int& line);
+    // Returns the first character that cannot continue an identifier.
+    const char* (*skip_identifier)(const char* p);
+};
+
+enum ScanKernelSet
+{
+    SCAN_SCALAR,
+    SCAN_SSE2,
+    SCAN_AVX2,
+};
+
+// The widest kernel set the CPU supports is selected on first use. A scan
+// keeps the kernels it started with, see ScannerState.
+const ScanKernels& scan_kernels();
+
+ScanKernelSet scan_kernel_set();
+const char* scan_kernel_set_name(ScanKernelSet set);
+bool scan_kernel_set_supported(ScanKernelSet set);
+bool select_scan_kernel_set(ScanKernelSet set);
@@ -1,8 +1,13 @@
+#include <atomic>
 #include <cstdio>
 #include <cstring>
+#include <thread>
+#include <vector>
 
 #include "common.h"
+#include "memory.h"
 #include "scanner.h"
+#include "scan_kernels.h"
 
 static inline bool is_at_end(const ScannerState& state)
 {
@@ -21,6 +26,16 @@ static constexpr bool is_alpha(char c)
         || c == '_';
 }
 
+static constexpr bool is_space(char c)
+{
+    return c == ' ' || c == '\r' || c == '\t' || c == '\n';
+}
+
+// Runs shorter than this are stepped over inline; calling into a vector
+// kernel only pays off once a run is longer than a typical single separator
+// or short identifier.
+static constexpr int INLINE_RUN = 8;
+
 static bool match(ScannerState& state, char expected)
 {
     if (is_at_end(state))
@@ -60,20 +75,17 @@ static void whitespace(ScannerState& state)
         case ' ':
         case '\r':
         case '\t':
-            advance(state);
-            break;
-
         case '\n':
+            if (c == '\n')
+                state.line++;
             advance(state);
-            state.line++;
+            if (is_space(peek(state)))
+                state.current = state.kernels->skip_whitespace(state.current, state.line);
             break;
 
         case '/':
             if (peek_next(state) == '/')
-            {
-                while (peek(state) != '\n' && !is_at_end(state))
-                    advance(state);
-            }
+                state.current = state.kernels->skip_comment(state.current + 2);
             else
                 return;
             break;
@@ -126,7 +138,15 @@ static TokenType identifier_type(const ScannerState& state)
     case 'n': return check_keyword(state, 1, 2, "il", TOKEN_NIL);
     case 'o': return check_keyword(state, 1, 1, "r", TOKEN_OR);
     case 'p': return check_keyword(state, 1, 4, "rint", TOKEN_PRINT);
-    case 'r': return check_keyword(state, 1, 5, "eturn", TOKEN_RETURN);
+    case 'r':
+        if (state.current - state.start > 2 && *(state.start + 1) == 'e') {
+            switch (*(state.start + 2))
+            {
+            case 'a': return check_keyword(state, 3, 1, "d", TOKEN_READ);
+            case 't': return check_keyword(state, 3, 3, "urn", TOKEN_RETURN);
+            }
+        }
+        break;
     case 's': return check_keyword(state, 1, 4, "uper", TOKEN_SUPER);
     case 't':
         if (state.current - state.start > 1) {
@@ -139,6 +159,7 @@ static TokenType identifier_type(const ScannerState& state)
         break;
     case 'v': return check_keyword(state, 1, 2, "ar", TOKEN_VAR);
     case 'w': return check_keyword(state, 1, 4, "hile", TOKEN_WHILE);
+    case 'y': return check_keyword(state, 1, 4, "ield", TOKEN_YIELD);
     }
 
     return TOKEN_IDENTIFIER;
@@ -146,9 +167,14 @@ static TokenType identifier_type(const ScannerState& state)
 
 static Token identifier(ScannerState& state)
 {
-    while (is_alpha(peek(state)) || is_digit(peek(state)))
+    for (int i = 0; i < INLINE_RUN; i++)
+    {
+        if (!is_alpha(peek(state)) && !is_digit(peek(state)))
+            return make_token(state, identifier_type(state));
         advance(state);
+    }
 
+    state.current = state.kernels->skip_identifier(state.current);
     return make_token(state, identifier_type(state));
 }
 
@@ -169,12 +195,7 @@ static Token number(ScannerState& state)
 
 static Token string(ScannerState& state)
 {
-    while (peek(state) != '"' && !is_at_end(state))
-    {
-        if (peek(state) == '\n')
-            state.line++;
-        advance(state);
-    }
+    state.current = state.kernels->skip_string(state.current, state.line);
 
     if (is_at_end(state))
         return error_token(state.line, "Unterminated string");
@@ -188,6 +209,7 @@ void init_scanner_state(ScannerState& state, const char* source)
     state.start = source;
     state.current = source;
     state.line = 1;
+    state.kernels = &scan_kernels();
 }
 
 Token scan_token(ScannerState& state)
@@ -235,3 +257,427 @@ Token scan_token(ScannerState& state)
 
     return error_token(state.line, "unexpected character");
 }
+
+void init_token_buffer(TokenBuffer& buffer)
+{
+    buffer.count = 0;
+    buffer.capacity = 0;
+    buffer.types = nullptr;
+    buffer.offsets = nullptr;
+    buffer.lengths = nullptr;
+    buffer.line_deltas = nullptr;
+
+    buffer.long_delta_count = 0;
+    buffer.long_delta_capacity = 0;
+    buffer.long_deltas = nullptr;
+
+    buffer.error_count = 0;
+    buffer.error_capacity = 0;
+    buffer.errors = nullptr;
+
+    buffer.source = nullptr;
+}
+
+void free_token_buffer(TokenBuffer& buffer)
+{
+    FREE_ARRAY(uint8_t, buffer.types, buffer.capacity);
+    FREE_ARRAY(uint32_t, buffer.offsets, buffer.capacity);
+    FREE_ARRAY(uint32_t, buffer.lengths, buffer.capacity);
+    FREE_ARRAY(uint8_t, buffer.line_deltas, buffer.capacity);
+    FREE_ARRAY(int, buffer.long_deltas, buffer.long_delta_capacity);
+    FREE_ARRAY(const char*, buffer.errors, buffer.error_capacity);
+    init_token_buffer(buffer);
+}
+
+static void resize_token_buffer(TokenBuffer& buffer, int capacity)
+{
+    int old_capacity = buffer.capacity;
+    buffer.capacity = capacity;
+    buffer.types = GROW_ARRAY(buffer.types, uint8_t, old_capacity, buffer.capacity);
+    buffer.offsets = GROW_ARRAY(buffer.offsets, uint32_t, old_capacity, buffer.capacity);
+    buffer.lengths = GROW_ARRAY(buffer.lengths, uint32_t, old_capacity, buffer.capacity);
+    buffer.line_deltas = GROW_ARRAY(buffer.line_deltas, uint8_t, old_capacity, buffer.capacity);
+}
+
+static void add_long_delta(TokenBuffer& buffer, int delta)
+{
+    if (buffer.long_delta_capacity < buffer.long_delta_count + 1)
+    {
+        int old_capacity = buffer.long_delta_capacity;
+        buffer.long_delta_capacity = GROW_CAPACITY(old_capacity);
+        buffer.long_deltas = GROW_ARRAY(buffer.long_deltas, int, old_capacity, buffer.long_delta_capacity);
+    }
+    buffer.long_deltas[buffer.long_delta_count++] = delta;
+}
+
+static uint32_t add_error(TokenBuffer& buffer, const char* message)
+{
+    if (buffer.error_capacity < buffer.error_count + 1)
+    {
+        int old_capacity = buffer.error_capacity;
+        buffer.error_capacity = GROW_CAPACITY(old_capacity);
+        buffer.errors = GROW_ARRAY(buffer.errors, const char*, old_capacity, buffer.error_capacity);
+    }
+    buffer.errors[buffer.error_count] = message;
+    return static_cast<uint32_t>(buffer.error_count++);
+}
+
+static void reset_token_buffer(TokenBuffer& buffer, const char* source)
+{
+    buffer.source = source;
+    buffer.count = 0;
+    buffer.long_delta_count = 0;
+    buffer.error_count = 0;
+}
+
+// Appends the tokens whose lexeme starts in [begin, end) to `buffer`, with
+// line deltas relative to `line`. Stops after TOKEN_EOF if the range reaches
+// the terminator. Returns the line of the last token appended.
+static int scan_range(TokenBuffer& buffer, const char* begin, const char* end, int line)
+{
+    // Typical code averages well over four bytes per token; sizing the
+    // columns up front avoids copying all four of them on every doubling.
+    size_t estimate = static_cast<size_t>(end - begin) / 4 + 8;
+    if (estimate > static_cast<size_t>(buffer.capacity) && estimate < INT32_MAX)
+        resize_token_buffer(buffer, static_cast<int>(estimate));
+
+    ScannerState state = {};
+    init_scanner_state(state, begin);
+    state.line = line;
+
+    const char* source = buffer.source;
+    int count = buffer.count;
+
+    for (;;)
+    {
+        if (buffer.capacity < count + 1)
+            resize_token_buffer(buffer, GROW_CAPACITY(buffer.capacity));
+
+        // The columns live in locals while scanning: the byte-sized stores
+        // below may alias anything, so writing through `buffer` would reload
+        // every pointer after each store.
+        uint8_t* types = buffer.types;
+        uint32_t* offsets = buffer.offsets;
+        uint32_t* lengths = buffer.lengths;
+        uint8_t* line_deltas = buffer.line_deltas;
+        int capacity = buffer.capacity;
+
+        for (; count < capacity; count++)
+        {
+            // Check before and after scanning: the next segment's first token
+            // can be a long string that should not be scanned twice.
+            if (state.current >= end)
+            {
+                buffer.count = count;
+                return line;
+            }
+
+            Token token = scan_token(state);
+            if (state.start >= end)
+            {
+                buffer.count = count;
+                return line;
+            }
+
+            types[count] = static_cast<uint8_t>(token.type);
+            lengths[count] = static_cast<uint32_t>(token.length);
+            if (token.type == TOKEN_ERROR)
+                offsets[count] = add_error(buffer, token.start);
+            else
+                offsets[count] = static_cast<uint32_t>(token.start - source);
+
+            int delta = token.line - line;
+            line = token.line;
+            if (delta < LINE_DELTA_ESCAPE)
+                line_deltas[count] = static_cast<uint8_t>(delta);
+            else
+            {
+                line_deltas[count] = LINE_DELTA_ESCAPE;
+                add_long_delta(buffer, delta);
+            }
+
+            if (token.type == TOKEN_EOF)
+            {
+                buffer.count = count + 1;
+                return line;
+            }
+        }
+    }
+}
+
+bool scan_all(TokenBuffer& buffer, const char* source)
+{
+    size_t length = strlen(source);
+    if (length > UINT32_MAX)
+        return false;
+
+    reset_token_buffer(buffer, source);
+    scan_range(buffer, source, source + length + 1, 1);
+    return true;
+}
+
+// Lexical context tracked by the speculative pass of the parallel scanner.
+// Scanning can only restart at a point that is in LEX_CODE.
+enum LexContext : uint8_t
+{
+    LEX_CODE,
+    LEX_STRING,
+    LEX_COMMENT,
+};
+
+static inline LexContext lex_step(LexContext context, const char* p)
+{
+    switch (context)
+    {
+    case LEX_CODE:
+        if (*p == '"')
+            return LEX_STRING;
+        if (*p == '/' && p[1] == '/')
+            return LEX_COMMENT;
+        return LEX_CODE;
+    case LEX_STRING:
+        return *p == '"' ? LEX_CODE : LEX_STRING;
+    case LEX_COMMENT:
+        return *p == '\n' ? LEX_CODE : LEX_COMMENT;
+    }
+    return context;
+}
+
+// A slice of the source that starts at the beginning of a line. Its context
+// on exit is computed speculatively for both contexts it could be entered in
+// (a line comment always ends at the newline before the slice).
+struct ScanChunk
+{
+    const char* begin;
+    const char* end;
+    LexContext exit_from_code;
+    LexContext exit_from_string;
+    int newlines;
+
+    int first_line;
+    int last_line;
+    TokenBuffer tokens;
+};
+
+// Only quotes, slashes and newlines can change the lexical context.
+static constexpr bool is_context_char(char c)
+{
+    return c == '"' || c == '/' || c == '\n';
+}
+
+static void summarize_chunk(ScanChunk& chunk)
+{
+    LexContext from_code = LEX_CODE;
+    LexContext from_string = LEX_STRING;
+    int newlines = 0;
+
+    for (const char* p = chunk.begin; p < chunk.end; p++)
+    {
+        if (!is_context_char(*p))
+            continue;
+
+        from_code = lex_step(from_code, p);
+        from_string = lex_step(from_string, p);
+        newlines += *p == '\n';
+    }
+
+    chunk.exit_from_code = from_code;
+    chunk.exit_from_string = from_string;
+    chunk.newlines = newlines;
+}
+
+// Runs `fn(i)` for every i in [0, count) on up to `threads` threads, the
+// calling thread included.
+template<typename TFn>
+static void run_parallel(int count, int threads, TFn fn)
+{
+    std::atomic<int> next(0);
+    auto worker = [&]() {
+        for (int i; (i = next.fetch_add(1)) < count;)
+            fn(i);
+    };
+
+    std::vector<std::thread> pool;
+    for (int t = 1; t < threads && t < count; t++)
+        pool.emplace_back(worker);
+    worker();
+    for (std::thread& thread : pool)
+        thread.join();
+}
+
+static int first_line_delta(const TokenBuffer& tokens)
+{
+    uint8_t delta = tokens.line_deltas[0];
+    return delta != LINE_DELTA_ESCAPE ? delta : tokens.long_deltas[0];
+}
+
+// Concatenates the per-segment buffers into `buffer`. Offsets are already
+// relative to the whole source; error indices are rebased and the first line
+// delta of every segment is re-encoded against the segment before it.
+static void stitch_segments(TokenBuffer& buffer, std::vector<ScanChunk>& segments)
+{
+    int total = 0;
+    for (const ScanChunk& segment : segments)
+        total += segment.tokens.count;
+
+    if (buffer.capacity < total)
+        resize_token_buffer(buffer, total);
+
+    int count = 0;
+    int previous_line = 1;
+    for (ScanChunk& segment : segments)
+    {
+        TokenBuffer& tokens = segment.tokens;
+        if (tokens.count == 0)
+            continue;
+
+        memcpy(buffer.types + count, tokens.types, tokens.count * sizeof(uint8_t));
+        memcpy(buffer.offsets + count, tokens.offsets, tokens.count * sizeof(uint32_t));
+        memcpy(buffer.lengths + count, tokens.lengths, tokens.count * sizeof(uint32_t));
+        memcpy(buffer.line_deltas + count, tokens.line_deltas, tokens.count * sizeof(uint8_t));
+
+        uint32_t error_base = static_cast<uint32_t>(buffer.error_count);
+        for (int i = 0; i < tokens.error_count; i++)
+            add_error(buffer, tokens.errors[i]);
+        if (error_base != 0 && tokens.error_count != 0)
+        {
+            for (int i = 0; i < tokens.count; i++)
+                if (tokens.types[i] == TOKEN_ERROR)
+                    buffer.offsets[count + i] += error_base;
+        }
+
+        int first_delta = first_line_delta(tokens);
+        int delta = segment.first_line + first_delta - previous_line;
+        int skip = tokens.line_deltas[0] == LINE_DELTA_ESCAPE ? 1 : 0;
+        if (delta < LINE_DELTA_ESCAPE)
+            buffer.line_deltas[count] = static_cast<uint8_t>(delta);
+        else
+        {
+            buffer.line_deltas[count] = LINE_DELTA_ESCAPE;
+            add_long_delta(buffer, delta);
+        }
+        for (int i = skip; i < tokens.long_delta_count; i++)
+            add_long_delta(buffer, tokens.long_deltas[i]);
+
+        count += tokens.count;
+        previous_line = segment.last_line;
+    }
+
+    buffer.count = count;
+}
+
+bool scan_all_parallel(TokenBuffer& buffer, const char* source, int threads, size_t min_segment)
+{
+    size_t length = strlen(source);
+    if (length > UINT32_MAX)
+        return false;
+
+    if (threads <= 0)
+        threads = static_cast<int>(std::thread::hardware_concurrency());
+    if (min_segment == 0)
+        min_segment = 1;
+
+    size_t chunk_count = length / min_segment;
+    if (chunk_count > static_cast<size_t>(threads))
+        chunk_count = static_cast<size_t>(threads);
+    if (chunk_count <= 1)
+        return scan_all(buffer, source);
+
+    // Cut the source into roughly equal chunks, each starting right after a newline.
+    std::vector<ScanChunk> chunks;
+    const char* begin = source;
+    const char* source_end = source + length;
+    for (size_t i = 1; i <= chunk_count && begin < source_end; i++)
+    {
+        const char* end = source_end;
+        if (i < chunk_count)
+        {
+            const char* target = source + length / chunk_count * i;
+            if (target < begin)
+                target = begin;
+            const char* newline = static_cast<const char*>(memchr(target, '\n', source_end - target));
+            end = newline != nullptr ? newline + 1 : source_end;
+        }
+
+        ScanChunk chunk = {};
+        chunk.begin = begin;
+        chunk.end = end;
+        chunks.push_back(chunk);
+        begin = end;
+    }
+
+    run_parallel(static_cast<int>(chunks.size()), threads, [&](int i) {
+        summarize_chunk(chunks[i]);
+    });
+
+    // Resolve the speculation front to back. A chunk entered inside a string
+    // literal cannot be scanned on its own and is merged into its predecessor.
+    std::vector<ScanChunk> segments;
+    LexContext context = LEX_CODE;
+    int line = 1;
+    for (ScanChunk& chunk : chunks)
+    {
+        if (context == LEX_CODE || segments.empty())
+        {
+            chunk.first_line = line;
+            segments.push_back(chunk);
+        }
+        else
+            segments.back().end = chunk.end;
+
+        context = context == LEX_STRING ? chunk.exit_from_string : chunk.exit_from_code;
+        line += chunk.newlines;
+    }
+
+    // The last segment runs up to and including the terminator so it picks up TOKEN_EOF.
+    segments.back().end = source_end + 1;
+
+    run_parallel(static_cast<int>(segments.size()), threads, [&](int i) {
+        ScanChunk& segment = segments[i];
+        init_token_buffer(segment.tokens);
+        reset_token_buffer(segment.tokens, source);
+        segment.last_line = scan_range(segment.tokens, segment.begin, segment.end, segment.first_line);
+    });
+
+    reset_token_buffer(buffer, source);
+    stitch_segments(buffer, segments);
+
+    for (ScanChunk& segment : segments)
+        free_token_buffer(segment.tokens);
+    return true;
+}
+
+void init_token_cursor(TokenCursor& cursor, const TokenBuffer& buffer)
+{
+    cursor.buffer = &buffer;
+    cursor.index = 0;
+    cursor.line = 1;
+    cursor.long_delta_index = 0;
+}
+
+Token next_token(TokenCursor& cursor)
+{
+    const TokenBuffer& buffer = *cursor.buffer;
+
+    // The final EOF is handed out again if the parser reads past it,
+    // without applying its line delta a second time.
+    int index = cursor.index;
+    if (index < buffer.count)
+    {
+        uint8_t delta = buffer.line_deltas[index];
+        cursor.line += delta != LINE_DELTA_ESCAPE ? delta : buffer.long_deltas[cursor.long_delta_index++];
+        cursor.index++;
+    }
+    else
+        index = buffer.count - 1;
+
+    Token token;
+    token.type = static_cast<TokenType>(buffer.types[index]);
+    token.length = static_cast<int>(buffer.lengths[index]);
+    token.line = cursor.line;
+    if (token.type == TOKEN_ERROR)
+        token.start = buffer.errors[buffer.offsets[index]];
+    else
+        token.start = buffer.source + buffer.offsets[index];
+    return token;
+}
@@ -1,5 +1,7 @@
 #pragma once
 
+#include "common.h"
+
 enum TokenType
 {
     // Single-character tokens.                         
@@ -20,18 +22,21 @@ enum TokenType
     // Keywords.                                        
     TOKEN_AND, TOKEN_CLASS, TOKEN_ELSE, TOKEN_FALSE,
     TOKEN_FOR, TOKEN_FUN, TOKEN_IF, TOKEN_NIL, TOKEN_OR,
-    TOKEN_PRINT, TOKEN_RETURN, TOKEN_SUPER, TOKEN_THIS,
-    TOKEN_TRUE, TOKEN_VAR, TOKEN_WHILE,
+    TOKEN_PRINT, TOKEN_READ, TOKEN_RETURN, TOKEN_SUPER, TOKEN_THIS,
+    TOKEN_TRUE, TOKEN_VAR, TOKEN_WHILE, TOKEN_YIELD,
 
     TOKEN_ERROR,
     TOKEN_EOF
 };
 
+struct ScanKernels;
+
 struct ScannerState
 {
     const char* start;
     const char* current;
     int line;
+    const ScanKernels* kernels; // see scan_kernels.h
 };
 
 struct Token
@@ -43,4 +48,65 @@ struct Token
 };
 
 void init_scanner_state(ScannerState& state, const char* source);
-Token scan_token(ScannerState& state);
\ No newline at end of file
+Token scan_token(ScannerState& state);
+
+// Every token of a source, scanned up front and stored column-wise. Offsets
+// are relative to `source`; for TOKEN_ERROR the offset indexes `errors`
+// instead. Lines are delta-encoded against the previous token, with
+// LINE_DELTA_ESCAPE marking deltas stored in `long_deltas`.
+struct TokenBuffer
+{
+    int count;
+    int capacity;
+    uint8_t* types;
+    uint32_t* offsets;
+    uint32_t* lengths;
+    uint8_t* line_deltas;
+
+    int long_delta_count;
+    int long_delta_capacity;
+    int* long_deltas;
+
+    int error_count;
+    int error_capacity;
+    const char** errors;
+
+    const char* source;
+};
+
+constexpr uint8_t LINE_DELTA_ESCAPE = UINT8_MAX;
+
+void init_token_buffer(TokenBuffer& buffer);
+void free_token_buffer(TokenBuffer& buffer);
+
+// Scans `source` up to and including TOKEN_EOF, replacing whatever the buffer
+// held before so its storage can be reused. Fails if the source is too large
+// for 32-bit offsets.
+bool scan_all(TokenBuffer& buffer, const char* source);
+
+// Produces exactly what scan_all() does, but splits large sources into
+// segments that are scanned on up to `threads` threads (0 picks one per
+// hardware thread). Sources shorter than two segments are scanned on the
+// calling thread.
+constexpr size_t PARALLEL_SCAN_MIN_SEGMENT = 1 << 20;
+bool scan_all_parallel(TokenBuffer& buffer, const char* source, int threads = 0, size_t min_segment = PARALLEL_SCAN_MIN_SEGMENT);
+
+// Walks a TokenBuffer front to back, decoding line numbers on the way.
+struct TokenCursor
+{
+    const TokenBuffer* buffer;
+    int index;
+    int line;
+    int long_delta_index;
+};
+
+void init_token_cursor(TokenCursor& cursor, const TokenBuffer& buffer);
+Token next_token(TokenCursor& cursor);
+
+inline TokenType peek_token_type(const TokenCursor& cursor, int distance)
+{
+    int index = cursor.index + distance;
+    if (index >= cursor.buffer->count)
+        return TOKEN_EOF;
+    return static_cast<TokenType>(cursor.buffer->types[index]);
+}
\ No newline at end of file
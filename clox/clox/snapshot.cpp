@@ -0,0 +1,477 @@
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+
+#ifdef _WIN32
+#include <cstdlib>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "snapshot.h"
+#include "globals.h"
+#include "intern.h"
+#include "memory.h"
+#include "object.h"
+#include "output.h"
+#include "vm.h"
+
+static const char SNAPSHOT_MAGIC[8] = { 'c', 'l', 'o', 'x', 's', 'n', 'a', 'p' };
+static constexpr uint32_t SNAPSHOT_VERSION = 3;
+static constexpr size_t SNAPSHOT_ALIGN = 16;
+
+struct SnapshotHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t chunk_count;
+    uint64_t size;
+    uint32_t value_size;
+    uint32_t string_size;
+    uint64_t global_names;  // the VM's defined globals, as string Values
+    uint64_t global_values; // their values, in the same order
+    uint32_t global_count;
+};
+
+// Offsets are from the start of the image.
+struct SnapshotChunk
+{
+    int32_t count;
+    int32_t constant_count;
+    uint64_t code;
+    uint64_t lines;
+    uint64_t constants;
+    uint64_t globals; // the names of the globals the code uses, as string Values
+    int32_t global_count;
+};
+
+static size_t append(Output& image, const void* data, size_t size)
+{
+    static const char padding[SNAPSHOT_ALIGN] = {};
+    size_t offset = (image.count + SNAPSHOT_ALIGN - 1) & ~(SNAPSHOT_ALIGN - 1);
+    if (offset > image.count)
+        write_output(image, padding, offset - image.count);
+    if (size > 0)
+        write_output(image, static_cast<const char*>(data), size);
+    return offset;
+}
+
+// An ObjString record followed by its characters, with the characters'
+// offset stored in place of the pointer.
+static size_t append_string(Output& image, const ObjString* string)
+{
+    ObjString record = *string;
+    record.obj.next = nullptr;
+    record.chars = nullptr;
+    size_t offset = append(image, &record, sizeof(record));
+    write_output(image, string->chars, static_cast<size_t>(string->length) + 1);
+
+    char* chars = reinterpret_cast<char*>(offset + sizeof(ObjString));
+    memcpy(image.buffer + offset + offsetof(ObjString, chars), &chars, sizeof(chars));
+    return offset;
+}
+
+// An array of values followed by the strings they point to, with the
+// strings' offsets stored in place of the pointers.
+static size_t append_values(Output& image, const Value* values, int count)
+{
+    size_t offset = append(image, values, sizeof(Value) * static_cast<size_t>(count));
+    for (int i = 0; i < count; i++)
+    {
+        Value value = values[i];
+        if (!is_obj(value))
+            continue;
+        value.obj = reinterpret_cast<Obj*>(append_string(image, as_string(value)));
+        memcpy(image.buffer + offset + sizeof(Value) * static_cast<size_t>(i), &value, sizeof(Value));
+    }
+    return offset;
+}
+
+bool save_snapshot(const char* path, const VM& vm, const Chunk* chunks, int count)
+{
+    Output image;
+    init_output_memory(image);
+
+    SnapshotHeader header = {};
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.chunk_count = static_cast<uint32_t>(count);
+    header.size = 0;
+    header.value_size = sizeof(Value);
+    header.string_size = sizeof(ObjString);
+    append(image, &header, sizeof(header));
+
+    SnapshotChunk empty = {};
+    size_t table = 0;
+    for (int i = 0; i < count; i++)
+    {
+        size_t offset = append(image, &empty, sizeof(empty));
+        if (i == 0)
+            table = offset;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        const Chunk& chunk = chunks[i];
+        SnapshotChunk entry = {};
+        entry.count = chunk.count;
+        entry.constant_count = chunk.constants.count;
+        entry.global_count = chunk.globals.count;
+        entry.code = append(image, chunk.code, static_cast<size_t>(chunk.count));
+        // Quickening reflects the types this process happened to see; the
+        // image gets the generic opcodes back.
+        for (int offset = 0; offset < chunk.count; offset += instruction_length(chunk.code[offset]))
+            image.buffer[entry.code + static_cast<size_t>(offset)] = static_cast<char>(generic_opcode(chunk.code[offset]));
+        entry.lines = append(image, chunk.lines, sizeof(int) * static_cast<size_t>(chunk.count));
+        entry.constants = append_values(image, chunk.constants.values, chunk.constants.count);
+        entry.globals = append_values(image, chunk.globals.values, chunk.globals.count);
+        memcpy(image.buffer + table + sizeof(SnapshotChunk) * i, &entry, sizeof(entry));
+    }
+
+    // Globals that were never defined are left out: a VM that loads the
+    // image numbers their names when it links a chunk that uses them.
+    ValueArray names;
+    ValueArray values;
+    init_value_array(names);
+    init_value_array(values);
+    const Table& slots = vm.globals.slots;
+    for (int i = 0; i < slots.capacity; i++)
+    {
+        const Entry& entry = slots.entries[i];
+        if (entry.key == nullptr)
+            continue;
+        Value value = vm.globals.values[static_cast<int>(as_number(entry.value))];
+        if (is_undefined(value))
+            continue;
+        write_value_array(names, obj_val(entry.key));
+        write_value_array(values, value);
+    }
+    header.global_count = static_cast<uint32_t>(names.count);
+    header.global_names = append_values(image, names.values, names.count);
+    header.global_values = append_values(image, values.values, values.count);
+    free_value_array(names);
+    free_value_array(values);
+
+    header.size = image.count;
+    memcpy(image.buffer, &header, sizeof(header));
+
+    FILE* file = fopen(path, "wb");
+    bool written = file && fwrite(image.buffer, 1, image.count, file) == image.count;
+    if (file && fclose(file) != 0)
+        written = false;
+    free_output(image);
+    return written;
+}
+
+static char* map_image(const char* path, size_t& size)
+{
+#ifdef _WIN32
+    FILE* file = fopen(path, "rb");
+    if (!file)
+        return nullptr;
+    fseek(file, 0L, SEEK_END);
+    long file_size = ftell(file);
+    rewind(file);
+    char* image = file_size > 0 ? static_cast<char*>(malloc(static_cast<size_t>(file_size))) : nullptr;
+    if (image && fread(image, 1, static_cast<size_t>(file_size), file) != static_cast<size_t>(file_size))
+    {
+        free(image);
+        image = nullptr;
+    }
+    fclose(file);
+    size = static_cast<size_t>(file_size);
+    return image;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return nullptr;
+    struct stat info;
+    void* image = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && info.st_size > 0)
+    {
+        size = static_cast<size_t>(info.st_size);
+        // Private and writable: relocation writes to our copy of the pages
+        // it touches and never to the file.
+        image = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    return image == MAP_FAILED ? nullptr : static_cast<char*>(image);
+#endif
+}
+
+static void unmap_image(char* image, size_t size)
+{
+#ifdef _WIN32
+    (void)size;
+    free(image);
+#else
+    munmap(image, size);
+#endif
+}
+
+static bool in_image(const Snapshot& snapshot, uint64_t offset, uint64_t size)
+{
+    return offset <= snapshot.size && size <= snapshot.size - offset;
+}
+
+// Reads an enum or bool field as raw bytes: a corrupt image may hold a
+// value outside the type's range, which must not be loaded as the type.
+static uint32_t raw_field(const void* field, size_t size)
+{
+    uint32_t raw = 0;
+    memcpy(&raw, field, size < sizeof(raw) ? size : sizeof(raw));
+    return raw;
+}
+
+static bool relocate_string(Snapshot& snapshot, Value& value)
+{
+    uint64_t offset = reinterpret_cast<uintptr_t>(value.obj);
+    if (offset % alignof(ObjString) != 0 || !in_image(snapshot, offset, sizeof(ObjString)))
+        return false;
+
+    ObjString* string = reinterpret_cast<ObjString*>(snapshot.image + offset);
+    uint64_t chars = reinterpret_cast<uintptr_t>(string->chars);
+    if (raw_field(&string->obj.type, sizeof(ObjType)) != OBJ_STRING ||
+        raw_field(&string->interned, sizeof(bool)) > 1 || string->length < 0 ||
+        !in_image(snapshot, chars, static_cast<uint64_t>(string->length) + 1))
+        return false;
+
+    string->chars = snapshot.image + chars;
+    // Hashed now, like a Program's constants: the chunks are shared, and a
+    // lazy hash would be written by whichever thread first needed it.
+    if (string->interned)
+        string = intern_string(string->chars, string->length);
+    else
+        string->hash = hash_string(string->chars, string->length);
+    value = obj_val(string);
+    return true;
+}
+
+static bool relocate_value(Snapshot& snapshot, Value& value)
+{
+    switch (raw_field(&value.type, sizeof(ValueType)))
+    {
+    case VAL_NIL:
+    case VAL_NUMBER:
+        return true;
+    case VAL_BOOL:
+        return raw_field(&value.boolean, sizeof(bool)) <= 1;
+    case VAL_OBJ:
+        return relocate_string(snapshot, value);
+    default:
+        return false;
+    }
+}
+
+// Checks that run() can execute the code without reading outside it or its
+// stack: every instruction is whole, constant, global and local operands
+// are in range, jumps land on instructions, and every path through the code
+// keeps the stack between empty and STACK_MAX, with the same depth wherever
+// paths meet, and ends in OP_RETURN or OP_HALT.
+static bool valid_code(const Chunk& chunk)
+{
+    if (chunk.count == 0)
+        return false;
+
+    // The depth of the stack before each instruction: -2 until a path
+    // reaches it, and -1 inside an instruction, where no jump may land.
+    int* depths = ALLOCATE(int, chunk.count);
+    int* pending = ALLOCATE(int, chunk.count);
+    bool valid = true;
+    for (int offset = 0; offset < chunk.count; offset++)
+        depths[offset] = -1;
+    for (int offset = 0; valid && offset < chunk.count; offset += instruction_length(chunk.code[offset]))
+    {
+        depths[offset] = -2;
+        valid = chunk.code[offset] <= OP_NEGATE_F64 && offset + instruction_length(chunk.code[offset]) <= chunk.count;
+    }
+
+    int pending_count = 0;
+    depths[0] = 0;
+    pending[pending_count++] = 0;
+    while (valid && pending_count > 0)
+    {
+        int offset = pending[--pending_count];
+        uint8_t op = chunk.code[offset];
+        const uint8_t* operands = chunk.code + offset + 1;
+        int depth = depths[offset];
+        int pops;
+        int pushes;
+        stack_effect(op, pops, pushes);
+        valid = pops <= depth && depth - pops + pushes <= STACK_MAX;
+
+        int next = offset + instruction_length(op);
+        int successors[2] = { next, -1 };
+        int successor_count = 1;
+        switch (op)
+        {
+        case OP_CONSTANT:
+            valid = valid && operands[0] < chunk.constants.count;
+            break;
+        case OP_GET_LOCAL:
+        case OP_SET_LOCAL:
+            valid = valid && operands[0] < depth;
+            break;
+        case OP_GET_GLOBAL:
+        case OP_SET_GLOBAL:
+        case OP_DEFINE_GLOBAL:
+            valid = valid && (operands[0] << 8 | operands[1]) < chunk.globals.count;
+            break;
+        case OP_JUMP_IF_FALSE:
+            successors[successor_count++] = next + (operands[0] << 8 | operands[1]);
+            break;
+        case OP_JUMP:
+            successors[0] = next + (operands[0] << 8 | operands[1]);
+            break;
+        case OP_LOOP:
+            successors[0] = next - (operands[0] << 8 | operands[1]);
+            break;
+        case OP_RETURN:
+        case OP_HALT:
+            successor_count = 0;
+            break;
+        default:
+            break;
+        }
+
+        for (int i = 0; valid && i < successor_count; i++)
+        {
+            int target = successors[i];
+            valid = target >= 0 && target < chunk.count && depths[target] != -1;
+            if (valid && depths[target] == -2)
+            {
+                depths[target] = depth - pops + pushes;
+                pending[pending_count++] = target;
+            }
+            else
+                valid = valid && depths[target] == depth - pops + pushes;
+        }
+    }
+
+    FREE_ARRAY(int, depths, chunk.count);
+    FREE_ARRAY(int, pending, chunk.count);
+    return valid;
+}
+
+// The names of globals are interned, so they are the process's own strings.
+static bool relocate_name(Snapshot& snapshot, Value& name)
+{
+    return raw_field(&name.type, sizeof(ValueType)) == VAL_OBJ &&
+        relocate_string(snapshot, name) && as_string(name)->interned;
+}
+
+static bool relocate_chunk(Snapshot& snapshot, const SnapshotChunk& entry, Chunk& chunk)
+{
+    if (entry.count < 0 || entry.constant_count < 0 || entry.global_count < 0 || entry.global_count > GLOBALS_MAX ||
+        !in_image(snapshot, entry.code, static_cast<uint64_t>(entry.count)) ||
+        entry.lines % alignof(int) != 0 || entry.constants % alignof(Value) != 0 || entry.globals % alignof(Value) != 0 ||
+        !in_image(snapshot, entry.lines, sizeof(int) * static_cast<uint64_t>(entry.count)) ||
+        !in_image(snapshot, entry.constants, sizeof(Value) * static_cast<uint64_t>(entry.constant_count)) ||
+        !in_image(snapshot, entry.globals, sizeof(Value) * static_cast<uint64_t>(entry.global_count)))
+        return false;
+
+    init_chunk(chunk);
+    chunk.count = chunk.capacity = entry.count;
+    chunk.code = reinterpret_cast<uint8_t*>(snapshot.image + entry.code);
+    chunk.lines = reinterpret_cast<int*>(snapshot.image + entry.lines);
+    chunk.constants.count = chunk.constants.capacity = entry.constant_count;
+    chunk.constants.values = reinterpret_cast<Value*>(snapshot.image + entry.constants);
+    chunk.globals.count = chunk.globals.capacity = entry.global_count;
+    chunk.globals.values = reinterpret_cast<Value*>(snapshot.image + entry.globals);
+    chunk.shared = true;
+
+    for (int i = 0; i < chunk.constants.count; i++)
+    {
+        if (!relocate_value(snapshot, chunk.constants.values[i]))
+            return false;
+    }
+    for (int i = 0; i < chunk.globals.count; i++)
+    {
+        if (!relocate_name(snapshot, chunk.globals.values[i]))
+            return false;
+    }
+    return valid_code(chunk);
+}
+
+// Gives the VM the saved globals, numbering their names in its table.
+// Nothing changes in the VM unless all of them are valid.
+static bool restore_globals(Snapshot& snapshot, const SnapshotHeader& header, VM& vm)
+{
+    uint64_t size = sizeof(Value) * static_cast<uint64_t>(header.global_count);
+    if (header.global_names % alignof(Value) != 0 || header.global_values % alignof(Value) != 0 ||
+        !in_image(snapshot, header.global_names, size) || !in_image(snapshot, header.global_values, size))
+        return false;
+
+    Value* names = reinterpret_cast<Value*>(snapshot.image + header.global_names);
+    Value* values = reinterpret_cast<Value*>(snapshot.image + header.global_values);
+    for (uint32_t i = 0; i < header.global_count; i++)
+    {
+        if (!relocate_name(snapshot, names[i]) || !relocate_value(snapshot, values[i]))
+            return false;
+    }
+    for (uint32_t i = 0; i < header.global_count; i++)
+    {
+        int slot = global_slot(vm.globals, as_string(names[i]));
+        vm.globals.values[slot] = values[i];
+    }
+    return true;
+}
+
+Snapshot* load_snapshot(const char* path, VM& vm)
+{
+    size_t size = 0;
+    char* image = map_image(path, size);
+    if (image == nullptr)
+        return nullptr;
+
+    SnapshotHeader header;
+    // The chunk table follows the header at the next aligned offset.
+    size_t table = (sizeof(header) + SNAPSHOT_ALIGN - 1) & ~(SNAPSHOT_ALIGN - 1);
+    if (size < table)
+    {
+        unmap_image(image, size);
+        return nullptr;
+    }
+    memcpy(&header, image, sizeof(header));
+    if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0 || header.version != SNAPSHOT_VERSION ||
+        header.size != size || header.value_size != sizeof(Value) || header.string_size != sizeof(ObjString) ||
+        header.chunk_count > (size - table) / sizeof(SnapshotChunk))
+    {
+        unmap_image(image, size);
+        return nullptr;
+    }
+
+    Snapshot* snapshot = ALLOCATE(Snapshot, 1);
+    snapshot->image = image;
+    snapshot->size = size;
+    snapshot->chunk_count = static_cast<int>(header.chunk_count);
+    snapshot->chunks = ALLOCATE(Chunk, snapshot->chunk_count);
+
+    for (int i = 0; i < snapshot->chunk_count; i++)
+    {
+        SnapshotChunk entry;
+        memcpy(&entry, image + table + sizeof(entry) * i, sizeof(entry));
+        if (!relocate_chunk(*snapshot, entry, snapshot->chunks[i]))
+        {
+            free_snapshot(snapshot);
+            return nullptr;
+        }
+    }
+
+    if (!restore_globals(*snapshot, header, vm))
+    {
+        free_snapshot(snapshot);
+        return nullptr;
+    }
+    return snapshot;
+}
+
+void free_snapshot(Snapshot* snapshot)
+{
+    unmap_image(snapshot->image, snapshot->size);
+    FREE_ARRAY(Chunk, snapshot->chunks, snapshot->chunk_count);
+    FREE(Snapshot, snapshot);
+}
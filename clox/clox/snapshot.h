@@ -0,0 +1,36 @@
+#pragma once
+
+#include "chunk.h"
+
+struct VM;
+
+// A VM's warm state saved to a file: chunks, their constant pools, the
+// names of the globals they use, the VM's global variables and the strings
+// all of those point to. The image holds offsets where the heap holds
+// pointers, so it can be mapped at any address; loading maps the file and
+// relocates the offsets in place, without reading or copying the code.
+//
+// Interned strings are re-interned on load, so they stay pointer-equal to
+// the process's own. Other strings live in the mapping and are rehashed,
+// since this process may hash differently. Chunks name their globals, so
+// their code runs on any VM unchanged (see globals.h), and loading gives
+// the saved globals to a VM, numbering their names in its table. Images
+// are only read by builds with the same Value and ObjString layout.
+
+struct Snapshot
+{
+    char* image; // the mapped file
+    size_t size;
+    int chunk_count;
+    Chunk* chunks; // shared and read only, like a Program's
+};
+
+// Saves the chunks and the globals the VM has defined.
+bool save_snapshot(const char* path, const VM& vm, const Chunk* chunks, int count);
+
+// Returns nullptr, leaving the VM as it was, if the file cannot be read or
+// is not a valid image. Otherwise the saved globals are defined in the VM.
+// Their values, like the chunks' constants, may point into the image.
+Snapshot* load_snapshot(const char* path, VM& vm);
+// Unmaps the image. Nothing may use its chunks or strings afterwards.
+void free_snapshot(Snapshot* snapshot);
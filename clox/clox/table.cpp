@@ -6,6 +6,8 @@
 #include "object.h"
 #include "value.h"
 
+static constexpr double TABLE_MAX_LOAD = 0.75;
+
 void init_table(Table& table)
 {
     table.count = 0;
@@ -18,3 +20,135 @@ void free_table(Table& table)
     FREE_ARRAY(Entry, table.entries, table.capacity);
     init_table(table);
 }
+
+static inline bool is_tombstone(const Entry& entry)
+{
+    return entry.key == nullptr && !is_nil(entry.value);
+}
+
+static Entry* find_entry(Entry* entries, int capacity, ObjString* key)
+{
+    uint32_t index = string_hash(key) & (capacity - 1);
+    Entry* tombstone = nullptr;
+
+    for (;;)
+    {
+        Entry* entry = &entries[index];
+        if (entry->key == key)
+            return entry;
+
+        if (entry->key == nullptr)
+        {
+            if (!is_tombstone(*entry))
+                return tombstone != nullptr ? tombstone : entry;
+            if (tombstone == nullptr)
+                tombstone = entry;
+        }
+
+        index = (index + 1) & (capacity - 1);
+    }
+}
+
+static void adjust_capacity(Table& table, int capacity)
+{
+    Entry* entries = ALLOCATE(Entry, capacity);
+    for (int i = 0; i < capacity; i++)
+    {
+        entries[i].key = nullptr;
+        entries[i].value = nil_val();
+    }
+
+    table.count = 0;
+    for (int i = 0; i < table.capacity; i++)
+    {
+        Entry& entry = table.entries[i];
+        if (entry.key == nullptr)
+            continue;
+
+        Entry* dest = find_entry(entries, capacity, entry.key);
+        dest->key = entry.key;
+        dest->value = entry.value;
+        table.count++;
+    }
+
+    FREE_ARRAY(Entry, table.entries, table.capacity);
+    table.entries = entries;
+    table.capacity = capacity;
+}
+
+bool table_get(const Table& table, ObjString* key, Value& value)
+{
+    if (table.count == 0)
+        return false;
+
+    Entry* entry = find_entry(table.entries, table.capacity, key);
+    if (entry->key == nullptr)
+        return false;
+
+    value = entry->value;
+    return true;
+}
+
+bool table_set(Table& table, ObjString* key, Value value)
+{
+    if (table.count + 1 > table.capacity * TABLE_MAX_LOAD)
+        adjust_capacity(table, GROW_CAPACITY(table.capacity));
+
+    Entry* entry = find_entry(table.entries, table.capacity, key);
+    bool is_new_key = entry->key == nullptr;
+    if (is_new_key && !is_tombstone(*entry))
+        table.count++;
+
+    entry->key = key;
+    entry->value = value;
+    return is_new_key;
+}
+
+bool table_delete(Table& table, ObjString* key)
+{
+    if (table.count == 0)
+        return false;
+
+    Entry* entry = find_entry(table.entries, table.capacity, key);
+    if (entry->key == nullptr)
+        return false;
+
+    // Leave a tombstone so probe sequences running through this slot stay intact.
+    entry->key = nullptr;
+    entry->value = bool_val(true);
+    return true;
+}
+
+void table_add_all(const Table& from, Table& to)
+{
+    for (int i = 0; i < from.capacity; i++)
+    {
+        const Entry& entry = from.entries[i];
+        if (entry.key != nullptr)
+            table_set(to, entry.key, entry.value);
+    }
+}
+
+ObjString* table_find_string(const Table& table, const char* chars, int length, uint32_t hash)
+{
+    if (table.count == 0)
+        return nullptr;
+
+    uint32_t index = hash & (table.capacity - 1);
+    for (;;)
+    {
+        const Entry& entry = table.entries[index];
+        if (entry.key == nullptr)
+        {
+            if (!is_tombstone(entry))
+                return nullptr;
+        }
+        // Keys were hashed when they were inserted, so their hash is set.
+        else if (entry.key->length == length
+            && entry.key->hash == hash
+            && memcmp(entry.key->chars, chars, length) == 0)
+            return entry.key;
+
+        index = (index + 1) & (table.capacity - 1);
+    }
+}
@@ -17,4 +17,10 @@ struct Table
 };
 
 void init_table(Table& table);
-void free_table(Table& table);
\ No newline at end of file
+void free_table(Table& table);
+
+bool table_get(const Table& table, ObjString* key, Value& value);
+bool table_set(Table& table, ObjString* key, Value value);
+bool table_delete(Table& table, ObjString* key);
+void table_add_all(const Table& from, Table& to);
+ObjString* table_find_string(const Table& table, const char* chars, int length, uint32_t hash);
@@ -3,7 +3,9 @@
 
 #include "value.h"
 #include "memory.h"
+#include "number.h"
 #include "object.h"
+#include "output.h"
 
 void init_value_array(ValueArray& valarray)
 {
@@ -47,26 +49,50 @@ bool values_equal(Value a, Value b)
     case VAL_OBJ:
         ObjString* astr = as_string(a);
         ObjString* bstr = as_string(b);
-        return astr->length == bstr->length
-            && memcmp(astr->chars, bstr->chars, astr->length) == 0;
+        if (astr == bstr)
+            return true;
+        // Equal interned strings are one object.
+        if (astr->interned && bstr->interned)
+            return false;
+        if (astr->length != bstr->length)
+            return false;
+        // Reuse hashes that were already computed, but never compute one just for a comparison.
+        if (astr->hash != HASH_UNSET && bstr->hash != HASH_UNSET && astr->hash != bstr->hash)
+            return false;
+        return memcmp(astr->chars, bstr->chars, astr->length) == 0;
     }
 }
 
-void print_value(Value value)
+void write_value(Output& out, Value value)
 {
     switch (value.type)
     {
     case VAL_NIL:
-        printf("nil");
+        write_output(out, "nil", 3);
         break;
     case VAL_BOOL:
-        printf(as_bool(value) ? "true" : "false");
+        if (as_bool(value))
+            write_output(out, "true", 4);
+        else
+            write_output(out, "false", 5);
         break;
     case VAL_NUMBER:
-        printf("%g", as_number(value));
+    {
+        char buffer[NUMBER_BUFFER_SIZE];
+        int length = format_number(as_number(value), buffer);
+        write_output(out, buffer, static_cast<size_t>(length));
         break;
+    }
     case VAL_OBJ:
-        print_object(value);
+        write_object(out, value);
         break;
     }
 }
+
+void print_value(Value value)
+{
+    // Unbuffered, so it interleaves with the printf calls around it.
+    Output out;
+    init_output_file(out, stdout, 0);
+    write_value(out, value);
+}
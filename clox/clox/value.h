@@ -52,6 +52,15 @@ constexpr Value obj_val(TObj* obj)
     return value;
 }
 
+// No program can make this value: it marks global slots that were never
+// defined (see VM::globals) and is never pushed.
+constexpr Value undefined_val()
+{
+    Value value{ VAL_OBJ };
+    value.obj = nullptr;
+    return value;
+}
+
 constexpr bool as_bool(Value value) { return value.boolean; }
 constexpr double as_number(Value value) { return value.number; }
 constexpr Obj* as_obj(Value value) { return value.obj; }
@@ -60,9 +69,14 @@ constexpr bool is_nil(Value value) { return value.type == VAL_NIL; }
 constexpr bool is_bool(Value value) { return value.type == VAL_BOOL; }
 constexpr bool is_number(Value value) { return value.type == VAL_NUMBER; }
 constexpr bool is_obj(Value value) { return value.type == VAL_OBJ; }
+constexpr bool is_undefined(Value value) { return value.type == VAL_OBJ && value.obj == nullptr; }
 
 bool values_equal(Value a, Value b);
 
+struct Output;
+
+void write_value(Output& out, Value value);
+// Writes to stdout; for debugging output only.
 void print_value(Value value);
 
 struct ValueArray
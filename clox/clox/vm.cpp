@@ -1,79 +1,217 @@
+#include <cstddef>
 #include <cstdio>
 #include <cstdarg>
 #include <cstring>
 
 #include "vm.h"
+#include "aio.h"
 #include "common.h"
 #include "compiler.h"
+#include "globals.h"
 #include "object.h"
 #include "debug.h"
+#include "jit.h"
+#include "opt.h"
 
 static inline void reset_stack(VM& vm)
 {
     vm.stack_top = vm.stack;
 }
 
-static inline Value peek(const VM& vm, int distance)
-{
-    return vm.stack_top[-1 - distance];
-}
-
 static constexpr bool is_falsey(Value value)
 {
     return is_nil(value) || (is_bool(value) && !as_bool(value));
 }
 
-static void concatenate(VM& vm)
+static void report_error(VM& vm, int line, const char* format, va_list args)
 {
-    ObjString* b = as_string(pop(vm));
-    ObjString* a = as_string(pop(vm));
+    flush_output(vm.output);
 
-    int length = a->length + b->length;
-    char* chars = ALLOCATE(char, length + 1);
-    memcpy(chars, a->chars, a->length);
-    memcpy(chars + a->length, b->chars, b->length);
-    chars[length] = '\0';
+    vfprintf(stderr, format, args);
+    fputs("\n", stderr);
+    fprintf(stderr, "[line %d] in script\n", line);
 
-    ObjString* result = take_string(vm.objects, chars, length);
-    push(vm, obj_val(result));
+    reset_stack(vm);
 }
 
 static void runtime_error(VM& vm, const char* format, ...)
 {
+    ptrdiff_t instruction = vm.ip - vm.chunk->code - 1;
+
     va_list args;
     va_start(args, format);
-    vfprintf(stderr, format, args);
+    report_error(vm, vm.chunk->lines[static_cast<size_t>(instruction)], format, args);
     va_end(args);
-    fputs("\n", stderr);
-
-    ptrdiff_t instruction = vm.ip - vm.chunk->code;
-    fprintf(stderr, "[line %d] in script\n", vm.chunk->lines[static_cast<size_t>(instruction)]);
+}
 
-    reset_stack(vm);
+// `ip` points past the failing instruction, as vm.ip does.
+static void reg_runtime_error(VM& vm, const RegChunk& chunk, const uint32_t* ip, const char* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    report_error(vm, chunk.lines[ip - chunk.code - 1], format, args);
+    va_end(args);
 }
 
 static inline uint8_t read_byte(VM& vm) { return *vm.ip++; }
 
 static inline Value read_constant(VM& vm) { return vm.chunk->constants.values[read_byte(vm)]; }
 
+static inline uint16_t read_short(VM& vm)
+{
+    vm.ip += 2;
+    return static_cast<uint16_t>(vm.ip[-2] << 8 | vm.ip[-1]);
+}
+
+// Both act on the instruction just read. Shared chunks are never rewritten.
+static inline void quicken(VM& vm, OpCode op)
+{
+    if (vm.chunk->shared)
+        return;
+    vm.ip[-1] = op;
+    vm.quickened++;
+}
+
+// Puts the generic opcode back. run() then dispatches the generic opcode
+// (see DEOPTIMIZE), which handles the operands this time and may quicken
+// again for the new types. A shared chunk loaded with quickened code keeps
+// it, and takes the generic path each time the guard fails.
+static inline void deoptimize(VM& vm, OpCode op)
+{
+    if (vm.chunk->shared)
+        return;
+    vm.ip[-1] = op;
+    vm.deoptimized++;
+}
+
+// The value on top of the stack is kept in `top`, a local the compiler can
+// hold in a register, instead of in vm.stack_top[-1]. `sp` stands in for
+// vm.stack_top and the slot under it is stale: a binary operation reads one
+// operand from memory and stores nothing. The slot is written back where
+// the stack is observed, by slot number or from outside run(). On an empty
+// stack `top` caches vm.stack_base.
+static_assert(offsetof(VM, stack) == offsetof(VM, stack_base) + sizeof(Value), "run() reads stack[-1]");
+
+static inline uint32_t start_slice(const VM& vm)
+{
+    return vm.slice != 0 ? vm.slice : UINT32_MAX;
+}
+
+// Starts the next slice when the budget runs out, on the spilled stack.
+// Returns true if run() should stop; a fiber is switched out instead.
+static bool end_slice(VM& vm)
+{
+    vm.budget = start_slice(vm);
+    if (vm.slice == 0)
+        return false;
+    if (vm.fiber == nullptr)
+        return true;
+    if (vm.io != nullptr)
+        complete_reads(vm, false);
+    switch_fiber(vm);
+    return false;
+}
+
 static InterpretResult run(VM& vm)
 {
-#define BINARY_OP(value_type, op)                               \
+    Value* sp = vm.stack_top;
+    Value top = sp[-1];
+
+#define PUSH(value)                                             \
+	do                                                          \
+	{                                                           \
+        sp[-1] = top;                                           \
+        sp++;                                                   \
+        top = (value);                                          \
+	} while (false)                                             \
+
+#define DROP()                                                  \
+	do                                                          \
+	{                                                           \
+        sp--;                                                   \
+        top = sp[-1];                                           \
+	} while (false)                                             \
+
+#define SPILL()                                                 \
+	do                                                          \
+	{                                                           \
+        sp[-1] = top;                                           \
+        vm.stack_top = sp;                                      \
+	} while (false)                                             \
+
+#define SECOND() (sp[-2])
+
+// Replaces the two values on top with one computed from them.
+#define REPLACE_TWO(value)                                      \
 	do                                                          \
 	{                                                           \
-        if (!is_number(peek(vm, 0)) || !is_number(peek(vm, 1))) \
+        top = (value);                                          \
+        sp--;                                                   \
+	} while (false)                                             \
+
+#define BINARY_OP(value_type, op, quick)                        \
+	do                                                          \
+	{                                                           \
+        if (!is_number(top) || !is_number(SECOND()))            \
         {                                                       \
             runtime_error(vm, "Operands must be numbers.");     \
             return INTERPRET_RUNTIME_ERROR;                     \
         }                                                       \
-		double b = as_number(pop(vm));                          \
-		double a = as_number(pop(vm));                          \
-		push(vm, value_type(a op b));                           \
+        quicken(vm, quick);                                     \
+        REPLACE_TWO(value_type(as_number(SECOND()) op as_number(top))); \
+	} while (false)                                             \
+
+#define BINARY_OP_F64(value_type, op)                           \
+        REPLACE_TWO(value_type(as_number(SECOND()) op as_number(top)))
+
+#define BINARY_OP_NUM(value_type, op, generic)                  \
+	do                                                          \
+	{                                                           \
+        if (!is_number(top) || !is_number(SECOND()))            \
+            DEOPTIMIZE(generic);                                \
+        REPLACE_TWO(value_type(as_number(SECOND()) op as_number(top))); \
+	} while (false)                                             \
+
+// Runs the generic opcode in place of the quickened one just read.
+#define DEOPTIMIZE(generic)                                     \
+	do                                                          \
+	{                                                           \
+        deoptimize(vm, generic);                                \
+        instruction = generic;                                  \
+        goto dispatch;                                          \
+	} while (false)                                             \
+
+#define CONCATENATE()                                           \
+	do                                                          \
+	{                                                           \
+        ObjString* result = concatenate_strings(vm.objects, as_string(SECOND()), as_string(top)); \
+        if (result == nullptr)                                  \
+        {                                                       \
+            runtime_error(vm, "Heap limit exceeded");           \
+            return INTERPRET_RUNTIME_ERROR;                     \
+        }                                                       \
+        REPLACE_TWO(obj_val(result));                           \
+	} while (false)                                             \
+
+// Charges the budget, one decrement and a branch on the hot path. Without
+// a slice the budget starts at UINT32_MAX and is just refilled.
+#define SAFEPOINT()                                             \
+	do                                                          \
+	{                                                           \
+        if (--vm.budget == 0)                                   \
+        {                                                       \
+            SPILL();                                            \
+            if (end_slice(vm))                                  \
+                return INTERPRET_PREEMPTED;                     \
+            sp = vm.stack_top;                                  \
+            top = sp[-1];                                       \
+        }                                                       \
 	} while (false)                                             \
 
     for (;;)
     {
 #ifdef DEBUG_TRACE_EXECUTION
+        SPILL();
         printf("          ");
         for (Value* slot = vm.stack; slot < vm.stack_top; slot++) {
             printf("[ ");
@@ -84,45 +222,82 @@ static InterpretResult run(VM& vm)
         disassemble_instruction(*vm.chunk, int(vm.ip - vm.chunk->code));
 #endif // DEBUG_TRACE_EXECUTION
 
-        uint8_t instruction;
-        switch (instruction = read_byte(vm))
+        uint8_t instruction = read_byte(vm);
+    dispatch:
+        switch (instruction)
         {
         case OP_CONSTANT:
-        {
-            Value constant = read_constant(vm);
-            push(vm, constant);
+            PUSH(read_constant(vm));
             break;
-        }
         case OP_NIL:
-            push(vm, nil_val());
+            PUSH(nil_val());
             break;
         case OP_TRUE:
-            push(vm, bool_val(true));
+            PUSH(bool_val(true));
             break;
         case OP_FALSE:
-            push(vm, bool_val(false));
+            PUSH(bool_val(false));
             break;
-        case OP_EQUAL:
+        case OP_POP:
+            DROP();
+            break;
+        case OP_GET_LOCAL:
+            // The local may be the cached top itself.
+            sp[-1] = top;
+            top = vm.stack[read_byte(vm)];
+            sp++;
+            break;
+        case OP_SET_LOCAL:
+            vm.stack[read_byte(vm)] = top;
+            break;
+        case OP_GET_GLOBAL:
         {
-            Value a = pop(vm);
-            Value b = pop(vm);
-            push(vm, bool_val(values_equal(a, b)));
+            uint16_t index = read_short(vm);
+            Value value = vm.globals.values[vm.global_slots[index]];
+            if (is_undefined(value))
+            {
+                runtime_error(vm, "Undefined variable '%s'", as_cstring(vm.chunk->globals.values[index]));
+                return INTERPRET_RUNTIME_ERROR;
+            }
+            PUSH(value);
             break;
         }
+        case OP_SET_GLOBAL:
+        {
+            // Assignment never defines a global.
+            uint16_t index = read_short(vm);
+            Value& value = vm.globals.values[vm.global_slots[index]];
+            if (is_undefined(value))
+            {
+                runtime_error(vm, "Undefined variable '%s'", as_cstring(vm.chunk->globals.values[index]));
+                return INTERPRET_RUNTIME_ERROR;
+            }
+            value = top;
+            break;
+        }
+        case OP_DEFINE_GLOBAL:
+            vm.globals.values[vm.global_slots[read_short(vm)]] = top;
+            DROP();
+            break;
+        case OP_EQUAL:
+            REPLACE_TWO(bool_val(values_equal(SECOND(), top)));
+            break;
         case OP_GREATER:
-            BINARY_OP(bool_val, > );
+            BINARY_OP(bool_val, >, OP_GREATER_NUM);
             break;
         case OP_LESS:
-            BINARY_OP(bool_val, < );
+            BINARY_OP(bool_val, <, OP_LESS_NUM);
             break;
         case OP_ADD:
-            if (is_string(peek(vm, 0)) && is_string(peek(vm, 1)))
-                concatenate(vm);
-            else if (is_number(peek(vm, 0)) && is_number(peek(vm, 1)))
+            if (is_string(top) && is_string(SECOND()))
             {
-                double b = as_number(pop(vm));
-                double a = as_number(pop(vm));
-                push(vm, number_val(a + b));
+                quicken(vm, OP_ADD_STR_STR);
+                CONCATENATE();
+            }
+            else if (is_number(top) && is_number(SECOND()))
+            {
+                quicken(vm, OP_ADD_NUM_NUM);
+                REPLACE_TWO(number_val(as_number(SECOND()) + as_number(top)));
             }
             else
             {
@@ -130,80 +305,517 @@ static InterpretResult run(VM& vm)
                 return INTERPRET_RUNTIME_ERROR;
             }
             break;
-            BINARY_OP(number_val, +);
-            break;
         case OP_SUBTRACT:
-            BINARY_OP(number_val, -);
+            BINARY_OP(number_val, -, OP_SUBTRACT_NUM);
             break;
         case OP_MULTIPLY:
-            BINARY_OP(number_val, *);
+            BINARY_OP(number_val, *, OP_MULTIPLY_NUM);
             break;
         case OP_DIVIDE:
-            BINARY_OP(number_val, / );
+            BINARY_OP(number_val, /, OP_DIVIDE_NUM);
             break;
         case OP_NOT:
-            push(vm, bool_val(is_falsey(pop(vm))));
+            top = bool_val(is_falsey(top));
             break;
         case OP_NEGATE:
-            if (!is_number(peek(vm, 0)))
+            if (!is_number(top))
             {
                 runtime_error(vm, "Operand must be a number");
                 return INTERPRET_RUNTIME_ERROR;
             }
-            push(vm, number_val(-as_number(pop(vm))));
+            quicken(vm, OP_NEGATE_NUM);
+            top = number_val(-as_number(top));
             break;
+        case OP_PRINT:
+            write_value(vm.output, top);
+            write_output(vm.output, '\n');
+            DROP();
+            break;
+        case OP_JUMP:
+        {
+            uint16_t offset = read_short(vm);
+            vm.ip += offset;
+            break;
+        }
+        case OP_JUMP_IF_FALSE:
+        {
+            uint16_t offset = read_short(vm);
+            if (is_falsey(top))
+                vm.ip += offset;
+            break;
+        }
+        case OP_LOOP:
+        {
+            // Only backward jumps can keep a run going, so only they are
+            // safepoints.
+            uint16_t offset = read_short(vm);
+            vm.ip -= offset;
+            SAFEPOINT();
+            break;
+        }
         case OP_RETURN:
-            print_value(pop(vm));
-            printf("\n");
+            write_value(vm.output, top);
+            write_output(vm.output, '\n');
+            DROP();
+            // fallthrough
+        case OP_HALT:
+            SPILL();
+            if (vm.fiber != nullptr && retire_fiber(vm))
+            {
+                sp = vm.stack_top;
+                top = sp[-1];
+                break;
+            }
             return INTERPRET_OK;
+        case OP_YIELD:
+            // The operand stays on the stack as the value of the yield.
+            if (vm.fiber != nullptr)
+            {
+                SPILL();
+                if (vm.io != nullptr)
+                    complete_reads(vm, false);
+                switch_fiber(vm);
+                sp = vm.stack_top;
+                top = sp[-1];
+            }
+            break;
+        case OP_READ:
+            if (!is_string(top))
+            {
+                runtime_error(vm, "Operand must be a string");
+                return INTERPRET_RUNTIME_ERROR;
+            }
+            SPILL();
+            if (vm.fiber != nullptr && vm.io != nullptr)
+                start_read(vm);
+            else
+                read_now(vm);
+            sp = vm.stack_top;
+            top = sp[-1];
+            break;
+        case OP_GREATER_NUM:
+            BINARY_OP_NUM(bool_val, >, OP_GREATER);
+            break;
+        case OP_LESS_NUM:
+            BINARY_OP_NUM(bool_val, <, OP_LESS);
+            break;
+        case OP_ADD_NUM_NUM:
+            BINARY_OP_NUM(number_val, +, OP_ADD);
+            break;
+        case OP_ADD_STR_STR:
+            if (!is_string(top) || !is_string(SECOND()))
+                DEOPTIMIZE(OP_ADD);
+            CONCATENATE();
+            break;
+        case OP_SUBTRACT_NUM:
+            BINARY_OP_NUM(number_val, -, OP_SUBTRACT);
+            break;
+        case OP_MULTIPLY_NUM:
+            BINARY_OP_NUM(number_val, *, OP_MULTIPLY);
+            break;
+        case OP_DIVIDE_NUM:
+            BINARY_OP_NUM(number_val, /, OP_DIVIDE);
+            break;
+        case OP_NEGATE_NUM:
+            if (!is_number(top))
+                DEOPTIMIZE(OP_NEGATE);
+            top = number_val(-as_number(top));
+            break;
+        case OP_EQUAL_F64:
+            BINARY_OP_F64(bool_val, ==);
+            break;
+        case OP_GREATER_F64:
+            BINARY_OP_F64(bool_val, >);
+            break;
+        case OP_LESS_F64:
+            BINARY_OP_F64(bool_val, <);
+            break;
+        case OP_ADD_F64:
+            BINARY_OP_F64(number_val, +);
+            break;
+        case OP_SUBTRACT_F64:
+            BINARY_OP_F64(number_val, -);
+            break;
+        case OP_MULTIPLY_F64:
+            BINARY_OP_F64(number_val, *);
+            break;
+        case OP_DIVIDE_F64:
+            BINARY_OP_F64(number_val, /);
+            break;
+        case OP_NEGATE_F64:
+            top = number_val(-as_number(top));
+            break;
         }
     }
 
+#undef PUSH
+#undef DROP
+#undef SPILL
+#undef SECOND
+#undef REPLACE_TWO
 #undef BINARY_OP
+#undef BINARY_OP_F64
+#undef BINARY_OP_NUM
+#undef DEOPTIMIZE
+#undef CONCATENATE
+#undef SAFEPOINT
 }
 
-void init_vm(VM& vm)
+static void reset_vm(VM& vm)
 {
     vm.chunk = nullptr;
     vm.ip = 0;
+    vm.compiled = nullptr;
     reset_stack(vm);
+    vm.stack_base = nil_val();
     vm.objects = {};
+    init_global_table(vm.globals);
+    vm.global_slots = nullptr;
+    vm.links = nullptr;
+    vm.link_capacity = 0;
+    vm.quickened = 0;
+    vm.deoptimized = 0;
+    vm.jit = false;
+    vm.optimize = true;
+    vm.registers = false;
+    vm.scan_threads = 0;
+    vm.fibers = nullptr;
+    vm.fiber = nullptr;
+    vm.fiber_bytes = 0;
+    vm.fiber_peak = 0;
+    vm.io = nullptr;
+    vm.slice = 0;
+    vm.budget = UINT32_MAX;
+}
+
+void init_vm(VM& vm)
+{
+    Output output;
+#ifdef DEBUG_TRACE_EXECUTION
+    // Through stdio, so results stay in order with the trace.
+    init_output_file(output, stdout);
+#else
+    init_output_fd(output, 1);
+#endif
+    init_vm(vm, output);
+}
+
+void init_vm(VM& vm, const Output& output)
+{
+    reset_vm(vm);
+    vm.output = output;
+}
+
+// Frees the chunk interpret(vm, source) compiled, once nothing runs it.
+static void free_compiled(VM& vm)
+{
+    if (vm.compiled == nullptr)
+        return;
+    free_chunk(*vm.compiled);
+    FREE(Chunk, vm.compiled);
+    vm.compiled = nullptr;
+}
+
+void abandon_run(VM& vm)
+{
+    vm.chunk = nullptr;
+    vm.ip = nullptr;
+    reset_stack(vm);
+    free_compiled(vm);
 }
 
 void free_vm(VM& vm)
 {
-    if (vm.chunk != nullptr)
+    abandon_run(vm);
+    free_fibers(vm);
+    free_objects(vm.objects);
+    free_output(vm.output);
+    free_global_table(vm.globals);
+    FREE_ARRAY(int, vm.links, vm.link_capacity);
+    reset_vm(vm);
+}
+
+void clear_globals(VM& vm)
+{
+    free_global_table(vm.globals);
+}
+
+// Links the chunk's globals to this VM's slots, for the run about to start.
+static void link_chunk(VM& vm, const Chunk& chunk)
+{
+    if (chunk.globals.count > vm.link_capacity)
     {
-        Chunk& chunk = *vm.chunk;
-        free_chunk(chunk);
+        int old_capacity = vm.link_capacity;
+        while (vm.link_capacity < chunk.globals.count)
+            vm.link_capacity = GROW_CAPACITY(vm.link_capacity);
+        vm.links = GROW_ARRAY(vm.links, int, old_capacity, vm.link_capacity);
     }
-
-    free_objects(vm.objects);
-    init_vm(vm);
+    link_globals(vm.globals, chunk, vm.links);
+    vm.global_slots = vm.links;
 }
 
 InterpretResult interpret(VM& vm, const char* source)
 {
-    Chunk chunk = {};
+    vm.compiled = ALLOCATE(Chunk, 1);
+    Chunk& chunk = *vm.compiled;
     init_chunk(chunk);
 
-    if (!compile(source, chunk, vm.objects))
+    // Earlier output goes out before the compiler reports to stderr, so the
+    // two stay in order.
+    flush_output(vm.output);
+    if (!compile(source, chunk, vm.scan_threads))
     {
-        free_chunk(chunk);
+        free_compiled(vm);
         return INTERPRET_COMPILE_ERROR;
     }
 
+    RegChunk registers;
+    if (vm.registers && compile_registers(chunk, registers))
+    {
+#ifdef DEBUG_PRINT_CODE
+        disassemble_reg_chunk(registers, "registers");
+#endif
+        InterpretResult result = interpret(vm, registers);
+        free_reg_chunk(registers);
+        free_compiled(vm);
+        return result;
+    }
+
+    // The chunk stays with the VM until its run finishes, so a preempted
+    // run can go back to the host; resume_run() frees it.
+    return interpret(vm, chunk);
+}
+
+// Returns the optimized chunk once the chunk has run often enough to be
+// worth it, or the chunk itself.
+static Chunk& tier_up(VM& vm, Chunk& chunk)
+{
+    if (!vm.optimize || chunk.shared)
+        return chunk;
+    if (chunk.optimized != nullptr)
+        return *chunk.optimized;
+    if (chunk.optimize_failed || ++chunk.runs < OPT_THRESHOLD)
+        return chunk;
+
+    Chunk* optimized = ALLOCATE(Chunk, 1);
+    if (!optimize_chunk(chunk, *optimized, vm.objects.limit))
+    {
+        FREE(Chunk, optimized);
+        chunk.optimize_failed = true;
+        return chunk;
+    }
+    chunk.optimized = optimized;
+    return *optimized;
+}
+
+// Runs from vm.ip, keeping the VM's place if the run is preempted.
+static InterpretResult resume_run(VM& vm)
+{
+    InterpretResult result = run(vm);
+    if (result != INTERPRET_PREEMPTED)
+    {
+        vm.chunk = nullptr;
+        vm.ip = nullptr;
+        free_compiled(vm);
+    }
+    return result;
+}
+
+InterpretResult interpret(VM& vm, Chunk& source_chunk)
+{
+    Chunk& chunk = tier_up(vm, source_chunk);
     vm.chunk = &chunk;
     vm.ip = vm.chunk->code;
+    link_chunk(vm, chunk);
 
-    InterpretResult result = run(vm);
+    // Native code charges the same budget at its backward branches.
+    vm.budget = start_slice(vm);
+    if (vm.jit && !chunk.shared)
+        jit_run(vm, chunk);
+    return resume_run(vm);
+}
+
+InterpretResult resume(VM& vm)
+{
+    vm.budget = start_slice(vm);
+    return resume_run(vm);
+}
+
+InterpretResult run_fibers(VM& vm)
+{
+    if (vm.fibers == nullptr)
+        return INTERPRET_OK;
+
+    // run() returns INTERPRET_OK only once the last fiber has finished.
+    InterpretResult result = INTERPRET_OK;
+    load_fiber(vm, *vm.fibers);
+    vm.budget = start_slice(vm);
+    for (;;)
+    {
+        InterpretResult status = run(vm);
+        if (status == INTERPRET_OK)
+            break;
+        if (result == INTERPRET_OK)
+            result = status;
+        if (!retire_fiber(vm))
+            break;
+    }
 
+    vm.fiber = nullptr;
     vm.chunk = nullptr;
     vm.ip = nullptr;
-    free_chunk(chunk);
+    vm.global_slots = nullptr;
     return result;
 }
 
+// Runs register code. Every instruction reads its operands in place and
+// writes its result straight to a register, so nothing is pushed or popped.
+InterpretResult interpret(VM& vm, const RegChunk& chunk)
+{
+    Value* registers = vm.stack;
+    const Value* constants = chunk.constants.values;
+    const uint32_t* ip = chunk.code;
+
+#define RK(operand) \
+    ((operand) & RK_CONSTANT ? constants[(operand) & ~RK_CONSTANT] : registers[operand])
+
+#define REG_ERROR(message)                                      \
+	do                                                          \
+	{                                                           \
+        reg_runtime_error(vm, chunk, ip, message);              \
+        return INTERPRET_RUNTIME_ERROR;                         \
+	} while (false)                                             \
+
+#define REG_BINARY_OP(value_type, op)                           \
+	do                                                          \
+	{                                                           \
+        Value b = RK(reg_b(instruction));                       \
+        Value c = RK(reg_c(instruction));                       \
+        if (!is_number(b) || !is_number(c))                     \
+            REG_ERROR("Operands must be numbers.");             \
+        registers[reg_a(instruction)] =                         \
+            value_type(as_number(b) op as_number(c));           \
+	} while (false)                                             \
+
+#define REG_BINARY_OP_F64(value_type, op)                       \
+	do                                                          \
+	{                                                           \
+        double b = as_number(RK(reg_b(instruction)));           \
+        double c = as_number(RK(reg_c(instruction)));           \
+        registers[reg_a(instruction)] = value_type(b op c);     \
+	} while (false)                                             \
+
+#ifdef DEBUG_TRACE_EXECUTION
+    // Registers are only printed; the code never reads one before writing it.
+    for (int i = 0; i < chunk.registers; i++)
+        registers[i] = nil_val();
+#endif
+
+    for (;;)
+    {
+#ifdef DEBUG_TRACE_EXECUTION
+        printf("          ");
+        for (int i = 0; i < chunk.registers; i++) {
+            printf("[ ");
+            print_value(registers[i]);
+            printf(" ]");
+        }
+        printf("\n");
+        disassemble_reg_instruction(chunk, int(ip - chunk.code));
+#endif // DEBUG_TRACE_EXECUTION
+
+        uint32_t instruction = *ip++;
+        switch (reg_op(instruction))
+        {
+        case ROP_MOVE:
+            registers[reg_a(instruction)] = RK(reg_b(instruction));
+            break;
+        case ROP_LOADK:
+            registers[reg_a(instruction)] = constants[reg_bc(instruction)];
+            break;
+        case ROP_EQUAL:
+            registers[reg_a(instruction)] = bool_val(values_equal(RK(reg_b(instruction)), RK(reg_c(instruction))));
+            break;
+        case ROP_GREATER:
+            REG_BINARY_OP(bool_val, >);
+            break;
+        case ROP_LESS:
+            REG_BINARY_OP(bool_val, <);
+            break;
+        case ROP_ADD:
+        {
+            Value b = RK(reg_b(instruction));
+            Value c = RK(reg_c(instruction));
+            if (is_string(b) && is_string(c))
+            {
+                ObjString* result = concatenate_strings(vm.objects, as_string(b), as_string(c));
+                if (result == nullptr)
+                    REG_ERROR("Heap limit exceeded");
+                registers[reg_a(instruction)] = obj_val(result);
+            }
+            else if (is_number(b) && is_number(c))
+                registers[reg_a(instruction)] = number_val(as_number(b) + as_number(c));
+            else
+                REG_ERROR("Operands must be two numbers or two strings");
+            break;
+        }
+        case ROP_SUBTRACT:
+            REG_BINARY_OP(number_val, -);
+            break;
+        case ROP_MULTIPLY:
+            REG_BINARY_OP(number_val, *);
+            break;
+        case ROP_DIVIDE:
+            REG_BINARY_OP(number_val, /);
+            break;
+        case ROP_NOT:
+            registers[reg_a(instruction)] = bool_val(is_falsey(RK(reg_b(instruction))));
+            break;
+        case ROP_NEGATE:
+        {
+            Value b = RK(reg_b(instruction));
+            if (!is_number(b))
+                REG_ERROR("Operand must be a number");
+            registers[reg_a(instruction)] = number_val(-as_number(b));
+            break;
+        }
+        case ROP_RETURN:
+            write_value(vm.output, RK(reg_b(instruction)));
+            write_output(vm.output, '\n');
+            return INTERPRET_OK;
+        case ROP_EQUAL_F64:
+            REG_BINARY_OP_F64(bool_val, ==);
+            break;
+        case ROP_GREATER_F64:
+            REG_BINARY_OP_F64(bool_val, >);
+            break;
+        case ROP_LESS_F64:
+            REG_BINARY_OP_F64(bool_val, <);
+            break;
+        case ROP_ADD_F64:
+            REG_BINARY_OP_F64(number_val, +);
+            break;
+        case ROP_SUBTRACT_F64:
+            REG_BINARY_OP_F64(number_val, -);
+            break;
+        case ROP_MULTIPLY_F64:
+            REG_BINARY_OP_F64(number_val, *);
+            break;
+        case ROP_DIVIDE_F64:
+            REG_BINARY_OP_F64(number_val, /);
+            break;
+        case ROP_NEGATE_F64:
+            registers[reg_a(instruction)] = number_val(-as_number(RK(reg_b(instruction))));
+            break;
+        }
+    }
+
+#undef RK
+#undef REG_ERROR
+#undef REG_BINARY_OP
+#undef REG_BINARY_OP_F64
+}
+
 void push(VM& vm, Value value)
 {
     *vm.stack_top = value;
@@ -2,30 +2,106 @@
 
 #include "memory.h"
 #include "chunk.h"
+#include "globals.h"
 #include "value.h"
+#include "output.h"
+#include "regchunk.h"
+#include "fiber.h"
+
+struct IoLoop;
 
 enum InterpretResult
 {
     INTERPRET_OK,
     INTERPRET_COMPILE_ERROR,
     INTERPRET_RUNTIME_ERROR,
+    INTERPRET_PREEMPTED, // the slice ran out, see resume()
 };
 
 constexpr int STACK_MAX = 256;
 
 struct VM
 {
-    Chunk* chunk;
+    Chunk* chunk; // running or preempted, never owned by the VM
     uint8_t* ip;
+    Chunk* compiled; // compiled by interpret(vm, source), owned until its run ends
+    Value stack_base; // stands below stack[0] as the top of an empty stack, see run()
     Value stack[STACK_MAX];
     Value* stack_top;
 
-    ObjList objects;
+    ObjList objects; // objects.limit caps the heap, see reserve_heap()
+    Output output;
+
+    // The VM's globals, see globals.h. global_slots maps the running
+    // chunk's global indexes to slots of the table, which cover all of them
+    // before the chunk runs, so run() indexes both unchecked. `links` holds
+    // them for a chunk run by interpret(), and each fiber holds its own.
+    GlobalTable globals;
+    const int* global_slots;
+    int* links;
+    int link_capacity;
+
+    bool jit;       // run chunks through the template JIT where it can
+    bool optimize;  // replace chunks run OPT_THRESHOLD times by optimized ones
+    bool registers; // run source through the register VM where it can
+    int scan_threads; // passed to compile() by interpret(vm, source)
+
+    Fiber* fibers;      // queued fibers, a ring starting with the next to run
+    Fiber* fiber;       // the running fiber, see fiber.h
+    size_t fiber_bytes; // held by queued fibers, their saved stacks included
+    size_t fiber_peak;  // the most fiber_bytes has been
+    IoLoop* io;         // reads from fibers are asynchronous through it, see aio.h
+
+    // Preemption. Backward branches and calls are safepoints: between two of
+    // them a script runs in time bounded by its length. Each charges one
+    // unit of budget, and a run whose budget runs out either switches fiber
+    // or stops with INTERPRET_PREEMPTED, so a runaway script cannot keep
+    // its thread. There are no calls yet; OP_LOOP is the only safepoint.
+    uint32_t slice;  // budget for each run or resume(), 0 for no limit
+    uint32_t budget; // left of the current slice
+
+    // Instruction sites rewritten to a quickened opcode, and quickened
+    // sites whose guard failed and went back to the generic opcode.
+    uint64_t quickened;
+    uint64_t deoptimized;
 };
 
+// Results go to a buffered stdout unless the VM is given its own output,
+// which it then owns. Output is flushed by free_vm, before any error is
+// reported, and whenever the host calls flush_output(vm.output).
 void init_vm(VM& vm);
+void init_vm(VM& vm, const Output& output);
+// Abandons a run left preempted, as free_vm does.
 void free_vm(VM& vm);
 
+// Forgets every global, name and value, as for a VM that never ran
+// anything. No run may be pending, nor any fiber queued.
+void clear_globals(VM& vm);
+
+// Compiles and runs the source. A preempted run continues with resume()
+// like any other, and the VM frees the compiled chunk when the run finishes
+// or is abandoned.
 InterpretResult interpret(VM& vm, const char* source);
+// Runs an already compiled chunk. Unless the chunk is shared (see
+// program.h), quickening may rewrite its code, with vm.jit set the chunk
+// keeps its native code until it is freed, and with vm.optimize set a
+// chunk run often enough keeps an optimized copy, which any VM may run.
+InterpretResult interpret(VM& vm, Chunk& chunk);
+// Continues a run that returned INTERPRET_PREEMPTED, with a fresh slice.
+// Until the run finishes or is abandoned, its chunk must stay alive and the
+// VM must run nothing else.
+InterpretResult resume(VM& vm);
+// Gives up a preempted run: forgets its chunk and place, empties the stack
+// and frees the chunk if interpret(vm, source) compiled it. Globals keep
+// what the run set. Does nothing if no run is pending.
+void abandon_run(VM& vm);
+// Runs register code, see regchunk.h. Registers are the VM's stack slots.
+InterpretResult interpret(VM& vm, const RegChunk& chunk);
+// Runs the fibers queued by spawn_fiber() round-robin until all of them
+// have finished. A runtime error ends only the fiber that raised it; the
+// result is that of the first fiber to fail. A fiber whose slice runs out
+// is switched out as if it had yielded. Fibers are neither optimized nor
+// JIT-compiled.
+InterpretResult run_fibers(VM& vm);
 void push(VM& vm, Value value);
 Value pop(VM& vm);